@@ -4,14 +4,24 @@
  * https://github.com/pauldreik/lemac
  * SPDX-License-Identifier: BSL-1.0
  */
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <span>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <lemac.h>
+#include <lemac_parallel.h>
 
-enum class Strategy { update_and_finalize, oneshot };
+enum class Strategy {
+  update_and_finalize,
+  oneshot,
+  memcpy_and_oneshot,
+  copy_and_oneshot
+};
 
 std::string_view to_string(Strategy s) {
   using enum Strategy;
@@ -20,17 +30,29 @@ std::string_view to_string(Strategy s) {
     return "update_and_finalize";
   case oneshot:
     return "oneshot";
+  case memcpy_and_oneshot:
+    return "memcpy_and_oneshot";
+  case copy_and_oneshot:
+    return "copy_and_oneshot";
   default:
     throw std::runtime_error("oops, did not recognize strategy");
   }
 }
 
 struct options {
+  lemac::backend backend{lemac::current_backend()};
   Strategy strategy{Strategy::update_and_finalize};
   std::size_t hashsize{123};
   std::chrono::nanoseconds runlength{std::chrono::seconds{1}};
+  /// if true, each hash is made on data which is not in the cache, by walking
+  /// through a buffer larger than the last level cache
+  bool cold_cache{false};
 };
 
+/// the size of the buffer used for cold cache measurements. this needs to be
+/// well above the size of the last level cache.
+constexpr std::size_t cold_cache_buffer_size = 512 * 1024 * 1024;
+
 struct results {
   std::size_t total_data_bytes{};
   std::size_t total_iterations{};
@@ -44,9 +66,17 @@ struct results {
 };
 
 results hash(const options& opt) {
-  lemac::LeMac lemac;
+  lemac::LeMac lemac(opt.backend);
 
-  std::vector<std::uint8_t> data(opt.hashsize);
+  std::vector<std::uint8_t> buffer(
+      opt.cold_cache ? std::max(opt.hashsize, cold_cache_buffer_size)
+                     : opt.hashsize,
+      1);
+  const std::size_t nslices =
+      buffer.size() / std::max(opt.hashsize, std::size_t{1});
+  std::size_t slice = 0;
+  // destination for the strategies which copy
+  std::vector<std::uint8_t> copy(opt.hashsize);
 
   std::array<std::uint8_t, 16> out;
   std::array<std::uint8_t, 16> nonce{};
@@ -56,6 +86,9 @@ results hash(const options& opt) {
   const auto deadline = t0 + opt.runlength;
   while (std::chrono::steady_clock::now() < deadline) {
     for (std::size_t i = 0; i < iterations; ++i) {
+      const auto data =
+          std::span(buffer).subspan(slice * opt.hashsize, opt.hashsize);
+      slice = (slice + 1) % nslices;
       lemac.reset();
       switch (opt.strategy) {
       case Strategy::update_and_finalize:
@@ -65,6 +98,13 @@ results hash(const options& opt) {
       case Strategy::oneshot:
         out = lemac.oneshot(data, nonce);
         break;
+      case Strategy::memcpy_and_oneshot:
+        std::memcpy(copy.data(), data.data(), data.size());
+        out = lemac.oneshot(copy, nonce);
+        break;
+      case Strategy::copy_and_oneshot:
+        out = lemac.copy_and_oneshot(copy, data, nonce);
+        break;
       }
       // prevent the optimizer from removing everything
       nonce[0] = out[0];
@@ -81,13 +121,29 @@ results hash(const options& opt) {
   return ret;
 }
 
-void run_testcase(const options& opt) {
-  const auto speed = hash(opt);
-  std::printf("with %7ld byte at a time and strategy %20s: ",
+void print_header(std::span<const lemac::backend> backends) {
+  // pad to match the test case description printed by run_testcase()
+  std::printf("%71s", "");
+  for (const auto b : backends) {
+    std::printf("%32s", std::string{to_string(b)}.c_str());
+  }
+  std::printf("\n");
+}
+
+/// runs the test case once for each backend and prints the results side by
+/// side
+void run_testcase(options opt, std::span<const lemac::backend> backends) {
+  std::printf("with %8ld byte at a time and strategy %20s%s: ",
               static_cast<long>(opt.hashsize),
-              std::string{to_string(opt.strategy)}.c_str());
-  std::printf("hashed with %6.3f GiB/s %6.3f µs/hash\n",
-              speed.data_rate() * 1e-9, speed.hash_rate() * 1e6);
+              std::string{to_string(opt.strategy)}.c_str(),
+              opt.cold_cache ? " (cold)" : "       ");
+  for (const auto b : backends) {
+    opt.backend = b;
+    const auto speed = hash(opt);
+    std::printf("  %7.3f GiB/s %8.3f µs/hash", speed.data_rate() * 1e-9,
+                speed.hash_rate() * 1e6);
+  }
+  std::printf("\n");
 }
 
 auto get_compiler() {
@@ -102,18 +158,74 @@ auto get_compiler() {
 #endif
 }
 
-void run_all() {
+void run_all(std::span<const lemac::backend> backends) {
+  print_header(backends);
   options opt{};
   for (auto strat : {Strategy::update_and_finalize, Strategy::oneshot}) {
     opt.strategy = strat;
     for (auto size : {1, 1024, 16 * 1024, 256 * 1024, 1024 * 1024}) {
       opt.hashsize = size;
-      run_testcase(opt);
+      run_testcase(opt, backends);
+    }
+  }
+
+  // larger than cache, to measure the memory bound case
+  opt.cold_cache = true;
+  for (auto strat : {Strategy::update_and_finalize, Strategy::oneshot,
+                     Strategy::memcpy_and_oneshot,
+                     Strategy::copy_and_oneshot}) {
+    opt.strategy = strat;
+    for (auto size : {1024 * 1024, 16 * 1024 * 1024}) {
+      opt.hashsize = size;
+      run_testcase(opt, backends);
+    }
+  }
+}
+
+/// measures how parallel_oneshot() scales with the number of threads
+void run_parallel_scaling() {
+  const unsigned max_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+  const lemac::LeMac lemac;
+  for (const std::size_t message_size : {64, 1024, 64 * 1024}) {
+    // about 256 MiB in total
+    const std::size_t count = 256 * 1024 * 1024 / message_size;
+    std::vector<std::uint8_t> buffer(count * message_size, 1);
+    std::vector<std::span<const std::uint8_t>> inputs(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      inputs[i] = std::span(buffer).subspan(i * message_size, message_size);
+    }
+    std::vector<lemac::tag> outputs(count);
+
+    double single_thread_rate{};
+    for (unsigned threads = 1; threads <= max_threads; ++threads) {
+      // warm up, then measure
+      lemac::parallel_oneshot(lemac, inputs, outputs, threads);
+      const auto t0 = std::chrono::steady_clock::now();
+      lemac::parallel_oneshot(lemac, inputs, outputs, threads);
+      const auto t1 = std::chrono::steady_clock::now();
+      const std::chrono::duration<double> elapsed = t1 - t0;
+      const auto rate = static_cast<double>(buffer.size()) / elapsed.count();
+      if (threads == 1) {
+        single_thread_rate = rate;
+      }
+      std::printf("parallel_oneshot with %8ld byte messages on %3u threads: "
+                  "%7.3f GiB/s %6.2fx\n",
+                  static_cast<long>(message_size), threads, rate * 1e-9,
+                  rate / single_thread_rate);
     }
   }
 }
 
 int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
   std::printf("compiler: %s\n", get_compiler());
-  run_all();
+  std::printf("default backend: %s\n",
+              std::string{to_string(lemac::current_backend())}.c_str());
+  const auto backends = lemac::available_backends();
+  for (const auto b : backends) {
+    std::printf("tuned kernels for %s:\n%s", std::string{to_string(b)}.c_str(),
+                lemac::to_string(lemac::tune(b)).c_str());
+  }
+  run_all(backends);
+  run_parallel_scaling();
 }
@@ -13,8 +13,17 @@
 #include <cstdint>
 #include <memory>
 #include <span>
-#ifdef LEMAC_INTERNAL_STATE_VISIBILITY
 #include <string>
+#include <string_view>
+#include <vector>
+#include <version>
+
+// std::pmr is not available on all platforms, for instance older macos
+#if defined(__cpp_lib_memory_resource)
+#include <memory_resource>
+#define LEMAC_HAS_MEMORY_RESOURCE 1
+#else
+#define LEMAC_HAS_MEMORY_RESOURCE 0
 #endif
 
 namespace lemac::inline v1 {
@@ -22,9 +31,112 @@ namespace lemac::inline v1 {
 /// the size of the key in bytes
 static constexpr std::size_t key_size = 16;
 
+/// the hash of a message
+using tag = std::array<std::uint8_t, 16>;
+
+/// the implementations of the hash. which ones can be used depends on the
+/// architecture and the cpu, determined at runtime.
+enum class backend {
+  /// amd64 with AES-NI, using 128 bit registers
+  aes128,
+  /// amd64 with VAES, AVX512F and AVX512VL
+  vaes512full,
+  /// arm64 with the Armv8-A cryptographic extension
+  arm64_v8a
+};
+
+/// @return the name of the backend, as accepted by LEMAC_BACKEND
+std::string_view to_string(backend b);
+
+/// @return the backends supported by the running cpu, best first
+std::vector<backend> available_backends();
+
+/**
+ * @return the backend used by LeMac objects constructed without an explicit
+ * backend. this is the best available, unless overridden by setting the
+ * environment variable LEMAC_BACKEND to the name of a backend (see
+ * to_string(backend)). an override which is not recognized or not supported
+ * by the cpu is ignored. the environment is only read once.
+ */
+backend current_backend();
+
+/**
+ * implementation choices for the hash kernels. which combination is the
+ * fastest depends on the compiler, the cpu and the message size, so all of
+ * them are compiled in and the one to use is selected at runtime.
+ */
+struct kernel_options {
+  /// oneshot() finalizes through a separate function instead of inline code
+  bool oneshot_uses_tail{};
+  /// finalize() finalizes through a separate function instead of inline code
+  bool finalize_uses_tail{};
+  /// the four zero blocks absorbed when finalizing are manually unrolled
+  bool unroll_zero_blocks{};
+  /// oneshot() absorbs blocks with inline code instead of a helper function
+  bool inline_processing{};
+
+  bool operator==(const kernel_options&) const = default;
+};
+
+/// the kernel used by oneshot() for messages of at most max_size bytes
+struct size_class_tuning {
+  std::size_t max_size{};
+  kernel_options options{};
+
+  bool operator==(const size_class_tuning&) const = default;
+};
+
+/// the kernels in use for the current cpu
+struct tuning_table {
+  /// used by finalize() and finalize_to(). only finalize_uses_tail and
+  /// unroll_zero_blocks are relevant.
+  kernel_options finalize{};
+  /// used by oneshot(), by increasing message size. finalize_uses_tail is not
+  /// relevant.
+  std::array<size_class_tuning, 4> oneshot{};
+
+  bool operator==(const tuning_table&) const = default;
+};
+
+/**
+ * microbenchmarks the kernel variants of the current backend on the running
+ * cpu and from then on uses the fastest one for each message size class.
+ * until this is called, kernels chosen at compile time are used.
+ *
+ * this takes a few milliseconds. it is thread safe and can be called at any
+ * time, also while other threads are hashing.
+ *
+ * @return the selected kernels
+ */
+tuning_table tune();
+
+/// like tune(), but for the given backend. throws if the backend is not
+/// available.
+tuning_table tune(backend b);
+
+/// @return the kernels currently in use by the current backend
+tuning_table get_tuning_table();
+
+/// @return the kernels currently in use by the given backend. throws if the
+/// backend is not available.
+tuning_table get_tuning_table(backend b);
+
+/// @return a human readable description, for logging
+std::string to_string(const tuning_table& table);
+
 namespace detail {
 // items in this namespace are not part of the public api
 class ImplInterface;
+struct Access;
+
+/// destroys an implementation and gives the memory back to where it came from
+struct ImplDeleter {
+  /// the std::pmr::memory_resource the memory came from, or null for the
+  /// global heap. it is type erased so the layout does not depend on
+  /// LEMAC_HAS_MEMORY_RESOURCE.
+  void* resource{};
+  void operator()(ImplInterface* impl) const noexcept;
+};
 } // namespace detail
 
 /**
@@ -50,9 +162,60 @@ public:
    */
   explicit LeMac(std::span<const std::uint8_t> key);
 
-  LeMac(const LeMac& other) noexcept;
+  /**
+   * constructs a hasher with a zero key, using the given backend instead of
+   * current_backend().
+   *
+   * @param b must be one of available_backends(), otherwise an exception is
+   * thrown.
+   */
+  explicit LeMac(backend b);
+
+  /**
+   * constructs a hasher with a correctly sized key, using the given backend
+   * instead of current_backend().
+   *
+   * @param key the key does not need to be aligned, but it must have the
+   * correct size (lemac::key_size). if not, an exception is thrown.
+   * @param b must be one of available_backends(), otherwise an exception is
+   * thrown.
+   */
+  LeMac(std::span<const std::uint8_t> key, backend b);
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+  /**
+   * constructs a hasher like LeMac(key), with the implementation allocated
+   * from the given resource instead of the global heap. the resource must
+   * outlive this object. copies made by the copy constructor or assignment
+   * are allocated from the global heap, since the resource may not be safe
+   * to use from where the copy is made. use LeMac(other, resource) to copy
+   * into a resource.
+   *
+   * @param resource may be null, meaning the global heap
+   */
+  LeMac(std::span<const std::uint8_t> key,
+        std::pmr::memory_resource* resource);
+
+  /// like LeMac(key, resource), using the given backend
+  LeMac(std::span<const std::uint8_t> key, backend b,
+        std::pmr::memory_resource* resource);
+
+  /**
+   * makes a copy of other, allocated from the given resource instead of the
+   * one other uses.
+   *
+   * @param resource may be null, meaning the global heap
+   */
+  LeMac(const LeMac& other, std::pmr::memory_resource* resource);
+
+  /// @return the resource the implementation is allocated from, null for the
+  /// global heap
+  std::pmr::memory_resource* get_memory_resource() const noexcept;
+#endif
+
+  LeMac(const LeMac& other);
   LeMac(LeMac&& other) noexcept;
-  LeMac& operator=(const LeMac& other) noexcept;
+  LeMac& operator=(const LeMac& other);
   LeMac& operator=(LeMac&& other) noexcept;
   ~LeMac() noexcept;
 
@@ -123,12 +286,86 @@ public:
   oneshot(std::span<const std::uint8_t> data,
           std::span<const std::uint8_t> nonce) const noexcept;
 
+  /**
+   * hashes data with the given nonce and compares the result to expected_tag.
+   * the comparison takes the same time wherever the tags differ, so it does
+   * not reveal how much of the tag is correct.
+   *
+   * @param nonce must be 16 bytes, otherwise an exception is thrown
+   * @param expected_tag must be 16 bytes, otherwise an exception is thrown
+   * @return true if the tag matches
+   */
+  bool verify(std::span<const std::uint8_t> data,
+              std::span<const std::uint8_t> nonce,
+              std::span<const std::uint8_t> expected_tag) const;
+
+  /**
+   * verifies many messages at once, like verify(messages[i], nonces[i],
+   * tags[i]) for all i but with the messages hashed together by the
+   * multi-message kernel of the backend, where it has one.
+   *
+   * @param nonces one 16 byte nonce per message, or empty for zero nonces
+   * @param tags the expected tag of each message
+   * @param results receives the outcome per message. may be empty if only
+   * the combined outcome is of interest.
+   * @return true if all tags match
+   *
+   * throws if the sizes of the arguments do not match.
+   */
+  bool verify_many(std::span<const std::span<const std::uint8_t>> messages,
+                   std::span<const std::span<const std::uint8_t>> nonces,
+                   std::span<const tag> tags, std::span<bool> results) const;
+
+  /**
+   * copies data to dst and updates the hash with it, as if by
+   * std::memcpy(dst.data(), data.data(), data.size()) followed by
+   * update(data), but only reading data from memory once. large copies to a
+   * suitably aligned destination use non-temporal stores where available.
+   *
+   * @param dst must be at least as large as data, otherwise an exception is
+   * thrown. it must not overlap with data. does not need to be aligned.
+   * @param data does not need to be aligned
+   */
+  void copy_and_update(std::span<std::uint8_t> dst,
+                       std::span<const std::uint8_t> data);
+
+  /**
+   * copies data to dst and hashes it, using a zero nonce. see
+   * copy_and_oneshot(dst, data, nonce).
+   */
+  std::array<std::uint8_t, 16>
+  copy_and_oneshot(std::span<std::uint8_t> dst,
+                   std::span<const std::uint8_t> data) const {
+    return copy_and_oneshot(dst, data, zeros);
+  }
+
+  /**
+   * copies data to dst and hashes it, as if by
+   * std::memcpy(dst.data(), data.data(), data.size()) followed by
+   * oneshot(data, nonce), but only reading data from memory once. large
+   * copies to a suitably aligned destination use non-temporal stores where
+   * available.
+   *
+   * @param dst must be at least as large as data, otherwise an exception is
+   * thrown. it must not overlap with data. does not need to be aligned.
+   * @param data does not need to be aligned
+   * @param nonce does not need to be aligned
+   * @return the lemac hash
+   */
+  std::array<std::uint8_t, 16>
+  copy_and_oneshot(std::span<std::uint8_t> dst,
+                   std::span<const std::uint8_t> data,
+                   std::span<const std::uint8_t> nonce) const;
+
   /**
    * resets the object as if it had been newly constructed. this is more
    * efficent than creating a new object.
    */
   void reset() noexcept;
 
+  /// @return the backend this object uses
+  backend get_backend() const noexcept;
+
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
   /**
    * for debugging/development. returns a text representation of the internal
@@ -146,7 +383,9 @@ private:
   ///  at runtime
   /// - to hide implementation detail
   /// - to have a small impact on compile time on user code
-  std::unique_ptr<detail::ImplInterface> m_impl;
+  std::unique_ptr<detail::ImplInterface, detail::ImplDeleter> m_impl;
+
+  friend struct detail::Access;
 };
 
 } // namespace lemac::inline v1
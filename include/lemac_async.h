@@ -0,0 +1,288 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+template <typename T = void> class task;
+
+namespace detail {
+struct task_promise_base {
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> self) const noexcept {
+      if (auto continuation = self.promise().continuation) {
+        return continuation;
+      }
+      return std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  final_awaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() noexcept {
+    exception = std::current_exception();
+  }
+
+  /// resumed when the task is done, if it was awaited
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+};
+
+template <typename T> struct task_promise : task_promise_base {
+  task<T> get_return_object() noexcept;
+  template <typename U> void return_value(U&& v) {
+    value.emplace(std::forward<U>(v));
+  }
+  T result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return std::move(*value);
+  }
+
+  std::optional<T> value;
+};
+
+template <> struct task_promise<void> : task_promise_base {
+  task<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+  void result() {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+/// a read, as seen by the code carrying it out
+struct io_request {
+  int fd{};
+  std::span<std::uint8_t> buffer;
+  /// bytes read, or a negative errno
+  long long result{};
+};
+} // namespace detail
+
+/**
+ * a coroutine producing a T. it starts running when awaited, or by start()
+ * for the outermost one.
+ *
+ * a task must not be destroyed while it waits for a read, since the read
+ * writes into memory owned by the task.
+ */
+template <typename T> class task {
+public:
+  using promise_type = detail::task_promise<T>;
+
+  task() noexcept = default;
+  task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      destroy();
+      m_handle = std::exchange(other.m_handle, {});
+    }
+    return *this;
+  }
+  ~task() { destroy(); }
+
+  /// true if it has run to completion
+  bool done() const noexcept { return m_handle && m_handle.done(); }
+
+  /// runs a task which has not started yet until it first has to wait
+  void start() { m_handle.resume(); }
+
+  /// @return the result of a task which is done, or throws the exception
+  /// it ended with
+  T get() { return m_handle.promise().result(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    m_handle.promise().continuation = awaiter;
+    return m_handle;
+  }
+  T await_resume() { return m_handle.promise().result(); }
+
+private:
+  friend promise_type;
+  explicit task(std::coroutine_handle<promise_type> handle) noexcept
+      : m_handle(handle) {}
+
+  void destroy() noexcept {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+task<T> detail::task_promise<T>::get_return_object() noexcept {
+  return task<T>(
+      std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::task_promise<void>::get_return_object() noexcept {
+  return task<void>(
+      std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+/// how an IoContext reads
+enum class io_backend {
+  /// io_uring where the kernel supports and permits it, otherwise threads
+  automatic,
+  /// io_uring, linux only
+  io_uring,
+  /// blocking reads on a pool of threads. each pending read occupies a
+  /// thread, so this suits files better than idle sockets.
+  threads,
+};
+
+/// @return a human readable name, for logging
+std::string_view to_string(io_backend b);
+
+/**
+ * performs reads for coroutines, and resumes them when their reads are done.
+ *
+ * a single thread drives the context: it calls read(), spawn(), poll() and
+ * run(), and the coroutines are resumed on it. any number of reads may be in
+ * flight at once, so one thread can keep hundreds of files hashing.
+ */
+class IoContext {
+  class Impl;
+
+public:
+  struct options {
+    io_backend backend = io_backend::automatic;
+    /// the size of the io_uring queues. more reads than fit are started as
+    /// earlier ones complete.
+    unsigned queue_depth = 256;
+    /// the number of threads for io_backend::threads
+    unsigned threads = 4;
+  };
+
+  /**
+   * reads into a buffer, started when created. co_await gives the number of
+   * bytes read, zero at the end of the file, or throws std::system_error.
+   * it must be awaited before it is destroyed.
+   */
+  class read_operation : private detail::io_request {
+  public:
+    read_operation(const read_operation& other) = delete;
+    read_operation& operator=(const read_operation& other) = delete;
+
+    bool await_ready() const noexcept { return m_done; }
+    void await_suspend(std::coroutine_handle<> waiter) noexcept {
+      m_waiter = waiter;
+    }
+    std::size_t await_resume() const;
+
+  private:
+    friend class IoContext;
+    read_operation(IoContext& context, int file,
+                   std::span<std::uint8_t> destination)
+        : detail::io_request{file, destination} {
+      context.start(*this);
+    }
+
+    bool m_done{};
+    std::coroutine_handle<> m_waiter;
+  };
+
+  IoContext();
+  explicit IoContext(const options& opts);
+
+  IoContext(const IoContext& other) = delete;
+  IoContext& operator=(const IoContext& other) = delete;
+
+  /// waits for the reads in flight, then destroys the spawned tasks
+  ~IoContext();
+
+  /// the backend in use, never automatic
+  io_backend backend() const noexcept;
+
+  /**
+   * starts reading from fd at its file position into buffer. only one read
+   * at a time may be in flight per file descriptor.
+   */
+  read_operation read(int fd, std::span<std::uint8_t> buffer) {
+    return read_operation(*this, fd, buffer);
+  }
+
+  /// starts a task which the context keeps until it is done
+  void spawn(task<void> t);
+
+  /**
+   * resumes the coroutines whose reads are done, without waiting. if a
+   * spawned task ended with an exception, it is thrown from here (only the
+   * first, if several did).
+   * @return the number of reads which were done
+   */
+  std::size_t poll();
+
+  /// like poll(), but waits for at least one read if there are any in flight
+  std::size_t run_one();
+
+  /// runs until there are no reads in flight
+  void run();
+
+  /**
+   * a file descriptor which polls readable when poll() has work to do, for
+   * use in an event loop. -1 if there is none on this platform.
+   */
+  int completion_fd() const noexcept;
+
+private:
+  void start(read_operation& op);
+  std::size_t process(bool block);
+
+  std::unique_ptr<Impl> m_impl;
+};
+
+/**
+ * starts t and drives io until it is done.
+ * @return the result of t
+ */
+template <typename T> T sync_wait(IoContext& io, task<T> t) {
+  t.start();
+  while (!t.done()) {
+    if (io.run_one() == 0 && !t.done()) {
+      throw std::runtime_error("task waits for something else than io");
+    }
+  }
+  return t.get();
+}
+
+/**
+ * hashes what can be read from fd, from its file position to the end, with
+ * the key of hasher. the next chunk is read while the current one is hashed.
+ * fd may be a file, pipe or socket. the context and fd must outlive the
+ * task.
+ */
+task<tag> async_hash(IoContext& io, LeMac hasher, int fd,
+                     std::array<std::uint8_t, 16> nonce = {},
+                     std::size_t chunk_size = 256 * 1024);
+
+} // namespace lemac::inline v1
@@ -0,0 +1,85 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+/*
+ * a C interface to lemac, for use from C and through foreign function
+ * interfaces of other languages.
+ *
+ * the caller provides the storage for the hasher state, see
+ * lemac_state_size() and lemac_state_alignment(). no function throws, and
+ * none allocates memory apart from the one time detection of the cpu
+ * features on first use.
+ *
+ * a state is a c++ object. it must not be copied or moved by copying its
+ * bytes. set up a new state with lemac_init() instead. a state may be used
+ * by several threads at once only through lemac_oneshot() and
+ * lemac_oneshot_batch(), which do not modify it.
+ *
+ * keys and nonces are 16 bytes, and so are the tags written by the library.
+ * a null nonce means a nonce of all zeros.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the number of bytes of storage a state needs */
+size_t lemac_state_size(void);
+
+/* the alignment the storage of a state needs */
+size_t lemac_state_alignment(void);
+
+/*
+ * sets up a state with the given key in storage, which must be at least
+ * lemac_state_size() bytes and aligned to lemac_state_alignment().
+ *
+ * returns 0 on success, or -1 if storage or key is null or storage is not
+ * aligned. storage is left untouched on failure.
+ */
+int lemac_init(void* storage, const uint8_t* key);
+
+/*
+ * ends the life of the state. the storage may be reused or freed afterwards.
+ */
+void lemac_destroy(void* state);
+
+/* adds data to the message being hashed */
+void lemac_update(void* state, const uint8_t* data, size_t size);
+
+/*
+ * finalizes the message and writes its tag. call lemac_reset() before
+ * hashing another message.
+ */
+void lemac_finalize(void* state, const uint8_t* nonce, uint8_t* tag);
+
+/* puts the state back to how lemac_init() left it, keeping the key */
+void lemac_reset(void* state);
+
+/*
+ * hashes a whole message at once and writes its tag. this is faster than
+ * lemac_update() and lemac_finalize(), and does not modify the state.
+ */
+void lemac_oneshot(const void* state, const uint8_t* data, size_t size,
+                   const uint8_t* nonce, uint8_t* tag);
+
+/*
+ * like lemac_oneshot() for each of count messages, where message i is
+ * data[i] with sizes[i] bytes. nonces is either null, meaning zero nonces
+ * for all messages, or holds one nonce per message. the tags are written one
+ * after the other to tags, which must have room for 16 * count bytes.
+ */
+void lemac_oneshot_batch(const void* state, size_t count,
+                         const uint8_t* const* data, const size_t* sizes,
+                         const uint8_t* const* nonces, uint8_t* tags);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,164 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/**
+ * keeps the hashers for recently used keys, so the key schedule (which costs
+ * about as much as hashing 5 kB) is not redone for keys which are used over
+ * and over. for instance a server with one key per tenant.
+ *
+ * the hashers are shared and immutable, so they can be used by several
+ * threads at once. the least recently used one is dropped when the capacity
+ * is reached, but lives on as long as someone holds on to it.
+ *
+ * each thread keeps its most recent lookups in a small table of its own,
+ * which is consulted without taking a lock. the table does not own the
+ * hashers, so dropping a key (by eviction or clear()) invalidates the tables
+ * of all threads. a dropped hasher which a thread is hashing with at that
+ * moment is destroyed when it is no longer used. one in 64 hits in the table
+ * also moves the key to the front of the eviction order, if the lock happens
+ * to be free.
+ *
+ * all functions are thread safe.
+ */
+class ContextCache {
+public:
+  struct statistics {
+    /// lookups which found the key
+    std::uint64_t hits{};
+    /// lookups which had to make a new hasher
+    std::uint64_t misses{};
+    /// hashers dropped to make room for others
+    std::uint64_t evictions{};
+    /// the number of keys currently in the cache
+    std::size_t entries{};
+  };
+
+  /// the capacity of the cache used by lemac::oneshot(key, data, nonce)
+  static constexpr std::size_t default_capacity = 1024;
+
+  /**
+   * @param capacity the most keys to keep. each takes a bit over 1 kB. must
+   * be positive, otherwise an exception is thrown.
+   */
+  explicit ContextCache(std::size_t capacity = default_capacity);
+
+  ContextCache(const ContextCache& other) = delete;
+  ContextCache& operator=(const ContextCache& other) = delete;
+  ~ContextCache();
+
+  /**
+   * @param key must be lemac::key_size bytes, otherwise an exception is
+   * thrown.
+   * @return a hasher with the given key. only use its const member
+   * functions, such as oneshot() and verify().
+   */
+  std::shared_ptr<const LeMac> get(std::span<const std::uint8_t> key);
+
+  /// like get(key)->oneshot(data, nonce)
+  std::array<std::uint8_t, 16> oneshot(std::span<const std::uint8_t> key,
+                                       std::span<const std::uint8_t> data,
+                                       std::span<const std::uint8_t> nonce);
+
+  /// drops all keys. hashers handed out by get() live on.
+  void clear();
+
+  /// @return a snapshot of the counters
+  statistics get_statistics() const;
+
+  /// @return the cache used by lemac::oneshot(key, data, nonce)
+  static ContextCache& global();
+
+private:
+  using key_type = std::array<std::uint8_t, key_size>;
+
+  struct KeyHash {
+    std::size_t operator()(const key_type& key) const noexcept;
+  };
+
+  struct Node;
+
+  struct Entry {
+    key_type key;
+    std::shared_ptr<const Node> node;
+  };
+
+  /// keeps the hasher found by find() alive while it is in scope
+  class Pin;
+
+  /// finds the hasher through the table of the calling thread, which avoids
+  /// touching the reference count that all threads share
+  const Node& find(std::span<const std::uint8_t> key, Pin& pin);
+
+  /// looks up key in the shared table, making a new hasher if needed
+  std::shared_ptr<const Node> get_shared(const key_type& key);
+
+  /// moves key to the front of the eviction order, unless the lock is taken
+  void touch(const key_type& key);
+
+  /// invalidates the per thread tables after hashers have been moved to
+  /// m_retired, then reclaims. m_mutex must be held.
+  void retire();
+
+  /// destroys the retired hashers which no thread is hashing with. m_mutex
+  /// must be held.
+  void reclaim();
+
+  /// identifies this cache in the per thread tables
+  const std::uint64_t m_id;
+  const std::size_t m_capacity;
+  /// raised when a key is dropped, to invalidate the per thread tables
+  std::atomic<std::uint64_t> m_generation{};
+
+  mutable std::mutex m_mutex;
+  /// most recently used first
+  std::list<Entry> m_lru;
+  std::unordered_map<key_type, std::list<Entry>::iterator, KeyHash> m_index;
+  /// dropped hashers which may still be in use by some thread
+  std::vector<std::shared_ptr<const Node>> m_retired;
+  std::uint64_t m_misses{};
+  std::uint64_t m_evictions{};
+
+  /// hits are counted without the lock, spread over several counters so the
+  /// threads do not fight over one cache line
+  struct alignas(64) HitCounter {
+    std::atomic<std::uint64_t> value{};
+  };
+  std::array<HitCounter, 16> m_hits;
+};
+
+/**
+ * hashes data with the given key and nonce, using a hasher from
+ * ContextCache::global() so hot keys are not set up over and over.
+ *
+ * @param key must be lemac::key_size bytes, otherwise an exception is thrown.
+ * @param nonce must be 16 bytes
+ */
+std::array<std::uint8_t, 16> oneshot(std::span<const std::uint8_t> key,
+                                     std::span<const std::uint8_t> data,
+                                     std::span<const std::uint8_t> nonce);
+
+/// like oneshot(key, data, nonce) with a zero nonce
+std::array<std::uint8_t, 16> oneshot(std::span<const std::uint8_t> key,
+                                     std::span<const std::uint8_t> data);
+
+} // namespace lemac::inline v1
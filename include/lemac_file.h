@@ -0,0 +1,154 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/// how the contents of a file are brought in for hashing
+enum class io_strategy {
+  /// picked by hash_file() depending on the kind and size of the file
+  automatic,
+  /// memory mapping, for regular files
+  mmap,
+  /// read() into a buffer
+  read,
+  /// io_uring on linux, with several reads in flight while hashing. falls
+  /// back to read where io_uring is not available.
+  uring,
+  /// read() on a separate thread into a ring of buffers, which are hashed as
+  /// they fill up. for pipes, where the producer can then run at full speed.
+  reader_thread,
+};
+
+/// @return a human readable name, for logging
+std::string_view to_string(io_strategy strategy);
+
+struct file_options {
+  io_strategy strategy = io_strategy::automatic;
+  /// the nonce the hash is finalized with
+  std::array<std::uint8_t, 16> nonce{};
+  /// the size of the buffer used by the read strategies
+  std::size_t buffer_size = 1024 * 1024;
+  /// bypass the page cache where the platform supports it (O_DIRECT on linux,
+  /// F_NOCACHE on macos). with mmap, the pages are instead dropped from the
+  /// cache once hashed (linux only). the automatic strategy also bypasses it
+  /// for block devices and files too large to stay cached.
+  bool bypass_cache = false;
+  /// how much of a file mmap maps at a time, which bounds the memory used.
+  /// the kernel reads ahead of the part being hashed and the pages behind it
+  /// are unmapped. rounded up to 64 KiB.
+  std::size_t mmap_window = 128 * 1024 * 1024;
+  /// the number of buffers in flight for the uring strategy, at most 16
+  unsigned uring_depth = 4;
+  /// open a file which is a symbolic link to what it points to. if false, it
+  /// fails to open instead (O_NOFOLLOW, not on windows).
+  bool follow_symlinks = true;
+};
+
+struct file_result {
+  tag hash{};
+  /// the strategy which was used in the end. a strategy which does not work
+  /// for the file falls back to read.
+  io_strategy strategy{};
+  /// true if the page cache was bypassed
+  bool bypassed_cache{};
+  /// the number of bytes hashed
+  std::uint64_t bytes{};
+  /// how long it took, in seconds, including opening the file
+  double seconds{};
+
+  double bytes_per_second() const noexcept {
+    return seconds > 0 ? static_cast<double>(bytes) / seconds : 0.0;
+  }
+};
+
+/**
+ * hashes the contents of a file.
+ *
+ * with io_strategy::automatic, small regular files are read, larger ones are
+ * memory mapped, pipes and character devices are read by a separate thread
+ * (given more than one core), and block devices and regular files too large
+ * to stay in the page cache go through io_uring. the buffers are kept by the
+ * calling thread for the next call.
+ *
+ * @param hasher its key is used, its state is overwritten
+ * @return the hash and how it was made
+ *
+ * throws std::system_error if the file can not be opened or read, or is a
+ * directory.
+ */
+file_result hash_file(LeMac& hasher, const std::filesystem::path& path,
+                      const file_options& options = {});
+
+/**
+ * like hash_file(hasher, path, options) for an open file descriptor, which
+ * is read from its current position (unless memory mapped, which is only
+ * done when it is at the start). the descriptor is not closed.
+ *
+ * when bypassing the page cache on linux, O_DIRECT is set with F_SETFL on
+ * the descriptor while it is read and cleared afterwards. the flag belongs
+ * to the open file description, so descriptors duplicated from fd (also in
+ * other processes) read with O_DIRECT meanwhile and must not be used to
+ * read or write at the same time.
+ */
+file_result hash_file(LeMac& hasher, int fd, const file_options& options = {});
+
+/// what became of one of the files given to hash_files()
+struct file_outcome {
+  /// valid unless there is an error
+  file_result result;
+  /// what hash_file() would have thrown, if anything
+  std::exception_ptr error;
+};
+
+/**
+ * hashes several files, like hash_file() on each, for runs over many small
+ * files where the system calls cost more than the hashing.
+ *
+ * with io_strategy::automatic or uring on linux, the files are opened and
+ * stat'ed through io_uring a batch at a time, the small regular ones are read
+ * with one request each and hashed with oneshot(), and all are closed
+ * together. the rest are hashed as by hash_file() once opened. elsewhere, and
+ * with the other strategies, it is the same as calling hash_file() for each.
+ * the time reported for a file hashed in a batch counts from the start of
+ * the batch.
+ *
+ * if io_uring itself fails, the batch closes the files it opened and the
+ * rest are hashed as by hash_file().
+ *
+ * @return one outcome per path, in the same order. errors with the files are
+ * reported there.
+ */
+std::vector<file_outcome>
+hash_files(LeMac& hasher, std::span<const std::filesystem::path> paths,
+           const file_options& options = {});
+
+#if !defined(_WIN32)
+/**
+ * like hash_files(hasher, paths, options) for files in the open directory
+ * dirfd, which is not closed. only the file name of each path is opened, as
+ * with openat(dirfd, name), so the directories on the way are not looked up
+ * again. the whole paths are used in error messages.
+ */
+std::vector<file_outcome>
+hash_files(LeMac& hasher, int dirfd,
+           std::span<const std::filesystem::path> paths,
+           const file_options& options = {});
+#endif
+
+} // namespace lemac::inline v1
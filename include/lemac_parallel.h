@@ -0,0 +1,38 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/**
+ * hashes each of the inputs with a zero nonce and writes the hash of
+ * inputs[i] to outputs[i], the same as proto.oneshot(inputs[i]).
+ *
+ * the work is split into pieces of about the same cost (by the number of
+ * bytes, plus a fixed cost per message), which the threads grab one at a
+ * time so they finish at about the same time even if the message sizes vary
+ * a lot. the pieces start at cache line boundaries of outputs when possible,
+ * so the threads do not write to the same cache lines. proto is shared
+ * between the threads, it is only read.
+ *
+ * @param proto the key and backend of proto are used, its state is not.
+ * @param inputs the messages. they must not overlap with outputs.
+ * @param outputs must have the same size as inputs, throws otherwise.
+ * @param threads the number of threads to use, including the calling thread.
+ * zero means one per cpu core (std::thread::hardware_concurrency()). fewer
+ * are used if there is too little work to make it worthwhile.
+ */
+void parallel_oneshot(const LeMac& proto,
+                      std::span<const std::span<const std::uint8_t>> inputs,
+                      std::span<tag> outputs, unsigned threads = 0);
+
+} // namespace lemac::inline v1
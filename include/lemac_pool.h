@@ -0,0 +1,90 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/**
+ * a fixed number of hashers with the same key, set up once and handed out
+ * ready to use. for code which needs a fresh hasher over and over, such as
+ * one per request, without paying for the key schedule or an allocation
+ * each time.
+ *
+ * the hashers are kept in one block of memory, each on cache lines of its
+ * own so threads using neighbouring hashers do not disturb each other.
+ * handing out and taking back does not take a lock. if all hashers are in
+ * use, acquire() makes an extra one on the heap, which is discarded when it
+ * is given back.
+ *
+ * all functions are thread safe.
+ */
+class HasherPool {
+  struct Slot;
+
+public:
+  /// gives exclusive use of a hasher, returning it to the pool on destruction
+  class handle {
+  public:
+    handle(const handle& other) = delete;
+    handle(handle&& other) noexcept;
+    handle& operator=(const handle& other) = delete;
+    handle& operator=(handle&& other) noexcept;
+    /// resets the hasher and returns it to the pool
+    ~handle();
+
+    LeMac& operator*() const noexcept { return *m_hasher; }
+    LeMac* operator->() const noexcept { return m_hasher; }
+
+  private:
+    friend class HasherPool;
+    explicit handle(Slot* slot) noexcept;
+    explicit handle(const LeMac& prototype);
+    void release() noexcept;
+
+    /// the slot in the pool, or null for an extra hasher
+    Slot* m_slot{};
+    std::optional<LeMac> m_extra;
+    LeMac* m_hasher{};
+  };
+
+  /**
+   * @param key must be lemac::key_size bytes, otherwise an exception is
+   * thrown.
+   * @param size the number of hashers in the pool
+   */
+  HasherPool(std::span<const std::uint8_t> key, std::size_t size);
+
+  HasherPool(const HasherPool& other) = delete;
+  HasherPool& operator=(const HasherPool& other) = delete;
+
+  /// all handles must have been destroyed before the pool is
+  ~HasherPool();
+
+  /// @return a hasher in its initial state
+  handle acquire();
+
+  /// @return the number of hashers in the pool
+  std::size_t size() const noexcept;
+
+  /// @return the number of hashers in the pool which are not in use. this is
+  /// a snapshot, other threads may change it at any time.
+  std::size_t available() const noexcept;
+
+private:
+  struct State;
+  std::unique_ptr<State> m_state;
+};
+
+} // namespace lemac::inline v1
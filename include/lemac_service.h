@@ -0,0 +1,145 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/**
+ * hashes messages submitted from any number of threads on a set of worker
+ * threads, all with the same key. for instance a server which hashes
+ * requests from many connections.
+ *
+ * submitting does not take a lock, and the bookkeeping for a message comes
+ * from a pool instead of the heap. each worker collects the submitted
+ * messages in batches, which amortizes the cost of waking up. on arm64 the
+ * messages of a batch are absorbed two at a time, interleaved. on amd64 a
+ * single message already keeps the aes units busy, so they are hashed one
+ * by one.
+ *
+ * the result is the same as for LeMac::oneshot().
+ */
+class HashService {
+public:
+  /// invoked on a worker thread with the hash of the message. must not throw.
+  using completion = std::function<void(const tag& hash)>;
+
+  struct options {
+    /// the number of worker threads, zero means one per hardware thread
+    unsigned workers = 1;
+    /// the most messages hashed in one batch
+    std::size_t max_batch = 64;
+    /// how long a worker which has found work waits for more to fill up the
+    /// batch. waiting raises throughput under load at the expense of
+    /// latency. the worker spins meanwhile, so keep it short.
+    std::chrono::microseconds max_delay{0};
+  };
+
+  struct statistics {
+    /// messages submitted so far
+    std::uint64_t submitted{};
+    /// messages hashed so far. counted before their completions run.
+    std::uint64_t completed{};
+    /// batches hashed so far
+    std::uint64_t batches{};
+    /// the largest batch so far
+    std::size_t max_batch_size{};
+    /// messages submitted but not yet picked up by a worker
+    std::size_t queue_depth{};
+    /// the most messages a worker has found waiting when picking up work
+    std::size_t max_queue_depth{};
+
+    double mean_batch_size() const noexcept {
+      return batches == 0 ? 0.0 : static_cast<double>(completed) /
+                                       static_cast<double>(batches);
+    }
+  };
+
+  /**
+   * starts the worker threads.
+   *
+   * @param hasher the key (and backend) of hasher is used for all messages.
+   * the state of hasher is not used, only its key.
+   */
+  explicit HashService(const LeMac& hasher);
+  HashService(const LeMac& hasher, const options& opts);
+
+  HashService(const HashService& other) = delete;
+  HashService& operator=(const HashService& other) = delete;
+
+  /// hashes all messages submitted so far, then stops the worker threads.
+  /// nothing may be submitted once destruction has begun.
+  ~HashService();
+
+  /**
+   * hashes the message with the given nonce, which must be 16 bytes (throws
+   * otherwise), and invokes done with the hash on a worker thread.
+   *
+   * the message data must stay valid until done has been invoked. the nonce
+   * is copied.
+   */
+  void submit(std::span<const std::uint8_t> message,
+              std::span<const std::uint8_t> nonce, completion done);
+
+  /// like submit(message, zero nonce, done)
+  void submit(std::span<const std::uint8_t> message, completion done);
+
+  /**
+   * hashes the message with the given nonce, which must be 16 bytes (throws
+   * otherwise). the message data must stay valid until the future is ready.
+   */
+  std::future<tag> submit(std::span<const std::uint8_t> message,
+                          std::span<const std::uint8_t> nonce);
+
+  /// like submit(message, zero nonce)
+  std::future<tag> submit(std::span<const std::uint8_t> message);
+
+  /// @return a snapshot of the counters. they are updated independently, so
+  /// the snapshot is not necessarily consistent while work is ongoing.
+  statistics get_statistics() const noexcept;
+
+  /// @return the number of worker threads
+  std::size_t workers() const noexcept;
+
+private:
+  struct Request;
+  struct Worker;
+
+  /// @return the worker which the calling thread submits to
+  Worker& pick_worker() noexcept;
+
+  /// @return a request from the pool of worker, or from the heap if the pool
+  /// is empty
+  static Request* acquire(Worker& worker);
+
+  /// returns a completed request to the pool of worker (or the heap)
+  static void release(Worker& worker, Request* request) noexcept;
+
+  void push(Worker& worker, Request* request) noexcept;
+
+  /// the main loop of a worker thread
+  void run(Worker& worker) noexcept;
+
+  /// makes the started workers finish their queues and joins them
+  void stop_workers() noexcept;
+
+  LeMac m_hasher;
+  options m_options;
+  std::unique_ptr<Worker[]> m_workers;
+  std::size_t m_nworkers{};
+};
+
+} // namespace lemac::inline v1
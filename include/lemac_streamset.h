@@ -0,0 +1,124 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "lemac.h"
+
+namespace lemac::inline v1 {
+
+/**
+ * hashes many messages at the same time with the same key, for instance one
+ * per network connection, where the data for each message arrives in pieces.
+ *
+ * data is enqueued per stream and absorbed in whole blocks when flush() is
+ * called. on arm64 two streams are absorbed interleaved, so the latency of
+ * the aes instructions of one is hidden behind the work on the other. on
+ * amd64 a single stream already keeps the aes units busy and the streams are
+ * absorbed one after another. the gain there is that small, irregular pieces
+ * are absorbed in fewer and larger steps, and that each stream needs much
+ * less memory than a LeMac object.
+ *
+ * the result is the same as for LeMac::update() followed by
+ * LeMac::finalize().
+ *
+ * a StreamSet is not thread safe.
+ */
+class StreamSet {
+public:
+  using stream_id = std::size_t;
+
+  /**
+   * @param hasher the key (and backend) of hasher is used for all streams.
+   * the state of hasher is not used, only its key.
+   */
+  explicit StreamSet(const LeMac& hasher);
+
+  StreamSet(const StreamSet& other) = delete;
+  StreamSet(StreamSet&& other) noexcept;
+  StreamSet& operator=(const StreamSet& other) = delete;
+  StreamSet& operator=(StreamSet&& other) noexcept;
+  ~StreamSet();
+
+  /**
+   * starts a new message. the ids of finalized or closed streams are reused.
+   * @return the id of the new stream
+   */
+  stream_id open();
+
+  /**
+   * appends data to the message of the given stream. the data does not need
+   * to outlive the call. small pieces are copied and absorbed by flush() or
+   * finalize(), large pieces are absorbed directly.
+   *
+   * throws if id is not an open stream.
+   */
+  void enqueue(stream_id id, std::span<const std::uint8_t> data);
+
+  /**
+   * absorbs all whole blocks enqueued so far, for all streams. partial
+   * blocks are kept until more data arrives or the stream is finalized.
+   */
+  void flush();
+
+  /**
+   * absorbs the remaining data of the stream and finalizes it with a zero
+   * nonce. the stream is closed afterwards.
+   *
+   * throws if id is not an open stream.
+   */
+  std::array<std::uint8_t, 16> finalize(stream_id id);
+
+  /**
+   * absorbs the remaining data of the stream and finalizes it with the given
+   * nonce. the stream is closed afterwards.
+   *
+   * throws if id is not an open stream.
+   */
+  std::array<std::uint8_t, 16> finalize(stream_id id,
+                                        std::span<const std::uint8_t> nonce);
+
+  /**
+   * discards the stream without finalizing it.
+   *
+   * throws if id is not an open stream.
+   */
+  void close(stream_id id);
+
+  /// @return the number of open streams
+  std::size_t size() const noexcept { return m_open_streams; }
+
+  /// @return the number of enqueued bytes which have not been absorbed yet
+  std::size_t pending_bytes() const noexcept;
+
+private:
+  struct Stream;
+
+  /// the maximum number of streams absorbed together
+  static constexpr std::size_t group_size = 8;
+
+  /// enqueued data reaching this many bytes is absorbed directly
+  static constexpr std::size_t direct_threshold = 512;
+
+  Stream& get_open(stream_id id);
+
+  /// absorbs the whole blocks pending in at most group_size streams
+  void absorb(std::span<Stream* const> streams);
+
+  LeMac m_hasher;
+  std::vector<Stream> m_streams;
+  /// ids of closed streams, for reuse
+  std::vector<stream_id> m_free;
+  std::size_t m_open_streams{};
+};
+
+} // namespace lemac::inline v1
@@ -7,21 +7,71 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <new>
 #include <span>
+#include <type_traits>
+#include <utility>
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
 #include <string>
 #endif
 
+#include "lemac.h"
+
 namespace lemac::inline v1 {
 
 namespace detail {
 
+/// upper limits (inclusive) of the message size classes, for which the
+/// oneshot kernel is selected separately. see lemac::tune().
+inline constexpr std::array<std::size_t, 4> size_class_limits{
+    256, 4 * 1024, 64 * 1024, SIZE_MAX};
+
+/// @return the index into size_class_limits for a message of the given size
+constexpr std::size_t size_class(const std::size_t message_size) noexcept {
+  std::size_t i = 0;
+  while (message_size > size_class_limits[i]) {
+    ++i;
+  }
+  return i;
+}
+
+/// the size of the blocks the message is absorbed in
+inline constexpr std::size_t block_size = 64;
+
+/// the absorption state of a single message, so many messages can be hashed
+/// with the same keyed context without a full hasher each. the contents are
+/// private to the backend which initialized it.
+struct alignas(16) StreamState {
+  std::array<std::byte, 13 * 16> storage;
+};
+
+class ImplInterface;
+
+/// the size and alignment of an implementation object
+struct object_layout {
+  std::size_t size;
+  std::size_t alignment;
+};
+
+/// owns an implementation, wherever it was allocated
+using impl_ptr = std::unique_ptr<ImplInterface, ImplDeleter>;
+
 class ImplInterface {
 public:
   virtual ~ImplInterface() = default;
-  virtual std::unique_ptr<detail::ImplInterface> clone() const noexcept = 0;
+  virtual impl_ptr clone() const = 0;
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+  /// like clone(), but allocated from resource (null means the global heap)
+  virtual impl_ptr clone(std::pmr::memory_resource* resource) const = 0;
+
+  /// destroys this object and gives its memory back to resource, which it
+  /// must have been allocated from
+  virtual void destroy(std::pmr::memory_resource* resource) noexcept = 0;
+#endif
 
   virtual void update(std::span<const std::uint8_t> data) noexcept = 0;
 
@@ -34,11 +84,84 @@ public:
 
   virtual void reset() noexcept = 0;
 
+  /// like update(data), but also copies data to dst which must have room for
+  /// data.size() bytes and not overlap with data
+  virtual void copy_and_update(std::uint8_t* dst,
+                               std::span<const std::uint8_t> data) noexcept = 0;
+
+  /// like oneshot(data, nonce), but also copies data to dst which must have
+  /// room for data.size() bytes and not overlap with data
+  virtual std::array<std::uint8_t, 16>
+  copy_and_oneshot(std::uint8_t* dst, std::span<const std::uint8_t> data,
+                   std::span<const std::uint8_t> nonce) const noexcept = 0;
+
+  virtual backend get_backend() const noexcept = 0;
+
+  /// @return the number of messages absorb_streams() works on at once. if
+  /// one, hashing messages one at a time with oneshot() is faster.
+  virtual std::size_t stream_interleave() const noexcept = 0;
+
+  /// sets state to the initial state of a message
+  virtual void init_stream(StreamState& state) const noexcept = 0;
+
+  /// absorbs nblocks whole blocks from data[i] into states[i], for all i.
+  /// states and data must have the same size. the work on the messages is
+  /// interleaved, so the aesenc chains of one can run while the others wait.
+  virtual void absorb_streams(std::span<StreamState* const> states,
+                              std::span<const std::uint8_t* const> data,
+                              std::size_t nblocks) const noexcept = 0;
+
+  /// absorbs the final, partial block tail (less than block_size bytes)
+  /// into state and writes the hash to target. state is consumed.
+  virtual void finalize_stream(StreamState& state,
+                               std::span<const std::uint8_t> tail,
+                               std::span<const std::uint8_t> nonce,
+                               std::span<std::uint8_t, 16> target) const
+      noexcept = 0;
+
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
   virtual std::string get_internal_state() const noexcept = 0;
 #endif
 };
 
+#if LEMAC_HAS_MEMORY_RESOURCE
+/// constructs a T from args, allocated from resource (null means the global
+/// heap)
+template <typename T, typename... Args>
+impl_ptr make_in(std::pmr::memory_resource* resource, Args&&... args) {
+  static_assert(std::is_nothrow_constructible_v<T, Args&&...>);
+  if (resource == nullptr) {
+    return impl_ptr(new T(std::forward<Args>(args)...));
+  }
+  void* const memory = resource->allocate(sizeof(T), alignof(T));
+  return impl_ptr(new (memory) T(std::forward<Args>(args)...),
+                  ImplDeleter{resource});
+}
+
+/// the counterpart of make_in()
+template <typename T>
+void destroy_in(T* object, std::pmr::memory_resource* resource) noexcept {
+  object->~T();
+  resource->deallocate(object, sizeof(T), alignof(T));
+}
+#endif
+
+/// @return a layout which fits the implementation of any of the backends
+object_layout impl_layout() noexcept;
+
+/// constructs the implementation for current_backend() with the given key in
+/// memory, which must fit impl_layout(). it is destroyed by calling the
+/// destructor directly.
+ImplInterface* make_impl_at(void* memory,
+                            std::span<const std::uint8_t, key_size> key);
+
+/// gives the library internals access to the implementation of a LeMac
+struct Access {
+  static const ImplInterface& impl(const LeMac& hasher) noexcept {
+    return *hasher.m_impl;
+  }
+};
+
 } // namespace detail
 
 } // namespace lemac::inline v1
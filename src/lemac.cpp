@@ -8,11 +8,17 @@
  * SPDX-License-Identifier: BSL-1.0
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>   // SIZE_MAX
 #include <cstdlib>   // std::abort
+#include <cstring>   // std::memcpy
 #include <stdexcept> // std::runtime_error
+#include <string>
 
+#include "impl_interface.h"
 #include "lemac.h"
+#include "lemac_batch.h"
 
 #if defined(LEMAC_ARCH_IS_AMD64)
 #include "lemac_aesni.h"
@@ -26,70 +32,250 @@
 
 namespace lemac::inline v1 {
 
-LeMac::LeMac() noexcept {
+namespace {
+/// zeros which can be used as a key
+constexpr std::array<const std::uint8_t, key_size> zero_key{};
 
+/// the backends compiled in for this architecture, best first
+constexpr std::array compiled_backends{
 #if defined(LEMAC_ARCH_IS_AMD64)
-  switch (lemac::get_aesni_support_level()) {
-  case AESNI_variant::aes128:
-    m_impl = make_aesni<AESNI_variant::aes128>();
-    break;
-  case AESNI_variant::vaes512full:
-    m_impl = make_aesni<AESNI_variant::vaes512full>();
-    break;
+    backend::vaes512full, backend::aes128
+#elif defined(LEMAC_ARCH_IS_ARM64)
+    backend::arm64_v8a
+#else
+#error "unsupported architecture"
+#endif
+};
+
+bool is_supported_by_cpu(const backend b) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  const auto level = lemac::get_aesni_support_level();
+  switch (b) {
+  case backend::aes128:
+    return level >= AESNI_variant::aes128;
+  case backend::vaes512full:
+    return level >= AESNI_variant::vaes512full;
+  default:
+    return false;
+  }
+#elif defined(LEMAC_ARCH_IS_ARM64)
+  return b == backend::arm64_v8a && supports_arm64v8a_crypto();
+#else
+#error "unsupported architecture"
+#endif
+}
+
+detail::impl_ptr make_impl(const backend b,
+                           std::span<const std::uint8_t, key_size> key) {
+  switch (b) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  case backend::aes128:
+    return make_aesni<AESNI_variant::aes128>(key);
+  case backend::vaes512full:
+    return make_aesni<AESNI_variant::vaes512full>(key);
+#elif defined(LEMAC_ARCH_IS_ARM64)
+  case backend::arm64_v8a:
+    return make_arm64_v8A(key);
+#else
+#error "unsupported architecture"
+#endif
   default:
     // unsupported!
     std::abort();
   }
+}
 
+#if LEMAC_HAS_MEMORY_RESOURCE
+detail::impl_ptr make_impl(const backend b,
+                           std::span<const std::uint8_t, key_size> key,
+                           std::pmr::memory_resource* resource) {
+  switch (b) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  case backend::aes128:
+    return make_aesni<AESNI_variant::aes128>(key, resource);
+  case backend::vaes512full:
+    return make_aesni<AESNI_variant::vaes512full>(key, resource);
 #elif defined(LEMAC_ARCH_IS_ARM64)
-  if (supports_arm64v8a_crypto()) {
-    m_impl = make_arm64_v8A();
-  } else {
+  case backend::arm64_v8a:
+    return make_arm64_v8A(key, resource);
+#else
+#error "unsupported architecture"
+#endif
+  default:
     // unsupported!
     std::abort();
   }
+}
+#endif
+
+detail::ImplInterface*
+make_impl_at(const backend b, void* memory,
+             std::span<const std::uint8_t, key_size> key) {
+  switch (b) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  case backend::aes128:
+    return make_aesni_at<AESNI_variant::aes128>(memory, key);
+  case backend::vaes512full:
+    return make_aesni_at<AESNI_variant::vaes512full>(memory, key);
+#elif defined(LEMAC_ARCH_IS_ARM64)
+  case backend::arm64_v8a:
+    return make_arm64_v8A_at(memory, key);
 #else
 #error "unsupported architecture"
 #endif
+  default:
+    // unsupported!
+    std::abort();
+  }
 }
 
-LeMac::LeMac(std::span<const uint8_t> key) {
+/// the best backend, unless overridden with the LEMAC_BACKEND environment
+/// variable. an override which is not recognized or not supported by the
+/// cpu is ignored.
+backend select_default_backend() {
+  const auto available = available_backends();
+  if (available.empty()) {
+    // unsupported!
+    std::abort();
+  }
+#if defined(_MSC_VER)
+#pragma warning(suppress : 4996) // getenv is not thread safe
+#endif
+  if (const char* name = std::getenv("LEMAC_BACKEND")) {
+    for (const auto b : available) {
+      if (to_string(b) == name) {
+        return b;
+      }
+    }
+  }
+  return available.front();
+}
 
+std::span<const std::uint8_t, key_size>
+checked_key(std::span<const std::uint8_t> key) {
   if (key.size() != lemac::key_size) {
     throw std::runtime_error("wrong size of key");
   }
+  return key.first<lemac::key_size>();
+}
+
+backend checked_backend(const backend b) {
+  if (!is_supported_by_cpu(b)) {
+    throw std::runtime_error("backend " + std::string{to_string(b)} +
+                             " is not supported on this cpu");
+  }
+  return b;
+}
+
+/// compares two tags without branching on their contents, so the time taken
+/// does not depend on where they differ
+bool tags_equal(const std::uint8_t* a, const std::uint8_t* b) noexcept {
+  std::uint64_t a0, a1, b0, b1;
+  std::memcpy(&a0, a, 8);
+  std::memcpy(&a1, a + 8, 8);
+  std::memcpy(&b0, b, 8);
+  std::memcpy(&b1, b + 8, 8);
+  return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+}
 
-  const auto right_size_key = key.first<lemac::key_size>();
+/// the number of messages verify_many() hashes at a time
+constexpr std::size_t verify_chunk = 64;
+} // namespace
 
+detail::object_layout detail::impl_layout() noexcept {
+  const std::array layouts{
 #if defined(LEMAC_ARCH_IS_AMD64)
-  switch (lemac::get_aesni_support_level()) {
-  case AESNI_variant::aes128:
-    m_impl = make_aesni<AESNI_variant::aes128>(right_size_key);
-    break;
-  case AESNI_variant::vaes512full:
-    m_impl = make_aesni<AESNI_variant::vaes512full>(right_size_key);
-    break;
-  default:
-    // unsupported!
-    std::abort();
-  }
+      aesni_layout<AESNI_variant::aes128>(),
+      aesni_layout<AESNI_variant::vaes512full>()
 #elif defined(LEMAC_ARCH_IS_ARM64)
-  if (supports_arm64v8a_crypto()) {
-    m_impl = make_arm64_v8A(right_size_key);
-  } else {
-    // unsupported!
-    std::abort();
-  }
+      arm64_v8A_layout()
 #else
 #error "unsupported architecture"
 #endif
+  };
+  object_layout ret{0, 1};
+  for (const auto& layout : layouts) {
+    ret.size = std::max(ret.size, layout.size);
+    ret.alignment = std::max(ret.alignment, layout.alignment);
+  }
+  return ret;
+}
+
+detail::ImplInterface*
+detail::make_impl_at(void* memory,
+                     std::span<const std::uint8_t, key_size> key) {
+  return lemac::make_impl_at(current_backend(), memory, key);
+}
+
+void detail::ImplDeleter::operator()(ImplInterface* impl) const noexcept {
+#if LEMAC_HAS_MEMORY_RESOURCE
+  if (resource) {
+    impl->destroy(static_cast<std::pmr::memory_resource*>(resource));
+    return;
+  }
+#endif
+  delete impl;
 }
 
-LeMac::LeMac(const LeMac& other) noexcept { m_impl = other.m_impl->clone(); }
+std::string_view to_string(const backend b) {
+  switch (b) {
+  case backend::aes128:
+    return "aes128";
+  case backend::vaes512full:
+    return "vaes512full";
+  case backend::arm64_v8a:
+    return "arm64_v8a";
+  }
+  return "unknown";
+}
+
+std::vector<backend> available_backends() {
+  std::vector<backend> ret;
+  for (const auto b : compiled_backends) {
+    if (is_supported_by_cpu(b)) {
+      ret.push_back(b);
+    }
+  }
+  return ret;
+}
+
+backend current_backend() {
+  static const auto cached_value = select_default_backend();
+  return cached_value;
+}
+
+LeMac::LeMac() noexcept : m_impl(make_impl(current_backend(), zero_key)) {}
+
+LeMac::LeMac(std::span<const uint8_t> key)
+    : m_impl(make_impl(current_backend(), checked_key(key))) {}
+
+LeMac::LeMac(const backend b)
+    : m_impl(make_impl(checked_backend(b), zero_key)) {}
+
+LeMac::LeMac(std::span<const uint8_t> key, const backend b)
+    : m_impl(make_impl(checked_backend(b), checked_key(key))) {}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+LeMac::LeMac(std::span<const uint8_t> key, std::pmr::memory_resource* resource)
+    : m_impl(make_impl(current_backend(), checked_key(key), resource)) {}
+
+LeMac::LeMac(std::span<const uint8_t> key, const backend b,
+             std::pmr::memory_resource* resource)
+    : m_impl(make_impl(checked_backend(b), checked_key(key), resource)) {}
+
+LeMac::LeMac(const LeMac& other, std::pmr::memory_resource* resource)
+    : m_impl(other.m_impl->clone(resource)) {}
+
+std::pmr::memory_resource* LeMac::get_memory_resource() const noexcept {
+  return static_cast<std::pmr::memory_resource*>(m_impl.get_deleter().resource);
+}
+#endif
+
+LeMac::LeMac(const LeMac& other) { m_impl = other.m_impl->clone(); }
 
 LeMac::LeMac(LeMac&& other) noexcept { m_impl = std::move(other.m_impl); }
 
-LeMac& LeMac::operator=(const LeMac& other) noexcept {
+LeMac& LeMac::operator=(const LeMac& other) {
   m_impl = other.m_impl->clone();
   return *this;
 }
@@ -137,6 +323,83 @@ void LeMac::reset() noexcept {
   m_impl->reset();
 }
 
+void LeMac::copy_and_update(std::span<uint8_t> dst,
+                            std::span<const uint8_t> data) {
+  assert(m_impl && "copy_and_update(dst, data) called on a moved from object!");
+  if (dst.size() < data.size()) {
+    throw std::runtime_error("destination is too small");
+  }
+  m_impl->copy_and_update(dst.data(), data);
+}
+
+std::array<uint8_t, 16>
+LeMac::copy_and_oneshot(std::span<uint8_t> dst, std::span<const uint8_t> data,
+                        std::span<const uint8_t> nonce) const {
+  assert(m_impl &&
+         "copy_and_oneshot(dst, data, nonce) called on a moved from object!");
+  if (dst.size() < data.size()) {
+    throw std::runtime_error("destination is too small");
+  }
+  return m_impl->copy_and_oneshot(dst.data(), data, nonce);
+}
+
+bool LeMac::verify(std::span<const uint8_t> data,
+                   std::span<const uint8_t> nonce,
+                   std::span<const uint8_t> expected_tag) const {
+  assert(m_impl && "verify(data, nonce, tag) called on a moved from object!");
+  if (nonce.size() != 16) {
+    throw std::runtime_error("wrong size of nonce");
+  }
+  if (expected_tag.size() != 16) {
+    throw std::runtime_error("wrong size of tag");
+  }
+  const auto actual = m_impl->oneshot(data, nonce);
+  return tags_equal(actual.data(), expected_tag.data());
+}
+
+bool LeMac::verify_many(std::span<const std::span<const uint8_t>> messages,
+                        std::span<const std::span<const uint8_t>> nonces,
+                        std::span<const tag> tags,
+                        std::span<bool> results) const {
+  assert(m_impl && "verify_many(...) called on a moved from object!");
+  if (!nonces.empty() && nonces.size() != messages.size()) {
+    throw std::runtime_error("nonces and messages must have the same size");
+  }
+  if (tags.size() != messages.size()) {
+    throw std::runtime_error("tags and messages must have the same size");
+  }
+  if (!results.empty() && results.size() != messages.size()) {
+    throw std::runtime_error("results and messages must have the same size");
+  }
+  for (const auto& nonce : nonces) {
+    if (nonce.size() != 16) {
+      throw std::runtime_error("wrong size of nonce");
+    }
+  }
+
+  bool all_valid = true;
+  std::array<tag, verify_chunk> actual;
+  for (std::size_t i = 0; i < messages.size(); i += verify_chunk) {
+    const auto n = std::min(verify_chunk, messages.size() - i);
+    detail::oneshot_batch(*m_impl, messages.subspan(i, n),
+                          nonces.empty() ? nonces : nonces.subspan(i, n),
+                          std::span(actual).first(n));
+    for (std::size_t j = 0; j < n; ++j) {
+      const bool valid = tags_equal(actual[j].data(), tags[i + j].data());
+      all_valid = all_valid && valid;
+      if (!results.empty()) {
+        results[i + j] = valid;
+      }
+    }
+  }
+  return all_valid;
+}
+
+backend LeMac::get_backend() const noexcept {
+  assert(m_impl && "get_backend() called on a moved from object!");
+  return m_impl->get_backend();
+}
+
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
 std::string LeMac::get_internal_state() const noexcept {
   assert(m_impl && "get_internal_state() called on a moved from object!");
@@ -144,4 +407,67 @@ std::string LeMac::get_internal_state() const noexcept {
 }
 #endif
 
+tuning_table tune() { return tune(current_backend()); }
+
+tuning_table tune(const backend b) {
+  switch (checked_backend(b)) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  case backend::aes128:
+    return tune_aesni<AESNI_variant::aes128>();
+  case backend::vaes512full:
+    return tune_aesni<AESNI_variant::vaes512full>();
+#elif defined(LEMAC_ARCH_IS_ARM64)
+  case backend::arm64_v8a:
+    return tune_arm64_v8A();
+#else
+#error "unsupported architecture"
+#endif
+  default:
+    // unsupported!
+    std::abort();
+  }
+}
+
+tuning_table get_tuning_table() { return get_tuning_table(current_backend()); }
+
+tuning_table get_tuning_table(const backend b) {
+  switch (checked_backend(b)) {
+#if defined(LEMAC_ARCH_IS_AMD64)
+  case backend::aes128:
+    return get_aesni_tuning_table<AESNI_variant::aes128>();
+  case backend::vaes512full:
+    return get_aesni_tuning_table<AESNI_variant::vaes512full>();
+#elif defined(LEMAC_ARCH_IS_ARM64)
+  case backend::arm64_v8a:
+    return get_arm64_v8A_tuning_table();
+#else
+#error "unsupported architecture"
+#endif
+  default:
+    // unsupported!
+    std::abort();
+  }
+}
+
+std::string to_string(const tuning_table& table) {
+  auto flag = [](const char* name, bool value) {
+    return std::string(" ") + name + "=" + (value ? "1" : "0");
+  };
+  std::string ret = "finalize:";
+  ret += flag("finalize_uses_tail", table.finalize.finalize_uses_tail);
+  ret += flag("unroll_zero_blocks", table.finalize.unroll_zero_blocks);
+  ret.push_back('\n');
+  for (const auto& e : table.oneshot) {
+    ret += "oneshot ";
+    ret += e.max_size == SIZE_MAX ? std::string("any size")
+                                   : "<= " + std::to_string(e.max_size);
+    ret += ":";
+    ret += flag("oneshot_uses_tail", e.options.oneshot_uses_tail);
+    ret += flag("unroll_zero_blocks", e.options.unroll_zero_blocks);
+    ret += flag("inline_processing", e.options.inline_processing);
+    ret.push_back('\n');
+  }
+  return ret;
+}
+
 } // namespace lemac::inline v1
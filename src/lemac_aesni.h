@@ -24,10 +24,28 @@ enum class AESNI_variant {
   vaes512full
 };
 
+template <AESNI_variant variant> detail::impl_ptr make_aesni();
+
+template <AESNI_variant variant>
+detail::impl_ptr make_aesni(std::span<const std::uint8_t, key_size>);
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+/// like make_aesni(key), allocated from resource
 template <AESNI_variant variant>
-std::unique_ptr<detail::ImplInterface> make_aesni();
+detail::impl_ptr make_aesni(std::span<const std::uint8_t, key_size>,
+                            std::pmr::memory_resource* resource);
+#endif
 
+/// constructs the implementation in memory, which must fit
+/// aesni_layout<variant>()
 template <AESNI_variant variant>
-std::unique_ptr<detail::ImplInterface>
-    make_aesni(std::span<const std::uint8_t, key_size>);
+detail::ImplInterface* make_aesni_at(void* memory,
+                                     std::span<const std::uint8_t, key_size>);
+
+template <AESNI_variant variant> detail::object_layout aesni_layout() noexcept;
+
+/// selects the fastest kernels for the running cpu, see lemac::tune()
+template <AESNI_variant variant> tuning_table tune_aesni();
+
+template <AESNI_variant variant> tuning_table get_aesni_tuning_table();
 } // namespace lemac::inline v1
@@ -11,14 +11,39 @@ namespace lemac::inline v1 {
 
 constexpr auto level = AESNI_variant::aes128;
 
-template <> std::unique_ptr<detail::ImplInterface> make_aesni<level>() {
-  return std::make_unique<AESNI<level>::LeMacAESNI>();
+template <> detail::impl_ptr make_aesni<level>() {
+  return detail::impl_ptr{new AESNI<level>::LeMacAESNI()};
 }
 
 template <>
-std::unique_ptr<detail::ImplInterface>
+detail::impl_ptr
 make_aesni<level>(std::span<const std::uint8_t, key_size> key) {
-  return std::make_unique<AESNI<level>::LeMacAESNI>(key);
+  return detail::impl_ptr{new AESNI<level>::LeMacAESNI(key)};
+}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+template <>
+detail::impl_ptr make_aesni<level>(std::span<const std::uint8_t, key_size> key,
+                                   std::pmr::memory_resource* resource) {
+  return detail::make_in<AESNI<level>::LeMacAESNI>(resource, key);
+}
+#endif
+
+template <>
+detail::ImplInterface*
+make_aesni_at<level>(void* memory,
+                     std::span<const std::uint8_t, key_size> key) {
+  return new (memory) AESNI<level>::LeMacAESNI(key);
+}
+
+template <> detail::object_layout aesni_layout<level>() noexcept {
+  return {sizeof(AESNI<level>::LeMacAESNI), alignof(AESNI<level>::LeMacAESNI)};
+}
+
+template <> tuning_table tune_aesni<level>() { return tune_kernels<level>(); }
+
+template <> tuning_table get_aesni_tuning_table<level>() {
+  return get_kernel_choice<level>();
 }
 
 } // namespace lemac::inline v1
@@ -9,12 +9,18 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <new>
 #include <span>
+#include <utility>
+#include <vector>
 
 #include "impl_interface.h"
 #include "lemac.h"
@@ -78,10 +84,21 @@ template <AESNI_variant variant> struct AESNI {
       return std::make_unique<LeMacAESNI>(key);
     }
 
-    std::unique_ptr<detail::ImplInterface> clone() const noexcept override {
-      return std::unique_ptr<detail::ImplInterface>{new LeMacAESNI(*this)};
+    detail::impl_ptr clone() const override {
+      return detail::impl_ptr{new LeMacAESNI(*this)};
     }
 
+#if LEMAC_HAS_MEMORY_RESOURCE
+    detail::impl_ptr
+    clone(std::pmr::memory_resource* resource) const override {
+      return detail::make_in<LeMacAESNI>(resource, *this);
+    }
+
+    void destroy(std::pmr::memory_resource* resource) noexcept override {
+      detail::destroy_in(this, resource);
+    }
+#endif
+
     /**
      * constructs a hasher with a zero key
      */
@@ -151,6 +168,35 @@ template <AESNI_variant variant> struct AESNI {
      */
     void reset() noexcept override;
 
+    void copy_and_update(std::uint8_t* dst,
+                         std::span<const std::uint8_t> data) noexcept override;
+
+    std::array<std::uint8_t, 16>
+    copy_and_oneshot(std::uint8_t* dst, std::span<const std::uint8_t> data,
+                     std::span<const std::uint8_t> nonce) const noexcept
+        override;
+
+    backend get_backend() const noexcept override {
+      static_assert(variant == AESNI_variant::aes128 ||
+                    variant == AESNI_variant::vaes512full);
+      return variant == AESNI_variant::aes128 ? backend::aes128
+                                              : backend::vaes512full;
+    }
+
+    std::size_t stream_interleave() const noexcept override;
+
+    void init_stream(detail::StreamState& state) const noexcept override;
+
+    void absorb_streams(std::span<detail::StreamState* const> states,
+                        std::span<const std::uint8_t* const> data,
+                        std::size_t nblocks) const noexcept override;
+
+    void finalize_stream(detail::StreamState& state,
+                         std::span<const std::uint8_t> tail,
+                         std::span<const std::uint8_t> nonce,
+                         std::span<std::uint8_t, 16> target) const
+        noexcept override;
+
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
     std::string get_internal_state() const noexcept override;
 #endif
@@ -168,6 +214,11 @@ template <AESNI_variant variant> struct AESNI {
     /// in case data is provided in sizes not evenly divisible by the block size
     std::array<std::uint8_t, block_size> m_buf{};
     std::size_t m_bufsize{};
+
+    /// @return the state placed in storage by init_stream()
+    static ComboState* get_stream(detail::StreamState& state) noexcept {
+      return std::launder(reinterpret_cast<ComboState*>(state.storage.data()));
+    }
   };
 }; // struct AESNI
 
@@ -179,19 +230,46 @@ template <AESNI_variant variant> struct AESNI {
 
 namespace {
 struct compile_time_options {
-  /// clang - best with true for inputs larger than a few kB (10% faster), but
-  /// best with false for small inputs (10% faster)
-  /// gcc - faster with false
-  constexpr static inline bool oneshot_uses_tail = false;
-
-  /// gcc and clang - both are faster with false
-  constexpr static inline bool finalize_uses_tail = false;
-
-  /// does not seem to be important
-  constexpr static inline bool unroll_zero_blocks = false;
-
-  /// does not seem to be important
-  constexpr static inline bool inline_processing = false;
+  /// the kernels used until lemac::tune() has been called. observations:
+  /// - oneshot_uses_tail: clang - best with true for inputs larger than a few
+  ///   kB (10% faster), but best with false for small inputs (10% faster).
+  ///   gcc - faster with false
+  /// - finalize_uses_tail: gcc and clang - both are faster with false
+  /// - unroll_zero_blocks: does not seem to be important
+  /// - inline_processing: does not seem to be important
+  constexpr static inline lemac::kernel_options defaults{
+      .oneshot_uses_tail = false,
+      .finalize_uses_tail = false,
+      .unroll_zero_blocks = false,
+      .inline_processing = false};
+
+  /// inputs with at least this many bytes of whole blocks are absorbed with
+  /// the streaming kernel, which prefetches ahead. below this, the data is
+  /// likely in cache already and the plain loop is as fast.
+  constexpr static inline std::size_t streaming_threshold = 256 * 1024;
+
+  /// the number of blocks the streaming kernel loads before starting on the
+  /// aesenc chains
+  constexpr static inline std::size_t streaming_unroll = 4;
+
+  /// copies of at least this many bytes of whole blocks use non-temporal
+  /// stores (if the destination is suitably aligned), since the destination
+  /// would not fit in cache anyway and it saves reading it in before writing
+  constexpr static inline std::size_t nontemporal_threshold = 4 * 1024 * 1024;
+
+  /// how far ahead (in bytes) the streaming kernel prefetches. the wider
+  /// variants consume data faster and benefit from a longer distance.
+  template <lemac::AESNI_variant variant>
+  constexpr static inline std::size_t prefetch_distance =
+      variant == lemac::AESNI_variant::aes128 ? 1024 : 2048;
+
+  /// the number of messages absorbed in an interleaved fashion by
+  /// absorb_streams(). a single message already has eight independent aesenc
+  /// per block, which keeps the aes units busy. interleaving two messages
+  /// was measured 12% (vaes512full) and 35% (aes128, which spills with only
+  /// 16 registers) slower on a xeon, so it is not done.
+  template <lemac::AESNI_variant variant>
+  constexpr static inline std::size_t stream_interleave = 1;
 };
 
 __m128i AES128_modified(std::span<const __m128i, 11> Ki, __m128i x) {
@@ -330,15 +408,12 @@ void init(typename lemac::AESNI<variant>::LeMacContext& ctx,
 }
 constexpr auto vector_register_alignment = std::alignment_of_v<__m128i>;
 
-// assumes no alignment
+// absorbs a block which has already been loaded into registers
 template <lemac::AESNI_variant variant>
-inline void process_block(typename lemac::AESNI<variant>::Sstate& S,
-                          typename lemac::AESNI<variant>::Rstate& R,
-                          const std::uint8_t* ptr) noexcept {
-  const auto M0 = _mm_loadu_si128((const __m128i*)(ptr + 0));
-  const auto M1 = _mm_loadu_si128((const __m128i*)(ptr + 16));
-  const auto M2 = _mm_loadu_si128((const __m128i*)(ptr + 32));
-  const auto M3 = _mm_loadu_si128((const __m128i*)(ptr + 48));
+inline void absorb_block(typename lemac::AESNI<variant>::Sstate& S,
+                         typename lemac::AESNI<variant>::Rstate& R,
+                         const __m128i M0, const __m128i M1, const __m128i M2,
+                         const __m128i M3) noexcept {
   __m128i T = S.S[8];
   S.S[8] = _mm_aesenc_si128(S.S[7], M3);
   S.S[7] = _mm_aesenc_si128(S.S[6], M1);
@@ -368,6 +443,133 @@ inline void process_block(typename lemac::AESNI<variant>::Sstate& S,
   R.RR = M2;
 }
 
+// assumes no alignment
+template <lemac::AESNI_variant variant>
+inline void process_block(typename lemac::AESNI<variant>::Sstate& S,
+                          typename lemac::AESNI<variant>::Rstate& R,
+                          const std::uint8_t* ptr) noexcept {
+  const auto M0 = _mm_loadu_si128((const __m128i*)(ptr + 0));
+  const auto M1 = _mm_loadu_si128((const __m128i*)(ptr + 16));
+  const auto M2 = _mm_loadu_si128((const __m128i*)(ptr + 32));
+  const auto M3 = _mm_loadu_si128((const __m128i*)(ptr + 48));
+  absorb_block<variant>(S, R, M0, M1, M2, M3);
+}
+
+// absorbs nblocks whole blocks, for large inputs which are likely not in
+// cache. the loads for several blocks are issued before the aesenc chains
+// which consume them, and data further ahead is prefetched. assumes no
+// alignment.
+template <lemac::AESNI_variant variant>
+inline void process_blocks_streaming(typename lemac::AESNI<variant>::Sstate& S,
+                                     typename lemac::AESNI<variant>::Rstate& R,
+                                     const std::uint8_t* ptr,
+                                     const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+  constexpr auto unroll = compile_time_options::streaming_unroll;
+  constexpr auto distance =
+      compile_time_options::prefetch_distance<variant>;
+
+  const auto unrolled_end = ptr + (nblocks / unroll) * unroll * block_size;
+  const auto block_end = ptr + nblocks * block_size;
+
+  for (; ptr != unrolled_end; ptr += unroll * block_size) {
+    // only within the data, a pointer past its end is not valid to form
+    if (static_cast<std::size_t>(block_end - ptr) >=
+        distance + unroll * block_size) {
+      for (std::size_t i = 0; i < unroll; ++i) {
+        _mm_prefetch((const char*)ptr + distance + i * block_size,
+                     _MM_HINT_T0);
+      }
+    }
+    __m128i M[unroll][4];
+    for (std::size_t i = 0; i < unroll; ++i) {
+      for (std::size_t j = 0; j < 4; ++j) {
+        M[i][j] = _mm_loadu_si128((const __m128i*)(ptr + i * block_size) + j);
+      }
+    }
+    for (std::size_t i = 0; i < unroll; ++i) {
+      absorb_block<variant>(S, R, M[i][0], M[i][1], M[i][2], M[i][3]);
+    }
+  }
+  for (; ptr != block_end; ptr += block_size) {
+    process_block<variant>(S, R, ptr);
+  }
+}
+
+// absorbs nblocks whole blocks from src and also stores them to dst, so the
+// data only needs to be loaded once. assumes no alignment and no overlap.
+template <lemac::AESNI_variant variant>
+inline void copy_and_process_blocks(typename lemac::AESNI<variant>::Sstate& S,
+                                    typename lemac::AESNI<variant>::Rstate& R,
+                                    std::uint8_t* dst, const std::uint8_t* src,
+                                    const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+  constexpr auto distance = compile_time_options::prefetch_distance<variant>;
+
+  const auto block_end = src + nblocks * block_size;
+
+  const bool nontemporal =
+      nblocks * block_size >= compile_time_options::nontemporal_threshold &&
+      (reinterpret_cast<std::uintptr_t>(dst) % vector_register_alignment) == 0;
+  if (nontemporal) {
+    for (; src != block_end; src += block_size, dst += block_size) {
+      // only within the data, a pointer past its end is not valid to form
+      if (static_cast<std::size_t>(block_end - src) > distance) {
+        _mm_prefetch((const char*)src + distance, _MM_HINT_T0);
+      }
+      const auto M0 = _mm_loadu_si128((const __m128i*)(src + 0));
+      const auto M1 = _mm_loadu_si128((const __m128i*)(src + 16));
+      const auto M2 = _mm_loadu_si128((const __m128i*)(src + 32));
+      const auto M3 = _mm_loadu_si128((const __m128i*)(src + 48));
+      _mm_stream_si128((__m128i*)(dst + 0), M0);
+      _mm_stream_si128((__m128i*)(dst + 16), M1);
+      _mm_stream_si128((__m128i*)(dst + 32), M2);
+      _mm_stream_si128((__m128i*)(dst + 48), M3);
+      absorb_block<variant>(S, R, M0, M1, M2, M3);
+    }
+    // make the non-temporal stores visible before returning
+    _mm_sfence();
+  } else {
+    for (; src != block_end; src += block_size, dst += block_size) {
+      if (static_cast<std::size_t>(block_end - src) > distance) {
+        _mm_prefetch((const char*)src + distance, _MM_HINT_T0);
+      }
+      const auto M0 = _mm_loadu_si128((const __m128i*)(src + 0));
+      const auto M1 = _mm_loadu_si128((const __m128i*)(src + 16));
+      const auto M2 = _mm_loadu_si128((const __m128i*)(src + 32));
+      const auto M3 = _mm_loadu_si128((const __m128i*)(src + 48));
+      _mm_storeu_si128((__m128i*)(dst + 0), M0);
+      _mm_storeu_si128((__m128i*)(dst + 16), M1);
+      _mm_storeu_si128((__m128i*)(dst + 32), M2);
+      _mm_storeu_si128((__m128i*)(dst + 48), M3);
+      absorb_block<variant>(S, R, M0, M1, M2, M3);
+    }
+  }
+}
+
+// absorbs nblocks whole blocks into each of the lanes states, alternating
+// between the messages block by block. the messages are independent, so the
+// cpu can overlap their aesenc chains. states should be local variables, so
+// the compiler can keep them in registers. assumes no alignment.
+template <lemac::AESNI_variant variant, std::size_t lanes>
+inline void
+process_blocks_interleaved(typename lemac::AESNI<variant>::ComboState* states,
+                           const std::uint8_t* const* data,
+                           const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+
+  const std::uint8_t* ptr[lanes];
+  for (std::size_t i = 0; i < lanes; ++i) {
+    ptr[i] = data[i];
+  }
+  for (std::size_t block = 0; block < nblocks; ++block) {
+    for (std::size_t i = 0; i < lanes; ++i) {
+      process_block<variant>(states[i].s, states[i].r, ptr[i]);
+      ptr[i] += block_size;
+    }
+  }
+}
+
 template <lemac::AESNI_variant variant>
 inline void process_aligned_block(typename lemac::AESNI<variant>::Sstate& S,
                                   typename lemac::AESNI<variant>::Rstate& R,
@@ -440,6 +642,27 @@ void tail(const typename lemac::AESNI<variant>::LeMacContext& context,
 
   const auto N = _mm_loadu_si128((const __m128i*)nonce.data());
 
+#if defined(_MSC_VER)
+  __m128i T = _mm_xor_si128(N, AES128(context.keys[0], N));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<0>(), S.S[0]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<1>(), S.S[1]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<2>(), S.S[2]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<3>(), S.S[3]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<4>(), S.S[4]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<5>(), S.S[5]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<6>(), S.S[6]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<7>(), S.S[7]));
+  T = _mm_xor_si128(
+      T, AES128_modified(context.template get_subkey<8>(), S.S[8]));
+#else
   __m128i T = N ^ AES128(context.keys[0], N);
   T ^= AES128_modified(context.template get_subkey<0>(), S.S[0]);
   T ^= AES128_modified(context.template get_subkey<1>(), S.S[1]);
@@ -450,12 +673,410 @@ void tail(const typename lemac::AESNI<variant>::LeMacContext& context,
   T ^= AES128_modified(context.template get_subkey<6>(), S.S[6]);
   T ^= AES128_modified(context.template get_subkey<7>(), S.S[7]);
   T ^= AES128_modified(context.template get_subkey<8>(), S.S[8]);
+#endif
 
   const auto tag = AES128(std::span(context.keys[1]), T);
   _mm_storeu_si128((__m128i*)target.data(), tag);
 }
 } // namespace
 
+namespace {
+
+// the kernels below are compiled for every combination of kernel_options, so
+// the fastest one can be selected at runtime, see tune_kernels()
+
+template <lemac::AESNI_variant variant, lemac::kernel_options options>
+void finalize_kernel(
+    const typename lemac::AESNI<variant>::LeMacContext& context,
+    typename lemac::AESNI<variant>::ComboState& state,
+    std::span<std::uint8_t, 64> buf, const std::size_t bufsize,
+    std::span<const std::uint8_t> nonce,
+    std::span<std::uint8_t, 16> target) noexcept {
+
+  // let buf be padded
+  assert(bufsize < buf.size());
+  buf[bufsize] = 1;
+  for (std::size_t i = bufsize + 1; i < buf.size(); ++i) {
+    buf[i] = 0;
+  }
+  const bool buf_is_aligned = (reinterpret_cast<std::uintptr_t>(buf.data()) %
+                               vector_register_alignment) == 0;
+  if (buf_is_aligned) {
+    process_aligned_block<variant>(state.s, state.r,
+                                   (const __m128i*)buf.data());
+  } else {
+    process_block<variant>(state.s, state.r, buf.data());
+  }
+
+  // Four final rounds to absorb message state
+  if constexpr (options.unroll_zero_blocks) {
+    process_zero_block<variant>(state.s, state.r);
+    process_zero_block<variant>(state.s, state.r);
+    process_zero_block<variant>(state.s, state.r);
+    process_zero_block<variant>(state.s, state.r);
+  } else {
+    for (int i = 0; i < 4; ++i) {
+      process_zero_block<variant>(state.s, state.r);
+    }
+  }
+
+  if constexpr (options.finalize_uses_tail) {
+    tail<variant>(context, state.s, nonce, target);
+  } else {
+    assert(nonce.size() == 16);
+
+    const auto N = _mm_loadu_si128((const __m128i*)nonce.data());
+
+    auto& S = state.s;
+#if defined(_MSC_VER)
+    __m128i T = _mm_xor_si128(N, AES128(context.keys[0], N));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<0>(), S.S[0]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<1>(), S.S[1]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<2>(), S.S[2]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<3>(), S.S[3]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<4>(), S.S[4]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<5>(), S.S[5]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<6>(), S.S[6]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<7>(), S.S[7]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<8>(), S.S[8]));
+#else
+    __m128i T = N ^ AES128(context.keys[0], N);
+    T ^= AES128_modified(context.template get_subkey<0>(), S.S[0]);
+    T ^= AES128_modified(context.template get_subkey<1>(), S.S[1]);
+    T ^= AES128_modified(context.template get_subkey<2>(), S.S[2]);
+    T ^= AES128_modified(context.template get_subkey<3>(), S.S[3]);
+    T ^= AES128_modified(context.template get_subkey<4>(), S.S[4]);
+    T ^= AES128_modified(context.template get_subkey<5>(), S.S[5]);
+    T ^= AES128_modified(context.template get_subkey<6>(), S.S[6]);
+    T ^= AES128_modified(context.template get_subkey<7>(), S.S[7]);
+    T ^= AES128_modified(context.template get_subkey<8>(), S.S[8]);
+#endif
+    const auto tag = AES128(context.keys[1], T);
+    _mm_storeu_si128((__m128i*)target.data(), tag);
+  }
+}
+
+template <lemac::AESNI_variant variant, lemac::kernel_options options>
+std::array<std::uint8_t, 16>
+oneshot_kernel(const typename lemac::AESNI<variant>::LeMacContext& context,
+               std::span<const std::uint8_t> data,
+               std::span<const std::uint8_t> nonce) noexcept {
+  constexpr std::size_t block_size = 64;
+
+  typename lemac::AESNI<variant>::Sstate S = context.init;
+  typename lemac::AESNI<variant>::Rstate R{};
+
+  // process whole blocks
+  const auto whole_blocks = data.size() / block_size;
+
+  if (whole_blocks * block_size >= compile_time_options::streaming_threshold) {
+    process_blocks_streaming<variant>(S, R, data.data(), whole_blocks);
+  } else if (whole_blocks) {
+    const bool data_is_aligned =
+        (reinterpret_cast<std::uintptr_t>(data.data()) %
+         vector_register_alignment) == 0;
+    if (data_is_aligned) {
+      auto ptr = (const __m128i*)data.data();
+      const auto step = (block_size / sizeof(*ptr));
+      const auto block_end = ptr + whole_blocks * step;
+      for (; ptr != block_end; ptr += step) {
+        if constexpr (options.inline_processing) {
+          __m128i T = S.S[8];
+          S.S[8] = _mm_aesenc_si128(S.S[7], *(ptr + 3));
+          S.S[7] = _mm_aesenc_si128(S.S[6], *(ptr + 1));
+          S.S[6] = _mm_aesenc_si128(S.S[5], *(ptr + 1));
+          S.S[5] = _mm_aesenc_si128(S.S[4], *(ptr + 0));
+
+          S.S[4] = _mm_aesenc_si128(S.S[3], *(ptr + 0));
+          S.S[3] = _mm_aesenc_si128(S.S[2], _mm_xor_si128(R.R1, R.R2));
+          S.S[2] = _mm_aesenc_si128(S.S[1], *(ptr + 3));
+          S.S[1] = _mm_aesenc_si128(S.S[0], *(ptr + 3));
+          S.S[0] = _mm_xor_si128(S.S[0], _mm_xor_si128(T, *(ptr + 2)));
+          R.R2 = R.R1;
+          R.R1 = R.R0;
+          R.R0 = _mm_xor_si128(R.RR, *(ptr + 1));
+          R.RR = *(ptr + 2);
+        } else {
+          process_aligned_block<variant>(S, R, ptr);
+        }
+      }
+    } else {
+      const auto block_end = data.data() + whole_blocks * block_size;
+      auto ptr = data.data();
+      for (; ptr != block_end; ptr += block_size) {
+        if constexpr (options.inline_processing) {
+          const auto M0 = _mm_loadu_si128((const __m128i*)(ptr + 0));
+          const auto M1 = _mm_loadu_si128((const __m128i*)(ptr + 16));
+          const auto M2 = _mm_loadu_si128((const __m128i*)(ptr + 32));
+          const auto M3 = _mm_loadu_si128((const __m128i*)(ptr + 48));
+          __m128i T = S.S[8];
+          S.S[8] = _mm_aesenc_si128(S.S[7], M3);
+          S.S[7] = _mm_aesenc_si128(S.S[6], M1);
+          S.S[6] = _mm_aesenc_si128(S.S[5], M1);
+          S.S[5] = _mm_aesenc_si128(S.S[4], M0);
+
+          S.S[4] = _mm_aesenc_si128(S.S[3], M0);
+          S.S[3] = _mm_aesenc_si128(S.S[2], _mm_xor_si128(R.R1, R.R2));
+          S.S[2] = _mm_aesenc_si128(S.S[1], M3);
+          S.S[1] = _mm_aesenc_si128(S.S[0], M3);
+          S.S[0] = _mm_xor_si128(S.S[0], _mm_xor_si128(T, M2));
+          R.R2 = R.R1;
+          R.R1 = R.R0;
+          R.R0 = _mm_xor_si128(R.RR, M1);
+          R.RR = M2;
+        } else {
+          process_block<variant>(S, R, ptr);
+        }
+      }
+    }
+  }
+
+  // write the tail into m_buf
+  std::array<std::uint8_t, block_size> buf{};
+  const std::size_t bufsize = data.size() - whole_blocks * block_size;
+  if (bufsize) {
+    std::memcpy(buf.data(), data.data() + whole_blocks * block_size, bufsize);
+  }
+
+  // let m_buf be padded
+  assert(bufsize < buf.size());
+  buf[bufsize] = 1;
+
+  process_block<variant>(S, R, buf.data());
+
+  // Four final rounds to absorb message state
+  if constexpr (options.unroll_zero_blocks) {
+    process_zero_block<variant>(S, R);
+    process_zero_block<variant>(S, R);
+    process_zero_block<variant>(S, R);
+    process_zero_block<variant>(S, R);
+  } else {
+    for (int i = 0; i < 4; ++i) {
+      process_zero_block<variant>(S, R);
+    }
+  }
+  assert(nonce.size() == 16);
+
+  const auto N = _mm_loadu_si128((const __m128i*)nonce.data());
+
+  if constexpr (!options.oneshot_uses_tail) {
+#if defined(_MSC_VER)
+    __m128i T = _mm_xor_si128(N, AES128(context.keys[0], N));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<0>(), S.S[0]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<1>(), S.S[1]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<2>(), S.S[2]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<3>(), S.S[3]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<4>(), S.S[4]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<5>(), S.S[5]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<6>(), S.S[6]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<7>(), S.S[7]));
+    T = _mm_xor_si128(
+        T, AES128_modified(context.template get_subkey<8>(), S.S[8]));
+#else
+    __m128i T = N ^ AES128(context.keys[0], N);
+    T ^= AES128_modified(context.template get_subkey<0>(), S.S[0]);
+    T ^= AES128_modified(context.template get_subkey<1>(), S.S[1]);
+    T ^= AES128_modified(context.template get_subkey<2>(), S.S[2]);
+    T ^= AES128_modified(context.template get_subkey<3>(), S.S[3]);
+    T ^= AES128_modified(context.template get_subkey<4>(), S.S[4]);
+    T ^= AES128_modified(context.template get_subkey<5>(), S.S[5]);
+    T ^= AES128_modified(context.template get_subkey<6>(), S.S[6]);
+    T ^= AES128_modified(context.template get_subkey<7>(), S.S[7]);
+    T ^= AES128_modified(context.template get_subkey<8>(), S.S[8]);
+#endif
+    const auto tag = AES128(context.keys[1], T);
+    std::array<std::uint8_t, 16> ret;
+    _mm_storeu_si128((__m128i*)ret.data(), tag);
+    return ret;
+  } else {
+    std::array<std::uint8_t, 16> ret;
+    tail<variant>(context, S, nonce, ret);
+    return ret;
+  }
+}
+
+// all the kernel variants, indexed by kernel_options
+template <lemac::AESNI_variant variant> struct KernelTable {
+  using finalize_fn = void (*)(
+      const typename lemac::AESNI<variant>::LeMacContext&,
+      typename lemac::AESNI<variant>::ComboState&, std::span<std::uint8_t, 64>,
+      std::size_t, std::span<const std::uint8_t>,
+      std::span<std::uint8_t, 16>) noexcept;
+  using oneshot_fn = std::array<std::uint8_t, 16> (*)(
+      const typename lemac::AESNI<variant>::LeMacContext&,
+      std::span<const std::uint8_t>, std::span<const std::uint8_t>) noexcept;
+
+  static constexpr std::size_t size = 16;
+
+  static constexpr lemac::kernel_options options_at(std::size_t index) {
+    return {.oneshot_uses_tail = (index & 1) != 0,
+            .finalize_uses_tail = (index & 2) != 0,
+            .unroll_zero_blocks = (index & 4) != 0,
+            .inline_processing = (index & 8) != 0};
+  }
+
+  static constexpr std::uint8_t index_of(const lemac::kernel_options& o) {
+    return static_cast<std::uint8_t>(
+        (o.oneshot_uses_tail ? 1 : 0) | (o.finalize_uses_tail ? 2 : 0) |
+        (o.unroll_zero_blocks ? 4 : 0) | (o.inline_processing ? 8 : 0));
+  }
+
+  template <std::size_t... I>
+  static constexpr std::array<finalize_fn, size>
+  make_finalize(std::index_sequence<I...>) {
+    return {&finalize_kernel<variant, options_at(I)>...};
+  }
+
+  template <std::size_t... I>
+  static constexpr std::array<oneshot_fn, size>
+  make_oneshot(std::index_sequence<I...>) {
+    return {&oneshot_kernel<variant, options_at(I)>...};
+  }
+
+  static constexpr std::array<finalize_fn, size> finalize =
+      make_finalize(std::make_index_sequence<size>{});
+  static constexpr std::array<oneshot_fn, size> oneshot =
+      make_oneshot(std::make_index_sequence<size>{});
+};
+
+// the kernels currently in use, as indices into KernelTable. this is shared
+// by all hasher objects of the same variant.
+template <lemac::AESNI_variant variant> struct KernelChoice {
+  static constexpr auto default_index =
+      KernelTable<variant>::index_of(compile_time_options::defaults);
+
+  static inline std::atomic<std::uint8_t> finalize{default_index};
+  static_assert(lemac::detail::size_class_limits.size() == 4);
+  static inline std::array<std::atomic<std::uint8_t>, 4> oneshot{
+      default_index, default_index, default_index, default_index};
+};
+
+template <lemac::AESNI_variant variant>
+lemac::tuning_table get_kernel_choice() {
+  using Table = KernelTable<variant>;
+  using Choice = KernelChoice<variant>;
+  lemac::tuning_table ret{};
+  ret.finalize = Table::options_at(Choice::finalize.load());
+  for (std::size_t i = 0; i < ret.oneshot.size(); ++i) {
+    ret.oneshot[i].max_size = lemac::detail::size_class_limits[i];
+    ret.oneshot[i].options = Table::options_at(Choice::oneshot[i].load());
+  }
+  return ret;
+}
+
+// measures all relevant kernel variants on this cpu and selects the fastest
+template <lemac::AESNI_variant variant> lemac::tuning_table tune_kernels() {
+  using Table = KernelTable<variant>;
+  using Choice = KernelChoice<variant>;
+  using clock = std::chrono::steady_clock;
+
+  // a message size representative for each size class
+  constexpr std::array<std::size_t, lemac::detail::size_class_limits.size()>
+      sizes{64, 1024, 16 * 1024, 256 * 1024};
+  static_assert(sizes.back() >= compile_time_options::streaming_threshold);
+  // the amount of data to hash per measurement, and how many times to repeat
+  // each measurement (keeping the fastest, to suppress noise)
+  constexpr std::size_t bytes_per_measurement = 1 << 20;
+  constexpr int repetitions = 3;
+
+  typename lemac::AESNI<variant>::LeMacContext context;
+  ::init<variant>(context, std::array<std::uint8_t, lemac::key_size>{});
+  std::vector<std::uint8_t> data(sizes.back());
+  std::array<std::uint8_t, 16> nonce{};
+
+  // returns the index of the fastest of the given candidates, where
+  // measure(index) runs a candidate and returns the elapsed time
+  auto fastest = [](const auto& candidates, auto&& measure) {
+    std::array<clock::duration, Table::size> best;
+    best.fill(clock::duration::max());
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+      for (const auto index : candidates) {
+        best[index] = std::min(best[index], measure(index));
+      }
+    }
+    auto winner = candidates.front();
+    for (const auto index : candidates) {
+      if (best[index] < best[winner]) {
+        winner = index;
+      }
+    }
+    return winner;
+  };
+
+  // oneshot does not depend on finalize_uses_tail
+  std::vector<std::uint8_t> oneshot_candidates;
+  // finalize only depends on finalize_uses_tail and unroll_zero_blocks
+  std::vector<std::uint8_t> finalize_candidates;
+  for (std::size_t i = 0; i < Table::size; ++i) {
+    const auto o = Table::options_at(i);
+    if (!o.finalize_uses_tail) {
+      oneshot_candidates.push_back(static_cast<std::uint8_t>(i));
+    }
+    if (!o.oneshot_uses_tail && !o.inline_processing) {
+      finalize_candidates.push_back(static_cast<std::uint8_t>(i));
+    }
+  }
+
+  for (std::size_t size_class = 0; size_class < sizes.size(); ++size_class) {
+    const auto message = std::span(data).first(sizes[size_class]);
+    const auto iterations =
+        std::max<std::size_t>(16, bytes_per_measurement / message.size());
+    const auto winner =
+        fastest(oneshot_candidates, [&](const std::uint8_t index) {
+          const auto kernel = Table::oneshot[index];
+          const auto t0 = clock::now();
+          for (std::size_t i = 0; i < iterations; ++i) {
+            // feed back the result to prevent the optimizer from removing
+            // the work
+            nonce[0] = kernel(context, message, nonce)[0];
+          }
+          return clock::now() - t0;
+        });
+    Choice::oneshot[size_class].store(winner);
+  }
+
+  {
+    typename lemac::AESNI<variant>::ComboState state;
+    std::array<std::uint8_t, 64> buf{};
+    std::array<std::uint8_t, 16> tag;
+    const std::size_t iterations = 4096;
+    const auto winner =
+        fastest(finalize_candidates, [&](const std::uint8_t index) {
+          const auto kernel = Table::finalize[index];
+          const auto t0 = clock::now();
+          for (std::size_t i = 0; i < iterations; ++i) {
+            state.s = context.init;
+            state.r.reset();
+            kernel(context, state, buf, 0, nonce, tag);
+            nonce[0] = tag[0];
+          }
+          return clock::now() - t0;
+        });
+    Choice::finalize.store(winner);
+  }
+
+  return get_kernel_choice<variant>();
+}
+} // namespace
+
+
 // begin paste
 
 namespace lemac {
@@ -528,7 +1149,10 @@ void lemac::AESNI<variant>::LeMacAESNI::update(
   auto ptr = data.data();
   const bool aligned =
       (reinterpret_cast<std::uintptr_t>(ptr) % vector_register_alignment) == 0;
-  if (aligned) {
+  if (whole_blocks * block_size >= compile_time_options::streaming_threshold) {
+    process_blocks_streaming<variant>(state.s, state.r, ptr, whole_blocks);
+    ptr = block_end;
+  } else if (aligned) {
     for (; ptr != block_end; ptr += block_size) {
       process_aligned_block<variant>(state.s, state.r, (const __m128i*)ptr);
     }
@@ -550,77 +1174,133 @@ template <lemac::AESNI_variant variant>
 void lemac::AESNI<variant>::LeMacAESNI::finalize_to(
     std::span<const std::uint8_t> nonce,
     std::span<std::uint8_t, 16> target) noexcept {
+  const auto kernel = KernelTable<variant>::finalize[KernelChoice<
+      variant>::finalize.load(std::memory_order_relaxed)];
+  kernel(m_context, m_state, m_buf, m_bufsize, nonce, target);
+}
 
-  // let m_buf be padded
-  assert(m_bufsize < m_buf.size());
-  m_buf[m_bufsize] = 1;
-  for (std::size_t i = m_bufsize + 1; i < m_buf.size(); ++i) {
-    m_buf[i] = 0;
+
+template <lemac::AESNI_variant variant>
+void lemac::AESNI<variant>::LeMacAESNI::copy_and_update(
+    std::uint8_t* dst, std::span<const std::uint8_t> data) noexcept {
+
+  if (m_bufsize != 0) {
+    // complete the partial block in m_buf first
+    const auto n = std::min(block_size - m_bufsize, data.size());
+    std::memcpy(dst, data.data(), n);
+    update(data.first(n));
+    if (m_bufsize != 0) {
+      // still not a full block
+      return;
+    }
+    dst += n;
+    data = data.subspan(n);
   }
-  const bool buf_is_aligned = (reinterpret_cast<std::uintptr_t>(m_buf.data()) %
-                               vector_register_alignment) == 0;
-  if (buf_is_aligned) {
-    process_aligned_block<variant>(m_state.s, m_state.r,
-                                   (const __m128i*)m_buf.data());
-  } else {
-    process_block<variant>(m_state.s, m_state.r, m_buf.data());
+
+  const auto whole_blocks = data.size() / block_size;
+
+  // operate on a copy of the state and write it back later
+  auto state = m_state;
+  copy_and_process_blocks<variant>(state.s, state.r, dst, data.data(),
+                                   whole_blocks);
+  m_state = state;
+
+  // the tail goes both to dst and m_buf
+  m_bufsize = data.size() - whole_blocks * block_size;
+  if (m_bufsize) {
+    const auto offset = whole_blocks * block_size;
+    std::memcpy(dst + offset, data.data() + offset, m_bufsize);
+    std::memcpy(m_buf.data(), data.data() + offset, m_bufsize);
   }
+}
 
-  // Four final rounds to absorb message state
-  if constexpr (compile_time_options::unroll_zero_blocks) {
-    process_zero_block<variant>(m_state.s, m_state.r);
-    process_zero_block<variant>(m_state.s, m_state.r);
-    process_zero_block<variant>(m_state.s, m_state.r);
-    process_zero_block<variant>(m_state.s, m_state.r);
-  } else {
-    for (int i = 0; i < 4; ++i) {
-      process_zero_block<variant>(m_state.s, m_state.r);
-    }
+template <lemac::AESNI_variant variant>
+std::array<std::uint8_t, 16>
+lemac::AESNI<variant>::LeMacAESNI::copy_and_oneshot(
+    std::uint8_t* dst, std::span<const std::uint8_t> data,
+    std::span<const std::uint8_t> nonce) const noexcept {
+
+  ComboState state{m_context.init, {}};
+
+  const auto whole_blocks = data.size() / block_size;
+  copy_and_process_blocks<variant>(state.s, state.r, dst, data.data(),
+                                   whole_blocks);
+
+  std::array<std::uint8_t, block_size> buf{};
+  const std::size_t bufsize = data.size() - whole_blocks * block_size;
+  if (bufsize) {
+    const auto offset = whole_blocks * block_size;
+    std::memcpy(dst + offset, data.data() + offset, bufsize);
+    std::memcpy(buf.data(), data.data() + offset, bufsize);
   }
 
-  if constexpr (compile_time_options::finalize_uses_tail) {
-    tail(m_context, m_state.s, nonce, target);
-  } else {
-    assert(nonce.size() == 16);
+  const auto kernel = KernelTable<variant>::finalize[KernelChoice<
+      variant>::finalize.load(std::memory_order_relaxed)];
+  std::array<std::uint8_t, 16> ret;
+  kernel(m_context, state, buf, bufsize, nonce, ret);
+  return ret;
+}
 
-    const auto N = _mm_loadu_si128((const __m128i*)nonce.data());
+template <lemac::AESNI_variant variant>
+void lemac::AESNI<variant>::LeMacAESNI::init_stream(
+    detail::StreamState& state) const noexcept {
+  static_assert(sizeof(ComboState) <= sizeof(state.storage));
+  static_assert(alignof(ComboState) <= alignof(detail::StreamState));
+  auto initial = new (state.storage.data()) ComboState;
+  initial->s = m_context.init;
+  initial->r.reset();
+}
 
-    auto& S = m_state.s;
-#if defined(_MSC_VER)
-    __m128i T = _mm_xor_si128(N, AES128(m_context.keys[0], N));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<0>(), S.S[0]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<1>(), S.S[1]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<2>(), S.S[2]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<3>(), S.S[3]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<4>(), S.S[4]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<5>(), S.S[5]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<6>(), S.S[6]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<7>(), S.S[7]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<8>(), S.S[8]));
-#else
-    __m128i T = N ^ AES128(m_context.keys[0], N);
-    T ^= AES128_modified(m_context.template get_subkey<0>(), S.S[0]);
-    T ^= AES128_modified(m_context.template get_subkey<1>(), S.S[1]);
-    T ^= AES128_modified(m_context.template get_subkey<2>(), S.S[2]);
-    T ^= AES128_modified(m_context.template get_subkey<3>(), S.S[3]);
-    T ^= AES128_modified(m_context.template get_subkey<4>(), S.S[4]);
-    T ^= AES128_modified(m_context.template get_subkey<5>(), S.S[5]);
-    T ^= AES128_modified(m_context.template get_subkey<6>(), S.S[6]);
-    T ^= AES128_modified(m_context.template get_subkey<7>(), S.S[7]);
-    T ^= AES128_modified(m_context.template get_subkey<8>(), S.S[8]);
-#endif
-    const auto tag = AES128(m_context.keys[1], T);
-    _mm_storeu_si128((__m128i*)target.data(), tag);
+template <lemac::AESNI_variant variant>
+std::size_t
+lemac::AESNI<variant>::LeMacAESNI::stream_interleave() const noexcept {
+  return compile_time_options::stream_interleave<variant>;
+}
+
+template <lemac::AESNI_variant variant>
+void lemac::AESNI<variant>::LeMacAESNI::absorb_streams(
+    std::span<detail::StreamState* const> states,
+    std::span<const std::uint8_t* const> data,
+    const std::size_t nblocks) const noexcept {
+  assert(states.size() == data.size());
+  constexpr auto lanes = compile_time_options::stream_interleave<variant>;
+
+  for (std::size_t i = 0; i < states.size(); i += lanes) {
+    const auto n = std::min(lanes, states.size() - i);
+    // operate on copies and write them back later, like update() does
+    ComboState local[lanes];
+    for (std::size_t j = 0; j < n; ++j) {
+      local[j] = *get_stream(*states[i + j]);
+    }
+    if (n == lanes) {
+      process_blocks_interleaved<variant, lanes>(local, &data[i], nblocks);
+    } else {
+      for (std::size_t j = 0; j < n; ++j) {
+        process_blocks_interleaved<variant, 1>(&local[j], &data[i + j],
+                                               nblocks);
+      }
+    }
+    for (std::size_t j = 0; j < n; ++j) {
+      *get_stream(*states[i + j]) = local[j];
+    }
+  }
+}
+
+template <lemac::AESNI_variant variant>
+void lemac::AESNI<variant>::LeMacAESNI::finalize_stream(
+    detail::StreamState& state, std::span<const std::uint8_t> tail,
+    std::span<const std::uint8_t> nonce,
+    std::span<std::uint8_t, 16> target) const noexcept {
+  assert(tail.size() < block_size);
+  ComboState local = *get_stream(state);
+  std::array<std::uint8_t, block_size> buf;
+  if (!tail.empty()) {
+    std::memcpy(buf.data(), tail.data(), tail.size());
   }
+
+  const auto kernel = KernelTable<variant>::finalize[KernelChoice<
+      variant>::finalize.load(std::memory_order_relaxed)];
+  kernel(m_context, local, buf, tail.size(), nonce, target);
 }
 
 template <lemac::AESNI_variant variant>
@@ -696,143 +1376,11 @@ template <lemac::AESNI_variant variant>
 std::array<uint8_t, 16> lemac::AESNI<variant>::LeMacAESNI::oneshot(
     std::span<const uint8_t> data,
     std::span<const uint8_t> nonce) const noexcept {
-
-  Sstate S = m_context.init;
-  Rstate R{};
-
-  // process whole blocks
-  const auto whole_blocks = data.size() / block_size;
-
-  if (whole_blocks) {
-    const bool data_is_aligned =
-        (reinterpret_cast<std::uintptr_t>(data.data()) %
-         vector_register_alignment) == 0;
-    if (data_is_aligned) {
-      auto ptr = (const __m128i*)data.data();
-      const auto step = (block_size / sizeof(*ptr));
-      const auto block_end = ptr + whole_blocks * step;
-      for (; ptr != block_end; ptr += step) {
-        if constexpr (compile_time_options::inline_processing) {
-          __m128i T = S.S[8];
-          S.S[8] = _mm_aesenc_si128(S.S[7], *(ptr + 3));
-          S.S[7] = _mm_aesenc_si128(S.S[6], *(ptr + 1));
-          S.S[6] = _mm_aesenc_si128(S.S[5], *(ptr + 1));
-          S.S[5] = _mm_aesenc_si128(S.S[4], *(ptr + 0));
-
-          S.S[4] = _mm_aesenc_si128(S.S[3], *(ptr + 0));
-          S.S[3] = _mm_aesenc_si128(S.S[2], R.R1 ^ R.R2);
-          S.S[2] = _mm_aesenc_si128(S.S[1], *(ptr + 3));
-          S.S[1] = _mm_aesenc_si128(S.S[0], *(ptr + 3));
-          S.S[0] = S.S[0] ^ T ^ *(ptr + 2);
-          R.R2 = R.R1;
-          R.R1 = R.R0;
-          R.R0 = R.RR ^ *(ptr + 1);
-          R.RR = *(ptr + 2);
-        } else {
-          process_aligned_block<variant>(S, R, ptr);
-        }
-      }
-    } else {
-      const auto block_end = data.data() + whole_blocks * block_size;
-      auto ptr = data.data();
-      for (; ptr != block_end; ptr += block_size) {
-        if constexpr (compile_time_options::inline_processing) {
-          const auto M0 = _mm_loadu_si128((const __m128i*)(ptr + 0));
-          const auto M1 = _mm_loadu_si128((const __m128i*)(ptr + 16));
-          const auto M2 = _mm_loadu_si128((const __m128i*)(ptr + 32));
-          const auto M3 = _mm_loadu_si128((const __m128i*)(ptr + 48));
-          __m128i T = S.S[8];
-          S.S[8] = _mm_aesenc_si128(S.S[7], M3);
-          S.S[7] = _mm_aesenc_si128(S.S[6], M1);
-          S.S[6] = _mm_aesenc_si128(S.S[5], M1);
-          S.S[5] = _mm_aesenc_si128(S.S[4], M0);
-
-          S.S[4] = _mm_aesenc_si128(S.S[3], M0);
-          S.S[3] = _mm_aesenc_si128(S.S[2], R.R1 ^ R.R2);
-          S.S[2] = _mm_aesenc_si128(S.S[1], M3);
-          S.S[1] = _mm_aesenc_si128(S.S[0], M3);
-          S.S[0] = S.S[0] ^ T ^ M2;
-          R.R2 = R.R1;
-          R.R1 = R.R0;
-          R.R0 = R.RR ^ M1;
-          R.RR = M2;
-        } else {
-          process_block<variant>(S, R, ptr);
-        }
-      }
-    }
-  }
-
-  // write the tail into m_buf
-  std::array<std::uint8_t, block_size> buf{};
-  const std::size_t bufsize = data.size() - whole_blocks * block_size;
-  if (bufsize) {
-    std::memcpy(buf.data(), data.data() + whole_blocks * block_size, bufsize);
-  }
-
-  // let m_buf be padded
-  assert(bufsize < buf.size());
-  buf[bufsize] = 1;
-
-  process_block<variant>(S, R, buf.data());
-
-  // Four final rounds to absorb message state
-  if constexpr (compile_time_options::unroll_zero_blocks) {
-    process_zero_block(S, R);
-    process_zero_block(S, R);
-    process_zero_block(S, R);
-    process_zero_block(S, R);
-  } else {
-    for (int i = 0; i < 4; ++i) {
-      process_zero_block<variant>(S, R);
-    }
-  }
-  assert(nonce.size() == 16);
-
-  const auto N = _mm_loadu_si128((const __m128i*)nonce.data());
-
-  if constexpr (!compile_time_options::oneshot_uses_tail) {
-#if defined(_MSC_VER)
-    __m128i T = _mm_xor_si128(N, AES128(m_context.keys[0], N));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<0>(), S.S[0]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<1>(), S.S[1]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<2>(), S.S[2]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<3>(), S.S[3]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<4>(), S.S[4]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<5>(), S.S[5]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<6>(), S.S[6]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<7>(), S.S[7]));
-    T = _mm_xor_si128(
-        T, AES128_modified(m_context.template get_subkey<8>(), S.S[8]));
-#else
-    __m128i T = N ^ AES128(m_context.keys[0], N);
-    T ^= AES128_modified(m_context.template get_subkey<0>(), S.S[0]);
-    T ^= AES128_modified(m_context.template get_subkey<1>(), S.S[1]);
-    T ^= AES128_modified(m_context.template get_subkey<2>(), S.S[2]);
-    T ^= AES128_modified(m_context.template get_subkey<3>(), S.S[3]);
-    T ^= AES128_modified(m_context.template get_subkey<4>(), S.S[4]);
-    T ^= AES128_modified(m_context.template get_subkey<5>(), S.S[5]);
-    T ^= AES128_modified(m_context.template get_subkey<6>(), S.S[6]);
-    T ^= AES128_modified(m_context.template get_subkey<7>(), S.S[7]);
-    T ^= AES128_modified(m_context.template get_subkey<8>(), S.S[8]);
-#endif
-    const auto tag = AES128(m_context.keys[1], T);
-    std::array<std::uint8_t, 16> ret;
-    _mm_storeu_si128((__m128i*)ret.data(), tag);
-    return ret;
-  } else {
-    std::array<std::uint8_t, 16> ret;
-    tail(m_context, S, nonce, ret);
-    return ret;
-  }
+  const auto size_class = lemac::detail::size_class(data.size());
+  const auto kernel = KernelTable<variant>::oneshot[KernelChoice<
+      variant>::oneshot[size_class].load(std::memory_order_relaxed)];
+  return kernel(m_context, data, nonce);
 }
 
+
 } // namespace lemac
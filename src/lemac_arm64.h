@@ -6,8 +6,25 @@
 
 namespace lemac::inline v1 {
 
-std::unique_ptr<detail::ImplInterface> make_arm64_v8A();
+detail::impl_ptr make_arm64_v8A();
 
-std::unique_ptr<detail::ImplInterface>
-make_arm64_v8A(std::span<const uint8_t, key_size> key);
+detail::impl_ptr make_arm64_v8A(std::span<const uint8_t, key_size> key);
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+/// like make_arm64_v8A(key), allocated from resource
+detail::impl_ptr make_arm64_v8A(std::span<const uint8_t, key_size> key,
+                                std::pmr::memory_resource* resource);
+#endif
+
+/// constructs the implementation in memory, which must fit
+/// arm64_v8A_layout()
+detail::ImplInterface*
+make_arm64_v8A_at(void* memory, std::span<const uint8_t, key_size> key);
+
+detail::object_layout arm64_v8A_layout() noexcept;
+
+/// there is a single kernel for arm64, so this only reports it
+tuning_table tune_arm64_v8A();
+
+tuning_table get_arm64_v8A_tuning_table();
 } // namespace lemac::inline v1
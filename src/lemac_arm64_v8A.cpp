@@ -1,9 +1,15 @@
 #include "lemac_arm64_v8A.h"
+#include "lemac_arm64.h"
 #include "lemac.h"
+#include <algorithm>
 #include <bit>
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <new>
+#if defined(_MSC_VER)
+#include <intrin.h> // __prefetch
+#endif
 
 // this was useful for understanding how to work with neon:
 // http://const.me/articles/simd/NEON.pdf
@@ -200,13 +206,10 @@ uint8x16_t aesenc_zero(uint8x16_t v) {
   return v;
 }
 
-void process_block(arm64v8detail::Sstate& S, arm64v8detail::Rstate& R,
-                   const std::uint8_t* ptr) noexcept {
-  const auto M0 = vld1q_u8(ptr + 0);
-  const auto M1 = vld1q_u8(ptr + 16);
-  const auto M2 = vld1q_u8(ptr + 32);
-  const auto M3 = vld1q_u8(ptr + 48);
-
+// absorbs a block which has already been loaded into registers
+void absorb_block(arm64v8detail::Sstate& S, arm64v8detail::Rstate& R,
+                  const uint8x16_t M0, const uint8x16_t M1, const uint8x16_t M2,
+                  const uint8x16_t M3) noexcept {
   uint8x16_t T = S.S[8];
   S.S[8] = aesenc(S.S[7], M3);
   S.S[7] = aesenc(S.S[6], M1);
@@ -236,6 +239,78 @@ void process_block(arm64v8detail::Sstate& S, arm64v8detail::Rstate& R,
   R.RR = M2;
 }
 
+void process_block(arm64v8detail::Sstate& S, arm64v8detail::Rstate& R,
+                   const std::uint8_t* ptr) noexcept {
+  const auto M0 = vld1q_u8(ptr + 0);
+  const auto M1 = vld1q_u8(ptr + 16);
+  const auto M2 = vld1q_u8(ptr + 32);
+  const auto M3 = vld1q_u8(ptr + 48);
+  absorb_block(S, R, M0, M1, M2, M3);
+}
+
+// absorbs nblocks whole blocks, for large inputs which are likely not in
+// cache. the loads for several blocks are issued before the aes chains which
+// consume them, and data further ahead is prefetched.
+void process_blocks_streaming(arm64v8detail::Sstate& S,
+                              arm64v8detail::Rstate& R, const std::uint8_t* ptr,
+                              const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+  constexpr std::size_t unroll = 4;
+  // how far ahead (in bytes) to prefetch
+  constexpr std::size_t distance = 1024;
+
+  const auto unrolled_end = ptr + (nblocks / unroll) * unroll * block_size;
+  const auto block_end = ptr + nblocks * block_size;
+
+  for (; ptr != unrolled_end; ptr += unroll * block_size) {
+    // only within the data, a pointer past its end is not valid to form
+    if (static_cast<std::size_t>(block_end - ptr) >=
+        distance + unroll * block_size) {
+      for (std::size_t i = 0; i < unroll; ++i) {
+#if defined(_MSC_VER)
+        __prefetch(ptr + distance + i * block_size);
+#else
+        __builtin_prefetch(ptr + distance + i * block_size);
+#endif
+      }
+    }
+    uint8x16_t M[unroll][4];
+    for (std::size_t i = 0; i < unroll; ++i) {
+      for (std::size_t j = 0; j < 4; ++j) {
+        M[i][j] = vld1q_u8(ptr + i * block_size + j * 16);
+      }
+    }
+    for (std::size_t i = 0; i < unroll; ++i) {
+      absorb_block(S, R, M[i][0], M[i][1], M[i][2], M[i][3]);
+    }
+  }
+  for (; ptr != block_end; ptr += block_size) {
+    process_block(S, R, ptr);
+  }
+}
+
+// absorbs nblocks whole blocks from src and also stores them to dst, so the
+// data only needs to be loaded once. there is no non-temporal store
+// intrinsic, so plain stores are used regardless of size.
+void copy_and_process_blocks(arm64v8detail::Sstate& S,
+                             arm64v8detail::Rstate& R, std::uint8_t* dst,
+                             const std::uint8_t* src,
+                             const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+  const auto block_end = src + nblocks * block_size;
+  for (; src != block_end; src += block_size, dst += block_size) {
+    const auto M0 = vld1q_u8(src + 0);
+    const auto M1 = vld1q_u8(src + 16);
+    const auto M2 = vld1q_u8(src + 32);
+    const auto M3 = vld1q_u8(src + 48);
+    vst1q_u8(dst + 0, M0);
+    vst1q_u8(dst + 16, M1);
+    vst1q_u8(dst + 32, M2);
+    vst1q_u8(dst + 48, M3);
+    absorb_block(S, R, M0, M1, M2, M3);
+  }
+}
+
 void process_zero_block(arm64v8detail::Sstate& S,
                         arm64v8detail::Rstate& R) noexcept {
   const uint8x16_t zero =
@@ -269,6 +344,88 @@ void process_zero_block(arm64v8detail::Sstate& S,
   R.R0 = R.RR /*^ M1*/;
   R.RR = M2;
 }
+
+/// @return the state placed in storage by init_stream()
+arm64v8detail::ComboState* get_stream(detail::StreamState& state) noexcept {
+  return std::launder(
+      reinterpret_cast<arm64v8detail::ComboState*>(state.storage.data()));
+}
+
+// absorbs nblocks whole blocks into each of the lanes states, alternating
+// between the messages block by block. the messages are independent, so the
+// cpu can overlap their aes chains. states should be local variables, so the
+// compiler can keep them in registers.
+template <std::size_t lanes>
+void process_blocks_interleaved(arm64v8detail::ComboState* states,
+                                const std::uint8_t* const* data,
+                                const std::size_t nblocks) noexcept {
+  constexpr std::size_t block_size = 64;
+
+  const std::uint8_t* ptr[lanes];
+  for (std::size_t i = 0; i < lanes; ++i) {
+    ptr[i] = data[i];
+  }
+  for (std::size_t block = 0; block < nblocks; ++block) {
+    for (std::size_t i = 0; i < lanes; ++i) {
+      process_block(states[i].s, states[i].r, ptr[i]);
+      ptr[i] += block_size;
+    }
+  }
+}
+
+// pads and absorbs the partial block in buf, then finalizes state into target
+void finalize_state(const arm64v8detail::LeMacContext& context,
+                    arm64v8detail::ComboState& state,
+                    std::span<uint8_t, 64> buf, const std::size_t bufsize,
+                    std::span<const uint8_t> nonce,
+                    std::span<uint8_t, 16> target) noexcept {
+  // let buf be padded
+  assert(bufsize < buf.size());
+  buf[bufsize] = 1;
+  for (std::size_t i = bufsize + 1; i < buf.size(); ++i) {
+    buf[i] = 0;
+  }
+
+  process_block(state.s, state.r, buf.data());
+
+  // Four final rounds to absorb message state
+  for (int i = 0; i < 4; ++i) {
+    process_zero_block(state.s, state.r);
+  }
+
+  assert(nonce.size() == 16);
+
+  const auto N = vld1q_u8(nonce.data());
+
+  auto& S = state.s;
+
+#if defined(_MSC_VER)
+  uint8x16_t T = veorq_u8(N, AES128(context.keys[0], N));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<0>(), S.S[0]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<1>(), S.S[1]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<2>(), S.S[2]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<3>(), S.S[3]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<4>(), S.S[4]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<5>(), S.S[5]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<6>(), S.S[6]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<7>(), S.S[7]));
+  T = veorq_u8(T, AES128_modified(context.get_subkey<8>(), S.S[8]));
+#else
+  uint8x16_t T = N ^ AES128(context.keys[0], N);
+  T ^= AES128_modified(context.get_subkey<0>(), S.S[0]);
+  T ^= AES128_modified(context.get_subkey<1>(), S.S[1]);
+  T ^= AES128_modified(context.get_subkey<2>(), S.S[2]);
+  T ^= AES128_modified(context.get_subkey<3>(), S.S[3]);
+  T ^= AES128_modified(context.get_subkey<4>(), S.S[4]);
+  T ^= AES128_modified(context.get_subkey<5>(), S.S[5]);
+  T ^= AES128_modified(context.get_subkey<6>(), S.S[6]);
+  T ^= AES128_modified(context.get_subkey<7>(), S.S[7]);
+  T ^= AES128_modified(context.get_subkey<8>(), S.S[8]);
+#endif
+
+  const auto tag = AES128(context.keys[1], T);
+  vst1q_u8(target.data(), tag);
+}
 } // namespace
 
 LemacArm64v8A::LemacArm64v8A() noexcept : LemacArm64v8A(zeros) {}
@@ -278,9 +435,20 @@ LemacArm64v8A::LemacArm64v8A(std::span<const uint8_t, key_size> key) noexcept {
   reset();
 }
 
-std::unique_ptr<detail::ImplInterface> LemacArm64v8A::clone() const noexcept {
-  return std::make_unique<LemacArm64v8A>(*this);
+detail::impl_ptr LemacArm64v8A::clone() const {
+  return detail::impl_ptr{new LemacArm64v8A(*this)};
+}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+detail::impl_ptr
+LemacArm64v8A::clone(std::pmr::memory_resource* resource) const {
+  return detail::make_in<LemacArm64v8A>(resource, *this);
+}
+
+void LemacArm64v8A::destroy(std::pmr::memory_resource* resource) noexcept {
+  detail::destroy_in(this, resource);
 }
+#endif
 
 void LemacArm64v8A::update(std::span<const uint8_t> data) noexcept {
 
@@ -319,8 +487,13 @@ void LemacArm64v8A::update(std::span<const uint8_t> data) noexcept {
 
   auto ptr = data.data();
 
-  for (; ptr != block_end; ptr += block_size) {
-    process_block(state.s, state.r, ptr);
+  if (whole_blocks * block_size >= streaming_threshold) {
+    process_blocks_streaming(state.s, state.r, ptr, whole_blocks);
+    ptr = block_end;
+  } else {
+    for (; ptr != block_end; ptr += block_size) {
+      process_block(state.s, state.r, ptr);
+    }
   }
   m_state = state;
 
@@ -333,65 +506,112 @@ void LemacArm64v8A::update(std::span<const uint8_t> data) noexcept {
 
 void LemacArm64v8A::finalize_to(std::span<const uint8_t> nonce,
                                 std::span<uint8_t, 16> target) noexcept {
-  // let m_buf be padded
-  assert(m_bufsize < m_buf.size());
-  m_buf[m_bufsize] = 1;
-  for (std::size_t i = m_bufsize + 1; i < m_buf.size(); ++i) {
-    m_buf[i] = 0;
-  }
+  finalize_state(m_context, m_state, m_buf, m_bufsize, nonce, target);
+}
 
-  process_block(m_state.s, m_state.r, m_buf.data());
+std::array<uint8_t, 16>
+LemacArm64v8A::oneshot(std::span<const uint8_t> data,
+                       std::span<const uint8_t> nonce) const noexcept {
+  auto copy = *this;
+  copy.reset();
+  copy.update(data);
+  std::array<uint8_t, 16> ret;
+  copy.finalize_to(nonce, ret);
+  return ret;
+}
 
-  // Four final rounds to absorb message state
-  for (int i = 0; i < 4; ++i) {
-    process_zero_block(m_state.s, m_state.r);
+void LemacArm64v8A::copy_and_update(std::uint8_t* dst,
+                                    std::span<const uint8_t> data) noexcept {
+  if (m_bufsize != 0) {
+    // complete the partial block in m_buf first
+    const auto n = std::min(block_size - m_bufsize, data.size());
+    std::memcpy(dst, data.data(), n);
+    update(data.first(n));
+    if (m_bufsize != 0) {
+      // still not a full block
+      return;
+    }
+    dst += n;
+    data = data.subspan(n);
   }
 
-  assert(nonce.size() == 16);
-
-  const auto N = vld1q_u8(nonce.data());
-
-  auto& S = m_state.s;
+  const auto whole_blocks = data.size() / block_size;
 
-#if defined(_MSC_VER)
-  uint8x16_t T = veorq_u8(N, AES128(m_context.keys[0], N));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<0>(), S.S[0]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<1>(), S.S[1]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<2>(), S.S[2]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<3>(), S.S[3]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<4>(), S.S[4]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<5>(), S.S[5]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<6>(), S.S[6]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<7>(), S.S[7]));
-  T = veorq_u8(T, AES128_modified(m_context.get_subkey<8>(), S.S[8]));
-#else
-  uint8x16_t T = N ^ AES128(m_context.keys[0], N);
-  T ^= AES128_modified(m_context.get_subkey<0>(), S.S[0]);
-  T ^= AES128_modified(m_context.get_subkey<1>(), S.S[1]);
-  T ^= AES128_modified(m_context.get_subkey<2>(), S.S[2]);
-  T ^= AES128_modified(m_context.get_subkey<3>(), S.S[3]);
-  T ^= AES128_modified(m_context.get_subkey<4>(), S.S[4]);
-  T ^= AES128_modified(m_context.get_subkey<5>(), S.S[5]);
-  T ^= AES128_modified(m_context.get_subkey<6>(), S.S[6]);
-  T ^= AES128_modified(m_context.get_subkey<7>(), S.S[7]);
-  T ^= AES128_modified(m_context.get_subkey<8>(), S.S[8]);
-#endif
+  // operate on a copy of the state and write it back later
+  auto state = m_state;
+  copy_and_process_blocks(state.s, state.r, dst, data.data(), whole_blocks);
+  m_state = state;
 
-  const auto tag = AES128(m_context.keys[1], T);
-  vst1q_u8(target.data(), tag);
+  // the tail goes both to dst and m_buf
+  m_bufsize = data.size() - whole_blocks * block_size;
+  if (m_bufsize) {
+    const auto offset = whole_blocks * block_size;
+    std::memcpy(dst + offset, data.data() + offset, m_bufsize);
+    std::memcpy(m_buf.data(), data.data() + offset, m_bufsize);
+  }
 }
 
 std::array<uint8_t, 16>
-LemacArm64v8A::oneshot(std::span<const uint8_t> data,
-                       std::span<const uint8_t> nonce) const noexcept {
+LemacArm64v8A::copy_and_oneshot(std::uint8_t* dst,
+                                std::span<const uint8_t> data,
+                                std::span<const uint8_t> nonce) const noexcept {
   auto copy = *this;
   copy.reset();
-  copy.update(data);
+  copy.copy_and_update(dst, data);
   std::array<uint8_t, 16> ret;
   copy.finalize_to(nonce, ret);
   return ret;
 }
 
+void LemacArm64v8A::init_stream(detail::StreamState& state) const noexcept {
+  static_assert(sizeof(arm64v8detail::ComboState) <= sizeof(state.storage));
+  static_assert(alignof(arm64v8detail::ComboState) <=
+                alignof(detail::StreamState));
+  auto initial = new (state.storage.data()) arm64v8detail::ComboState;
+  initial->s = m_context.init;
+  initial->r.reset();
+}
+
+void LemacArm64v8A::absorb_streams(std::span<detail::StreamState* const> states,
+                                   std::span<const std::uint8_t* const> data,
+                                   const std::size_t nblocks) const noexcept {
+  assert(states.size() == data.size());
+  constexpr std::size_t lanes = stream_interleave_lanes;
+
+  for (std::size_t i = 0; i < states.size(); i += lanes) {
+    const auto n = std::min(lanes, states.size() - i);
+    // operate on copies and write them back later, like update() does
+    arm64v8detail::ComboState local[lanes];
+    for (std::size_t j = 0; j < n; ++j) {
+      local[j] = *get_stream(*states[i + j]);
+    }
+    if (n == lanes) {
+      process_blocks_interleaved<lanes>(local, &data[i], nblocks);
+    } else {
+      for (std::size_t j = 0; j < n; ++j) {
+        process_blocks_interleaved<1>(&local[j], &data[i + j], nblocks);
+      }
+    }
+    for (std::size_t j = 0; j < n; ++j) {
+      *get_stream(*states[i + j]) = local[j];
+    }
+  }
+}
+
+void LemacArm64v8A::finalize_stream(detail::StreamState& state,
+                                    std::span<const std::uint8_t> tail,
+                                    std::span<const std::uint8_t> nonce,
+                                    std::span<std::uint8_t, 16> target) const
+    noexcept {
+  assert(tail.size() < block_size);
+  auto local = *get_stream(state);
+  std::array<std::uint8_t, block_size> buf;
+  if (!tail.empty()) {
+    std::memcpy(buf.data(), tail.data(), tail.size());
+  }
+  finalize_state(m_context, local, buf, tail.size(), nonce, target);
+}
+
 void LemacArm64v8A::reset() noexcept {
   m_state.s = m_context.init;
   m_state.r.reset();
@@ -451,13 +671,38 @@ std::string LemacArm64v8A::get_internal_state() const noexcept {
 }
 #endif
 
-std::unique_ptr<detail::ImplInterface> make_arm64_v8A() {
-  return std::make_unique<LemacArm64v8A>();
+detail::impl_ptr make_arm64_v8A() {
+  return detail::impl_ptr{new LemacArm64v8A()};
+}
+
+detail::impl_ptr make_arm64_v8A(std::span<const uint8_t, key_size> key) {
+  return detail::impl_ptr{new LemacArm64v8A(key)};
+}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+detail::impl_ptr make_arm64_v8A(std::span<const uint8_t, key_size> key,
+                                std::pmr::memory_resource* resource) {
+  return detail::make_in<LemacArm64v8A>(resource, key);
 }
+#endif
 
-std::unique_ptr<detail::ImplInterface>
-make_arm64_v8A(std::span<const uint8_t, key_size> key) {
-  return std::make_unique<LemacArm64v8A>(key);
+detail::ImplInterface*
+make_arm64_v8A_at(void* memory, std::span<const uint8_t, key_size> key) {
+  return new (memory) LemacArm64v8A(key);
+}
+
+detail::object_layout arm64_v8A_layout() noexcept {
+  return {sizeof(LemacArm64v8A), alignof(LemacArm64v8A)};
+}
+
+tuning_table tune_arm64_v8A() { return get_arm64_v8A_tuning_table(); }
+
+tuning_table get_arm64_v8A_tuning_table() {
+  tuning_table ret{};
+  for (std::size_t i = 0; i < ret.oneshot.size(); ++i) {
+    ret.oneshot[i].max_size = detail::size_class_limits[i];
+  }
+  return ret;
 }
 
 void arm64v8detail::Rstate::reset() { std::memset(this, 0, sizeof(*this)); }
@@ -54,7 +54,13 @@ public:
   LemacArm64v8A& operator=(const LemacArm64v8A&) = default;
   LemacArm64v8A& operator=(LemacArm64v8A&&) = default;
 
-  std::unique_ptr<detail::ImplInterface> clone() const noexcept override;
+  detail::impl_ptr clone() const override;
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+  detail::impl_ptr clone(std::pmr::memory_resource* resource) const override;
+
+  void destroy(std::pmr::memory_resource* resource) noexcept override;
+#endif
 
   void update(std::span<const uint8_t> data) noexcept override;
 
@@ -66,6 +72,32 @@ public:
           std::span<const uint8_t> nonce) const noexcept override;
 
   void reset() noexcept override;
+
+  void copy_and_update(std::uint8_t* dst,
+                       std::span<const uint8_t> data) noexcept override;
+
+  std::array<uint8_t, 16>
+  copy_and_oneshot(std::uint8_t* dst, std::span<const uint8_t> data,
+                   std::span<const uint8_t> nonce) const noexcept override;
+
+  backend get_backend() const noexcept override { return backend::arm64_v8a; }
+
+  std::size_t stream_interleave() const noexcept override {
+    return stream_interleave_lanes;
+  }
+
+  void init_stream(detail::StreamState& state) const noexcept override;
+
+  void absorb_streams(std::span<detail::StreamState* const> states,
+                      std::span<const std::uint8_t* const> data,
+                      std::size_t nblocks) const noexcept override;
+
+  void finalize_stream(detail::StreamState& state,
+                       std::span<const std::uint8_t> tail,
+                       std::span<const std::uint8_t> nonce,
+                       std::span<std::uint8_t, 16> target) const
+      noexcept override;
+
 #ifdef LEMAC_INTERNAL_STATE_VISIBILITY
   std::string get_internal_state() const noexcept override;
 #endif
@@ -75,6 +107,15 @@ private:
 
   static constexpr std::size_t block_size = 64;
 
+  /// inputs with at least this many bytes of whole blocks are absorbed with
+  /// the streaming kernel, which prefetches ahead
+  static constexpr std::size_t streaming_threshold = 256 * 1024;
+
+  /// the number of messages absorbed in an interleaved fashion by
+  /// absorb_streams(). there are 32 vector registers and each message state
+  /// occupies 13 of them.
+  static constexpr std::size_t stream_interleave_lanes = 2;
+
   /// this is a buffer that keeps data between update() invocations,
   /// in case data is provided in sizes not evenly divisible by the block size
   std::array<std::uint8_t, block_size> m_buf{};
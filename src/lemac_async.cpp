@@ -0,0 +1,403 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "lemac_async.h"
+#include "lemac_uring.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace lemac::inline v1 {
+
+namespace {
+using detail::io_request;
+
+/// where reads are carried out. finished reads are handed back by reap().
+class Backend {
+public:
+  virtual ~Backend() = default;
+  virtual io_backend kind() const noexcept = 0;
+  virtual void start(io_request& request) = 0;
+  /// appends the finished requests, with their results stored
+  virtual void reap(bool block, std::vector<io_request*>& finished) = 0;
+  virtual int completion_fd() const noexcept = 0;
+};
+
+/// the result of a blocking read, or a negative errno
+long long blocking_read(int fd, std::span<std::uint8_t> buffer) {
+  for (;;) {
+#if defined(_WIN32)
+    const auto ret = _read(
+        fd, buffer.data(),
+        static_cast<unsigned>(std::min<std::size_t>(buffer.size(), INT_MAX)));
+#else
+    const auto ret = ::read(fd, buffer.data(), buffer.size());
+#endif
+    if (ret >= 0) {
+      return ret;
+    }
+#if !defined(_WIN32)
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // a non-blocking descriptor, wait until there is something to read
+      pollfd pfd{fd, POLLIN, 0};
+      ::poll(&pfd, 1, -1);
+      continue;
+    }
+#endif
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+class ThreadBackend final : public Backend {
+public:
+  explicit ThreadBackend(unsigned nthreads) {
+#if !defined(_WIN32)
+    if (::pipe(m_pipe) == 0) {
+      for (const int fd : m_pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+    } else {
+      m_pipe[0] = m_pipe[1] = -1;
+    }
+#endif
+    nthreads = std::max(1U, nthreads);
+    m_threads.reserve(nthreads);
+    for (unsigned i = 0; i < nthreads; ++i) {
+      m_threads.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ThreadBackend() override {
+    {
+      std::lock_guard lock(m_mutex);
+      m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto& t : m_threads) {
+      t.join();
+    }
+#if !defined(_WIN32)
+    for (const int fd : m_pipe) {
+      if (fd != -1) {
+        ::close(fd);
+      }
+    }
+#endif
+  }
+
+  io_backend kind() const noexcept override { return io_backend::threads; }
+
+  void start(io_request& request) override {
+    {
+      std::lock_guard lock(m_mutex);
+      m_queue.push_back(&request);
+    }
+    m_work_cv.notify_one();
+  }
+
+  void reap(bool block, std::vector<io_request*>& finished) override {
+    std::unique_lock lock(m_mutex);
+    if (block) {
+      m_done_cv.wait(lock, [this] { return !m_done.empty(); });
+    }
+#if !defined(_WIN32)
+    // drain while holding the lock. a worker which finishes after this sees
+    // m_done empty and writes to the pipe again, so the wakeup is not lost.
+    if (m_pipe[0] != -1) {
+      char drain[64];
+      while (::read(m_pipe[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+#endif
+    finished.insert(finished.end(), m_done.begin(), m_done.end());
+    m_done.clear();
+  }
+
+  int completion_fd() const noexcept override { return m_pipe[0]; }
+
+private:
+  void work() {
+    for (;;) {
+      std::unique_lock lock(m_mutex);
+      m_work_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+      if (m_queue.empty()) {
+        return;
+      }
+      auto* const request = m_queue.front();
+      m_queue.pop_front();
+      lock.unlock();
+
+      request->result = blocking_read(request->fd, request->buffer);
+
+      lock.lock();
+      [[maybe_unused]] const bool was_empty = m_done.empty();
+      m_done.push_back(request);
+      lock.unlock();
+      m_done_cv.notify_one();
+#if !defined(_WIN32)
+      if (was_empty && m_pipe[1] != -1) {
+        const char wake = 1;
+        [[maybe_unused]] const auto ret = ::write(m_pipe[1], &wake, 1);
+      }
+#endif
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_work_cv;
+  std::condition_variable m_done_cv;
+  std::deque<io_request*> m_queue;
+  std::vector<io_request*> m_done;
+  bool m_stop{};
+  int m_pipe[2]{-1, -1};
+  std::vector<std::thread> m_threads;
+};
+
+#if LEMAC_HAS_IO_URING
+class UringBackend final : public Backend {
+public:
+  explicit UringBackend(std::unique_ptr<detail::IoUring> ring)
+      : m_ring(std::move(ring)) {}
+
+  io_backend kind() const noexcept override { return io_backend::io_uring; }
+
+  void start(io_request& request) override {
+    // never have more in flight than there is room for completions
+    while (m_in_flight >= m_ring->cq_entries()) {
+      collect(true);
+    }
+    queue(request);
+    // submit right away, so the kernel reads while the caller hashes
+    check(m_ring->submit());
+    ++m_in_flight;
+  }
+
+  void reap(bool block, std::vector<io_request*>& finished) override {
+    collect(block && m_finished.empty());
+    finished.insert(finished.end(), m_finished.begin(), m_finished.end());
+    m_finished.clear();
+  }
+
+  int completion_fd() const noexcept override { return m_ring->fd(); }
+
+private:
+  void queue(io_request& request) {
+    const auto size = static_cast<unsigned>(
+        std::min<std::size_t>(request.buffer.size(), UINT_MAX / 2));
+    while (!m_ring->prepare_read(request.fd, request.buffer.data(), size,
+                                 static_cast<std::uint64_t>(-1),
+                                 reinterpret_cast<std::uintptr_t>(&request))) {
+      check(m_ring->submit());
+    }
+  }
+
+  void collect(bool block) {
+    if (block) {
+      check(m_ring->submit(1));
+    }
+    bool resubmit = false;
+    m_ring->reap([&](std::uint64_t user_data, int res) {
+      auto* const request = reinterpret_cast<io_request*>(user_data);
+      if (res == -EAGAIN || res == -EINTR) {
+        queue(*request);
+        resubmit = true;
+        return;
+      }
+      request->result = res;
+      m_finished.push_back(request);
+      --m_in_flight;
+    });
+    if (resubmit) {
+      check(m_ring->submit());
+    }
+  }
+
+  static void check(int ret) {
+    if (ret < 0) {
+      throw std::system_error(-ret, std::generic_category(),
+                              "io_uring_enter failed");
+    }
+  }
+
+  std::unique_ptr<detail::IoUring> m_ring;
+  std::size_t m_in_flight{};
+  std::vector<io_request*> m_finished;
+};
+#endif
+} // namespace
+
+std::string_view to_string(const io_backend b) {
+  switch (b) {
+  case io_backend::automatic:
+    return "automatic";
+  case io_backend::io_uring:
+    return "io_uring";
+  case io_backend::threads:
+    return "threads";
+  }
+  return "unknown";
+}
+
+class IoContext::Impl {
+public:
+  explicit Impl(const options& opts) {
+#if LEMAC_HAS_IO_URING
+    if (opts.backend != io_backend::threads) {
+      if (auto ring = detail::IoUring::create(std::max(1U, opts.queue_depth))) {
+        backend = std::make_unique<UringBackend>(std::move(ring));
+      }
+    }
+#endif
+    if (!backend) {
+      if (opts.backend == io_backend::io_uring) {
+        throw std::runtime_error("io_uring is not available");
+      }
+      backend = std::make_unique<ThreadBackend>(opts.threads);
+    }
+  }
+
+  std::unique_ptr<Backend> backend;
+  /// reads started but not yet handed back by the backend
+  std::size_t outstanding{};
+  std::vector<detail::io_request*> finished;
+  std::vector<task<void>> spawned;
+};
+
+std::size_t IoContext::read_operation::await_resume() const {
+  if (result < 0) {
+    throw std::system_error(static_cast<int>(-result), std::generic_category(),
+                            "async read failed");
+  }
+  return static_cast<std::size_t>(result);
+}
+
+IoContext::IoContext() : IoContext(options{}) {}
+
+IoContext::IoContext(const options& opts)
+    : m_impl(std::make_unique<Impl>(opts)) {}
+
+IoContext::~IoContext() {
+  // the reads write into the frames of the spawned tasks
+  while (m_impl->outstanding > 0) {
+    m_impl->finished.clear();
+    m_impl->backend->reap(true, m_impl->finished);
+    m_impl->outstanding -= m_impl->finished.size();
+  }
+  m_impl->spawned.clear();
+}
+
+io_backend IoContext::backend() const noexcept {
+  return m_impl->backend->kind();
+}
+
+void IoContext::start(read_operation& op) {
+  m_impl->backend->start(op);
+  ++m_impl->outstanding;
+}
+
+void IoContext::spawn(task<void> t) {
+  t.start();
+  m_impl->spawned.push_back(std::move(t));
+}
+
+std::size_t IoContext::process(const bool block) {
+  std::vector<detail::io_request*> finished;
+  finished.swap(m_impl->finished);
+  finished.clear();
+  if (m_impl->outstanding > 0) {
+    m_impl->backend->reap(block, finished);
+    m_impl->outstanding -= finished.size();
+  }
+  for (auto* request : finished) {
+    static_cast<read_operation*>(request)->m_done = true;
+  }
+  // resuming may end the coroutine and with it the operation, so the waiter
+  // is taken out first
+  for (auto* request : finished) {
+    auto* const op = static_cast<read_operation*>(request);
+    if (auto waiter = std::exchange(op->m_waiter, {})) {
+      waiter.resume();
+    }
+  }
+  const auto count = finished.size();
+  finished.clear();
+  m_impl->finished.swap(finished);
+
+  // let go of the spawned tasks which are done
+  std::exception_ptr error;
+  std::erase_if(m_impl->spawned, [&](task<void>& t) {
+    if (!t.done()) {
+      return false;
+    }
+    if (!error) {
+      try {
+        t.get();
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+    return true;
+  });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return count;
+}
+
+std::size_t IoContext::poll() { return process(false); }
+
+std::size_t IoContext::run_one() { return process(true); }
+
+void IoContext::run() {
+  do {
+    process(true);
+  } while (m_impl->outstanding > 0);
+}
+
+int IoContext::completion_fd() const noexcept {
+  return m_impl->backend->completion_fd();
+}
+
+task<tag> async_hash(IoContext& io, LeMac hasher, const int fd,
+                     const std::array<std::uint8_t, 16> nonce,
+                     std::size_t chunk_size) {
+  chunk_size = std::max<std::size_t>(chunk_size, 4096);
+  // one buffer is hashed while the other is read into
+  std::unique_ptr<std::uint8_t[]> storage(new std::uint8_t[2 * chunk_size]);
+  std::span<std::uint8_t> current(storage.get(), chunk_size);
+  std::span<std::uint8_t> next(storage.get() + chunk_size, chunk_size);
+
+  hasher.reset();
+  auto got = co_await io.read(fd, current);
+  while (got > 0) {
+    auto reading = io.read(fd, next);
+    hasher.update(current.first(got));
+    got = co_await reading;
+    std::swap(current, next);
+  }
+  co_return hasher.finalize(nonce);
+}
+
+} // namespace lemac::inline v1
@@ -0,0 +1,99 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#include "lemac_batch.h"
+
+namespace lemac::inline v1::detail {
+
+namespace {
+/// the number of messages handed to the backend at a time
+constexpr std::size_t group_size = 8;
+
+constexpr std::array<const std::uint8_t, 16> zeros{};
+
+/// hashes at most group_size messages
+void oneshot_group(const ImplInterface& impl,
+                   std::span<const std::span<const std::uint8_t>> messages,
+                   std::span<const std::span<const std::uint8_t>> nonces,
+                   std::span<tag> outputs) noexcept {
+  assert(messages.size() <= group_size);
+
+  std::array<StreamState, group_size> states;
+  // the messages which still have whole blocks to absorb
+  std::array<std::size_t, group_size> active;
+  std::array<std::size_t, group_size> offset;
+  std::array<std::size_t, group_size> remaining;
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    impl.init_stream(states[i]);
+    offset[i] = 0;
+    if (messages[i].size() >= block_size) {
+      active[n++] = i;
+    }
+    remaining[i] = messages[i].size() / block_size;
+  }
+
+  // absorb the same number of blocks from all active messages at a time,
+  // limited by the one with the fewest
+  std::array<StreamState*, group_size> state_ptrs;
+  std::array<const std::uint8_t*, group_size> data;
+  while (n != 0) {
+    std::size_t nblocks = remaining[active[0]];
+    for (std::size_t j = 0; j < n; ++j) {
+      const auto i = active[j];
+      nblocks = std::min(nblocks, remaining[i]);
+      state_ptrs[j] = &states[i];
+      data[j] = messages[i].data() + offset[i];
+    }
+    impl.absorb_streams(std::span(state_ptrs).first(n),
+                        std::span(data).first(n), nblocks);
+    for (std::size_t j = 0; j < n;) {
+      const auto i = active[j];
+      offset[i] += nblocks * block_size;
+      remaining[i] -= nblocks;
+      if (remaining[i] == 0) {
+        active[j] = active[--n];
+      } else {
+        ++j;
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    impl.finalize_stream(states[i], messages[i].subspan(offset[i]),
+                         nonces.empty() ? zeros : nonces[i], outputs[i]);
+  }
+}
+} // namespace
+
+void oneshot_batch(const ImplInterface& impl,
+                   std::span<const std::span<const std::uint8_t>> messages,
+                   std::span<const std::span<const std::uint8_t>> nonces,
+                   std::span<tag> outputs) noexcept {
+  assert(nonces.empty() || nonces.size() == messages.size());
+  assert(outputs.size() == messages.size());
+  if (impl.stream_interleave() == 1) {
+    // nothing to gain from handing the messages over together
+    for (std::size_t i = 0; i < messages.size(); ++i) {
+      outputs[i] =
+          impl.oneshot(messages[i], nonces.empty() ? zeros : nonces[i]);
+    }
+    return;
+  }
+  for (std::size_t i = 0; i < messages.size(); i += group_size) {
+    const auto n = std::min(group_size, messages.size() - i);
+    oneshot_group(impl, messages.subspan(i, n),
+                  nonces.empty() ? nonces : nonces.subspan(i, n),
+                  outputs.subspan(i, n));
+  }
+}
+
+} // namespace lemac::inline v1::detail
@@ -0,0 +1,30 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "impl_interface.h"
+#include "lemac.h"
+
+namespace lemac::inline v1::detail {
+
+/**
+ * hashes many messages, like impl.oneshot(messages[i], nonces[i]) for all i.
+ * the interleaved multi-message kernel of the backend is used, if it has one.
+ *
+ * @param nonces either empty, meaning zero nonces, or one 16 byte nonce per
+ * message
+ * @param outputs one per message
+ */
+void oneshot_batch(const ImplInterface& impl,
+                   std::span<const std::span<const std::uint8_t>> messages,
+                   std::span<const std::span<const std::uint8_t>> nonces,
+                   std::span<tag> outputs) noexcept;
+
+} // namespace lemac::inline v1::detail
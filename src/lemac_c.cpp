@@ -0,0 +1,112 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <new>
+
+#include "impl_interface.h"
+#include "lemac_batch.h"
+#include "lemac_c.h"
+
+namespace {
+using lemac::detail::ImplInterface;
+
+constexpr std::array<const std::uint8_t, 16> zeros{};
+
+/// the implementation is constructed at the start of the storage
+ImplInterface* get(void* state) noexcept {
+  return std::launder(static_cast<ImplInterface*>(state));
+}
+
+const ImplInterface* get(const void* state) noexcept {
+  return std::launder(static_cast<const ImplInterface*>(state));
+}
+
+std::span<const std::uint8_t> nonce_or_zeros(const uint8_t* nonce) noexcept {
+  if (nonce == nullptr) {
+    return zeros;
+  }
+  return {nonce, 16};
+}
+
+/// the number of messages lemac_oneshot_batch() hands over at a time
+constexpr std::size_t batch_chunk = 32;
+} // namespace
+
+extern "C" {
+
+size_t lemac_state_size(void) { return lemac::detail::impl_layout().size; }
+
+size_t lemac_state_alignment(void) {
+  return lemac::detail::impl_layout().alignment;
+}
+
+int lemac_init(void* storage, const uint8_t* key) {
+  if (storage == nullptr || key == nullptr ||
+      reinterpret_cast<std::uintptr_t>(storage) % lemac_state_alignment() !=
+          0) {
+    return -1;
+  }
+  auto* const impl = lemac::detail::make_impl_at(
+      storage, std::span<const std::uint8_t, lemac::key_size>(
+                   key, lemac::key_size));
+  if (static_cast<void*>(impl) != storage) {
+    // the interface is not at the start of the implementation, which the
+    // other functions rely on. no known abi does this.
+    impl->~ImplInterface();
+    return -1;
+  }
+  return 0;
+}
+
+void lemac_destroy(void* state) { get(state)->~ImplInterface(); }
+
+void lemac_update(void* state, const uint8_t* data, size_t size) {
+  get(state)->update({data, size});
+}
+
+void lemac_finalize(void* state, const uint8_t* nonce, uint8_t* tag) {
+  get(state)->finalize_to(nonce_or_zeros(nonce),
+                          std::span<std::uint8_t, 16>(tag, 16));
+}
+
+void lemac_reset(void* state) { get(state)->reset(); }
+
+void lemac_oneshot(const void* state, const uint8_t* data, size_t size,
+                   const uint8_t* nonce, uint8_t* tag) {
+  const auto hash = get(state)->oneshot({data, size}, nonce_or_zeros(nonce));
+  std::memcpy(tag, hash.data(), hash.size());
+}
+
+void lemac_oneshot_batch(const void* state, size_t count,
+                         const uint8_t* const* data, const size_t* sizes,
+                         const uint8_t* const* nonces, uint8_t* tags) {
+  const auto* const impl = get(state);
+  std::array<std::span<const std::uint8_t>, batch_chunk> messages;
+  std::array<std::span<const std::uint8_t>, batch_chunk> chunk_nonces;
+  std::array<lemac::tag, batch_chunk> hashes;
+  for (std::size_t i = 0; i < count; i += batch_chunk) {
+    const auto n = std::min(batch_chunk, count - i);
+    for (std::size_t j = 0; j < n; ++j) {
+      messages[j] = {data[i + j], sizes[i + j]};
+      if (nonces) {
+        chunk_nonces[j] = {nonces[i + j], 16};
+      }
+    }
+    lemac::detail::oneshot_batch(
+        *impl, std::span(messages).first(n),
+        std::span(chunk_nonces).first(nonces ? n : 0),
+        std::span(hashes).first(n));
+    for (std::size_t j = 0; j < n; ++j) {
+      std::memcpy(tags + (i + j) * 16, hashes[j].data(), 16);
+    }
+  }
+}
+
+} // extern "C"
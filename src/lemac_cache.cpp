@@ -0,0 +1,329 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept> // std::runtime_error
+
+#include "lemac_cache.h"
+
+namespace lemac::inline v1 {
+
+namespace {
+/// gives each cache a distinct id, never reused
+std::atomic<std::uint64_t> next_cache_id{1};
+
+/// an entry in the table each thread keeps of its recent lookups. it does
+/// not own the node, which is only valid while the cache is at generation.
+struct LocalSlot {
+  std::uint64_t cache_id{};
+  std::uint64_t generation{};
+  std::array<std::uint8_t, key_size> key{};
+  const void* node{};
+};
+
+/// the number of recent lookups each thread keeps, for all caches together
+constexpr std::size_t local_slots = 16;
+
+thread_local std::array<LocalSlot, local_slots> local_table;
+
+/// one in this many hits in the local table refreshes the eviction order
+constexpr std::uint32_t touch_interval = 64;
+
+thread_local std::uint32_t local_hits{};
+
+/**
+ * a hazard pointer: the node a thread is hashing with, found through its
+ * local table. a dropped node is not destroyed while it is in a hazard.
+ * they are never freed, but reused when their thread exits.
+ */
+struct Hazard {
+  std::atomic<const void*> node{};
+  std::atomic<bool> taken{};
+  Hazard* next{};
+};
+
+/// all hazards ever made, shared by all caches
+std::atomic<Hazard*> hazards{};
+
+/// the hazard of the calling thread
+class HazardOwner {
+public:
+  HazardOwner() {
+    for (Hazard* h = hazards.load(std::memory_order_acquire); h;
+         h = h->next) {
+      bool expected = false;
+      if (!h->taken.load(std::memory_order_relaxed) &&
+          h->taken.compare_exchange_strong(expected, true,
+                                           std::memory_order_acquire)) {
+        m_hazard = h;
+        return;
+      }
+    }
+    m_hazard = new Hazard;
+    m_hazard->taken.store(true, std::memory_order_relaxed);
+    Hazard* head = hazards.load(std::memory_order_relaxed);
+    do {
+      m_hazard->next = head;
+    } while (!hazards.compare_exchange_weak(head, m_hazard,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+  }
+  HazardOwner(const HazardOwner&) = delete;
+  HazardOwner& operator=(const HazardOwner&) = delete;
+  ~HazardOwner() {
+    m_hazard->node.store(nullptr, std::memory_order_relaxed);
+    m_hazard->taken.store(false, std::memory_order_release);
+  }
+
+  Hazard& get() noexcept { return *m_hazard; }
+
+private:
+  Hazard* m_hazard;
+};
+
+/// the hazard of the calling thread, set up on first use. kept apart from
+/// its owner, which needs a guard on every access.
+thread_local Hazard* local_hazard{};
+
+Hazard& get_local_hazard() {
+  if (!local_hazard) {
+    thread_local HazardOwner owner;
+    local_hazard = &owner.get();
+  }
+  return *local_hazard;
+}
+
+std::uint64_t load64(const std::uint8_t* p) noexcept {
+  std::uint64_t ret;
+  std::memcpy(&ret, p, sizeof(ret));
+  return ret;
+}
+
+std::uint64_t mix(std::uint64_t x) noexcept {
+  x ^= x >> 32;
+  x *= 0x9E3779B97F4A7C15;
+  return x ^ (x >> 29);
+}
+
+/// picks which of the hit counters the calling thread uses
+std::size_t hit_counter_index() noexcept {
+  static std::atomic<std::size_t> next{0};
+  thread_local const std::size_t index =
+      next.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+} // namespace
+
+struct ContextCache::Node : std::enable_shared_from_this<Node> {
+  explicit Node(const key_type& key) : hasher(key) {}
+  const LeMac hasher;
+};
+
+class ContextCache::Pin {
+public:
+  Pin() : m_hazard(get_local_hazard().node) {}
+  Pin(const Pin&) = delete;
+  Pin& operator=(const Pin&) = delete;
+  ~Pin() { m_hazard.store(nullptr, std::memory_order_release); }
+
+  /// publishes node as in use. it must be checked to still be valid
+  /// afterwards.
+  void protect(const void* node) noexcept {
+    m_hazard.store(node, std::memory_order_seq_cst);
+  }
+
+  /// set when the node was found in the shared table
+  std::shared_ptr<const Node> owner;
+
+private:
+  std::atomic<const void*>& m_hazard;
+};
+
+std::size_t
+ContextCache::KeyHash::operator()(const key_type& key) const noexcept {
+  return static_cast<std::size_t>(
+      mix(load64(key.data()) ^ mix(load64(key.data() + 8))));
+}
+
+ContextCache::ContextCache(const std::size_t capacity)
+    : m_id(next_cache_id.fetch_add(1, std::memory_order_relaxed)),
+      m_capacity(capacity) {
+  if (m_capacity == 0) {
+    throw std::runtime_error("capacity must be positive");
+  }
+}
+
+ContextCache::~ContextCache() = default;
+
+std::shared_ptr<const LeMac>
+ContextCache::get(std::span<const std::uint8_t> key) {
+  Pin pin;
+  const auto& node = find(key, pin);
+  return {node.shared_from_this(), &node.hasher};
+}
+
+std::array<std::uint8_t, 16>
+ContextCache::oneshot(std::span<const std::uint8_t> key,
+                      std::span<const std::uint8_t> data,
+                      std::span<const std::uint8_t> nonce) {
+  Pin pin;
+  return find(key, pin).hasher.oneshot(data, nonce);
+}
+
+const ContextCache::Node&
+ContextCache::find(std::span<const std::uint8_t> key, Pin& pin) {
+  if (key.size() != key_size) {
+    throw std::runtime_error("wrong size of key");
+  }
+  key_type k;
+  std::memcpy(k.data(), key.data(), k.size());
+
+  auto& slot =
+      local_table[mix(KeyHash{}(k) ^ m_id) % local_table.size()];
+  if (slot.cache_id == m_id && slot.key == k) {
+    // the node is valid if no key was dropped since the slot was filled.
+    // checking after publishing the hazard means that retire() either sees
+    // the hazard, or raised the generation before the check.
+    pin.protect(slot.node);
+    if (m_generation.load(std::memory_order_seq_cst) == slot.generation) {
+      m_hits[hit_counter_index() % m_hits.size()].value.fetch_add(
+          1, std::memory_order_relaxed);
+      if (++local_hits % touch_interval == 0) {
+        touch(k);
+      }
+      return *static_cast<const Node*>(slot.node);
+    }
+  }
+
+  // a generation read before the lookup is safe to record, since the node
+  // found is in the table at some point after it
+  const auto generation = m_generation.load(std::memory_order_seq_cst);
+  pin.owner = get_shared(k);
+  slot.cache_id = m_id;
+  slot.generation = generation;
+  slot.key = k;
+  slot.node = pin.owner.get();
+  return *pin.owner;
+}
+
+std::shared_ptr<const ContextCache::Node>
+ContextCache::get_shared(const key_type& key) {
+  {
+    std::lock_guard lock(m_mutex);
+    reclaim();
+    if (const auto it = m_index.find(key); it != m_index.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      m_hits[hit_counter_index() % m_hits.size()].value.fetch_add(
+          1, std::memory_order_relaxed);
+      return it->second->node;
+    }
+  }
+
+  // set up the key outside the lock, so other threads are not held up
+  auto made = std::make_shared<const Node>(key);
+
+  std::lock_guard lock(m_mutex);
+  ++m_misses;
+  if (const auto it = m_index.find(key); it != m_index.end()) {
+    // another thread got there first
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->node;
+  }
+  m_lru.push_front(Entry{key, made});
+  try {
+    m_index.emplace(key, m_lru.begin());
+  } catch (...) {
+    m_lru.pop_front();
+    throw;
+  }
+  if (m_lru.size() > m_capacity) {
+    m_retired.reserve(m_retired.size() + m_lru.size() - m_capacity);
+    while (m_lru.size() > m_capacity) {
+      m_index.erase(m_lru.back().key);
+      m_retired.push_back(std::move(m_lru.back().node));
+      m_lru.pop_back();
+      ++m_evictions;
+    }
+    retire();
+  }
+  return made;
+}
+
+void ContextCache::touch(const key_type& key) {
+  std::unique_lock lock(m_mutex, std::try_to_lock);
+  if (!lock) {
+    return;
+  }
+  if (const auto it = m_index.find(key); it != m_index.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+  }
+}
+
+void ContextCache::retire() {
+  m_generation.fetch_add(1, std::memory_order_seq_cst);
+  reclaim();
+}
+
+void ContextCache::reclaim() {
+  if (m_retired.empty()) {
+    return;
+  }
+  const auto in_use = [](const Node* node) {
+    for (Hazard* h = hazards.load(std::memory_order_acquire); h;
+         h = h->next) {
+      if (h->node.load(std::memory_order_seq_cst) == node) {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::erase_if(m_retired,
+                [&](const auto& node) { return !in_use(node.get()); });
+}
+
+void ContextCache::clear() {
+  std::lock_guard lock(m_mutex);
+  m_retired.reserve(m_retired.size() + m_lru.size());
+  m_index.clear();
+  for (auto& entry : m_lru) {
+    m_retired.push_back(std::move(entry.node));
+  }
+  m_lru.clear();
+  retire();
+}
+
+ContextCache::statistics ContextCache::get_statistics() const {
+  statistics ret;
+  for (const auto& hits : m_hits) {
+    ret.hits += hits.value.load(std::memory_order_relaxed);
+  }
+  std::lock_guard lock(m_mutex);
+  ret.misses = m_misses;
+  ret.evictions = m_evictions;
+  ret.entries = m_lru.size();
+  return ret;
+}
+
+ContextCache& ContextCache::global() {
+  static ContextCache cache;
+  return cache;
+}
+
+std::array<std::uint8_t, 16> oneshot(std::span<const std::uint8_t> key,
+                                     std::span<const std::uint8_t> data,
+                                     std::span<const std::uint8_t> nonce) {
+  return ContextCache::global().oneshot(key, data, nonce);
+}
+
+std::array<std::uint8_t, 16> oneshot(std::span<const std::uint8_t> key,
+                                     std::span<const std::uint8_t> data) {
+  static constexpr std::array<const std::uint8_t, 16> zeros{};
+  return oneshot(key, data, zeros);
+}
+
+} // namespace lemac::inline v1
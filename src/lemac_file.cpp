@@ -0,0 +1,1170 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "lemac_file.h"
+#include "lemac_uring.h"
+
+#if defined(_WIN32)
+#include <fstream>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if LEMAC_HAS_IO_URING && defined(STATX_SIZE)
+#define LEMAC_HAS_URING_BATCH 1
+#else
+#define LEMAC_HAS_URING_BATCH 0
+#endif
+
+namespace lemac::inline v1 {
+
+namespace {
+
+/// the alignment direct io needs for the buffer, the file offset and the
+/// length of each read
+constexpr std::size_t direct_alignment = 4096;
+
+/// @return size rounded up to a whole number of direct_alignment, at least one
+std::size_t aligned_size(std::size_t size) noexcept {
+  size = std::max<std::size_t>(size, direct_alignment);
+  return (size + direct_alignment - 1) / direct_alignment * direct_alignment;
+}
+
+/// a buffer kept by each thread, so hashing many files does not allocate
+/// for every file
+class ReadBuffer {
+public:
+  ReadBuffer() = default;
+  ReadBuffer(const ReadBuffer&) = delete;
+  ReadBuffer& operator=(const ReadBuffer&) = delete;
+  ~ReadBuffer() { release(); }
+
+  /// @return a buffer of at least the given size, rounded up to a whole
+  /// number of direct_alignment
+  std::span<std::uint8_t> get(std::size_t size) {
+    size = aligned_size(size);
+    if (size > m_size) {
+      release();
+      m_data = static_cast<std::uint8_t*>(
+          ::operator new(size, std::align_val_t{direct_alignment}));
+      m_size = size;
+    }
+    return {m_data, size};
+  }
+
+private:
+  void release() noexcept {
+    if (m_data) {
+      ::operator delete(m_data, std::align_val_t{direct_alignment});
+      m_data = nullptr;
+      m_size = 0;
+    }
+  }
+
+  std::uint8_t* m_data{};
+  std::size_t m_size{};
+};
+
+std::span<std::uint8_t> thread_buffer(std::size_t size) {
+  thread_local ReadBuffer buffer;
+  return buffer.get(size);
+}
+
+[[noreturn]] void throw_error(int error, const std::string& what) {
+  throw std::system_error(error, std::generic_category(), what);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+#if !defined(_WIN32)
+// RAII for file descriptor
+struct fdcloser {
+  explicit fdcloser(int fd) : m_fd(fd) {}
+  fdcloser& operator=(fdcloser&&) = delete;
+  ~fdcloser() { close(m_fd); }
+
+  int m_fd{-1};
+};
+
+// RAII for memory map
+struct mmapper {
+  mmapper(void* addr, size_t length) : m_addr(addr), m_len(length) {}
+  mmapper& operator=(mmapper&&) = delete;
+  ~mmapper() {
+    if (m_addr != MAP_FAILED) {
+      munmap(m_addr, m_len);
+    }
+  }
+
+  void* m_addr{MAP_FAILED};
+  size_t m_len{0};
+};
+
+/// regular files smaller than this are read, setting up and tearing down a
+/// memory map costs more than copying them
+constexpr std::uint64_t mmap_threshold = 64 * 1024;
+
+/// regular files larger than this can not stay in the page cache anyway, so
+/// they bypass it instead of evicting everything else
+std::uint64_t bypass_threshold() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  static const std::uint64_t threshold = [] {
+    const auto pages = sysconf(_SC_PHYS_PAGES);
+    const auto page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+      return UINT64_MAX;
+    }
+    return static_cast<std::uint64_t>(pages) *
+           static_cast<std::uint64_t>(page_size) / 2;
+  }();
+  return threshold;
+#else
+  return UINT64_MAX;
+#endif
+}
+
+io_strategy pick_strategy(const struct stat& statbuf) {
+  if (S_ISBLK(statbuf.st_mode)) {
+    return io_strategy::uring;
+  }
+  if (!S_ISREG(statbuf.st_mode)) {
+    // pipes and character devices deliver data as it is produced. reading on
+    // another core lets the producer run at full speed while hashing.
+    static const bool several_cores = std::thread::hardware_concurrency() > 1;
+    return several_cores ? io_strategy::reader_thread : io_strategy::uring;
+  }
+  const auto size = static_cast<std::uint64_t>(statbuf.st_size);
+  if (size < mmap_threshold) {
+    // includes files in /proc and /sys which report size zero
+    return io_strategy::read;
+  }
+  if (size > bypass_threshold()) {
+    return io_strategy::uring;
+  }
+  return io_strategy::mmap;
+}
+
+/// whole disks and huge files are read once, keeping them out of the page
+/// cache leaves room for what is used again
+bool pick_bypass_cache(const struct stat& statbuf) {
+  return S_ISBLK(statbuf.st_mode) ||
+         (S_ISREG(statbuf.st_mode) &&
+          static_cast<std::uint64_t>(statbuf.st_size) > bypass_threshold());
+}
+
+/// mapping windows are a whole number of this, which is a multiple of the
+/// page size on all supported platforms
+constexpr std::size_t mmap_granularity = 64 * 1024;
+
+/// a mapped window is hashed this much at a time. the kernel reads ahead by
+/// two steps, and the pages are let go of after each.
+constexpr std::size_t mmap_step = 8 * 1024 * 1024;
+
+/// asks the kernel to start reading [offset, offset + length) of the file,
+/// which is at base + pos in the window [base, base + size)
+void read_ahead([[maybe_unused]] int fd, [[maybe_unused]] std::uint8_t* base,
+                [[maybe_unused]] std::size_t size,
+                [[maybe_unused]] std::size_t pos,
+                [[maybe_unused]] std::uint64_t offset,
+                std::size_t length) noexcept {
+#if defined(POSIX_FADV_WILLNEED)
+  // goes by the file, so it reaches into the next window as well
+  posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length),
+                POSIX_FADV_WILLNEED);
+#else
+  if (pos < size) {
+    madvise(base + pos, std::min(length, size - pos), MADV_WILLNEED);
+  }
+#endif
+}
+
+#if defined(POSIX_FADV_DONTNEED)
+constexpr bool can_drop_cached = true;
+#else
+constexpr bool can_drop_cached = false;
+#endif
+
+/// drops [offset, offset + length) of the file from the page cache, where
+/// supported. pages which are still mapped are kept.
+void drop_cached([[maybe_unused]] int fd, [[maybe_unused]] std::uint64_t offset,
+                 [[maybe_unused]] std::uint64_t length) noexcept {
+#if defined(POSIX_FADV_DONTNEED)
+  posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length),
+                POSIX_FADV_DONTNEED);
+#endif
+}
+
+/**
+ * hashes a regular file of the given length by memory mapping it. a file
+ * which fits in one window is mapped and populated at once. a larger one is
+ * mapped a window at a time, so the memory used is bounded however large the
+ * file is: the kernel reads ahead of the hash cursor and the pages behind it
+ * are unmapped, and with drop_behind also evicted from the page cache.
+ * @return the hash, or nothing if the file could not be mapped at all
+ */
+std::optional<tag> hash_mapped(LeMac& hasher, int fd, std::uint64_t length,
+                               const file_options& options, bool drop_behind,
+                               const std::string& name) {
+  const std::size_t window =
+      std::max(mmap_granularity, (options.mmap_window + mmap_granularity - 1) /
+                                     mmap_granularity * mmap_granularity);
+
+  if (length <= window) {
+    const auto size = static_cast<std::size_t>(length);
+    std::optional<tag> hash;
+    {
+      const auto memory_map = mmapper(mmap(nullptr, size, PROT_READ,
+                                           MAP_FILE | MAP_PRIVATE
+#ifdef __linux__
+                                               | MAP_POPULATE
+#endif
+                                           ,
+                                           fd, 0),
+                                      size);
+      if (memory_map.m_addr == MAP_FAILED) {
+        return std::nullopt;
+      }
+      const auto* addr =
+          reinterpret_cast<const std::uint8_t*>(memory_map.m_addr);
+      hash = hasher.oneshot(std::span{addr, size}, options.nonce);
+    }
+    if (drop_behind) {
+      drop_cached(fd, 0, length);
+    }
+    return hash;
+  }
+
+  const std::size_t step = std::min(mmap_step, window);
+  hasher.reset();
+  for (std::uint64_t offset = 0; offset < length; offset += window) {
+    const auto size = static_cast<std::size_t>(
+        std::min<std::uint64_t>(window, length - offset));
+    const auto memory_map =
+        mmapper(mmap(nullptr, size, PROT_READ, MAP_FILE | MAP_PRIVATE, fd,
+                     static_cast<off_t>(offset)),
+                size);
+    if (memory_map.m_addr == MAP_FAILED) {
+      if (offset == 0) {
+        return std::nullopt;
+      }
+      throw_error(errno, "failed memory mapping " + name);
+    }
+    auto* const base = static_cast<std::uint8_t*>(memory_map.m_addr);
+    madvise(base, size, MADV_SEQUENTIAL);
+    if (offset == 0) {
+      read_ahead(fd, base, size, 0, 0, step);
+    }
+    for (std::size_t pos = 0; pos < size; pos += step) {
+      const auto n = std::min(step, size - pos);
+      // read in the next steps while this one is hashed
+      read_ahead(fd, base, size, pos + n, offset + pos + n, 2 * step);
+#if defined(MADV_POPULATE_READ)
+      // mapping the step in one go is much cheaper than faulting in each
+      // page. older kernels reject it, then the pages are faulted in.
+      madvise(base + pos, n, MADV_POPULATE_READ);
+#endif
+      hasher.update(std::span{base + pos, n});
+      madvise(base + pos, n, MADV_DONTNEED);
+      if (drop_behind) {
+        drop_cached(fd, offset + pos, n);
+      }
+    }
+  }
+  return hasher.finalize(options.nonce);
+}
+
+/// turns off the page cache for fd until destroyed
+class DirectIo {
+public:
+  explicit DirectIo(int fd) : m_fd(fd) {
+#if defined(O_DIRECT)
+    m_flags = fcntl(fd, F_GETFL);
+    m_enabled = m_flags != -1 && fcntl(fd, F_SETFL, m_flags | O_DIRECT) == 0;
+#elif defined(F_NOCACHE)
+    m_enabled = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
+  }
+  DirectIo& operator=(DirectIo&&) = delete;
+  ~DirectIo() { disable(); }
+
+  bool enabled() const noexcept { return m_enabled; }
+
+  void disable() noexcept {
+    if (m_enabled) {
+#if defined(O_DIRECT)
+      fcntl(m_fd, F_SETFL, m_flags);
+#elif defined(F_NOCACHE)
+      fcntl(m_fd, F_NOCACHE, 0);
+#endif
+      m_enabled = false;
+    }
+  }
+
+private:
+  int m_fd;
+  int m_flags{-1};
+  bool m_enabled{};
+};
+
+/// @return what read() returns, retrying on interruption, or a negative
+/// errno
+long long read_some(int fd, std::span<std::uint8_t> buffer, DirectIo* direct) {
+  for (;;) {
+    const auto ret = read(fd, buffer.data(), buffer.size());
+    if (ret >= 0) {
+      return ret;
+    }
+    if (errno == EINVAL && direct && direct->enabled()) {
+      // the file system does not support direct io after all
+      direct->disable();
+      continue;
+    }
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+/// reads fd to the end into the hasher, which must be reset
+std::uint64_t read_all(LeMac& hasher, int fd, std::span<std::uint8_t> buffer,
+                       DirectIo* direct, const std::string& name) {
+  std::uint64_t total = 0;
+  for (;;) {
+    const auto ret = read_some(fd, buffer, direct);
+    if (ret < 0) {
+      throw_error(static_cast<int>(-ret), "failed reading from " + name);
+    }
+    if (ret == 0) {
+      return total;
+    }
+    hasher.update(buffer.first(static_cast<std::size_t>(ret)));
+    total += static_cast<std::uint64_t>(ret);
+  }
+}
+
+/**
+ * like read_all(), but the reading is done by a separate thread into a ring
+ * of buffers, so a slow producer on the other end of a pipe and the hashing
+ * run at the same time. the buffers are those of the calling thread, which
+ * are kept for the next file.
+ */
+std::uint64_t read_all_threaded(LeMac& hasher, int fd, std::size_t buffer_size,
+                                DirectIo* direct, const std::string& name) {
+  constexpr std::size_t ring_size = 4;
+  buffer_size = aligned_size(buffer_size);
+  const auto all = thread_buffer(buffer_size * ring_size);
+  auto buffer = [&](std::uint64_t k) {
+    return all.subspan((k % ring_size) * buffer_size, buffer_size);
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::array<long long, ring_size> sizes{};
+  // the number of buffers filled and hashed so far
+  std::uint64_t filled = 0;
+  std::uint64_t hashed = 0;
+
+  std::thread reader([&] {
+    for (std::uint64_t k = 0;; ++k) {
+      {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return filled - hashed < ring_size; });
+      }
+      const auto ret = read_some(fd, buffer(k), direct);
+      {
+        std::lock_guard lock(mutex);
+        sizes[k % ring_size] = ret;
+        ++filled;
+      }
+      cv.notify_one();
+      if (ret <= 0) {
+        return;
+      }
+    }
+  });
+
+  std::uint64_t total = 0;
+  long long ret = 0;
+  for (std::uint64_t k = 0;; ++k) {
+    {
+      std::unique_lock lock(mutex);
+      cv.wait(lock, [&] { return filled > k; });
+      ret = sizes[k % ring_size];
+    }
+    if (ret <= 0) {
+      break;
+    }
+    hasher.update(buffer(k).first(static_cast<std::size_t>(ret)));
+    total += static_cast<std::uint64_t>(ret);
+    {
+      std::lock_guard lock(mutex);
+      ++hashed;
+    }
+    cv.notify_one();
+  }
+  reader.join();
+  if (ret < 0) {
+    throw_error(static_cast<int>(-ret), "failed reading from " + name);
+  }
+  return total;
+}
+
+#if LEMAC_HAS_IO_URING
+/// reads through io_uring with several reads in flight, into page aligned
+/// buffers registered with the kernel. each thread keeps its own for the
+/// next file.
+class UringReader {
+public:
+  static constexpr unsigned max_depth = 16;
+
+  /// @return the reader of the calling thread, or null if io_uring can not
+  /// be used
+  static UringReader* get() {
+    thread_local std::unique_ptr<UringReader> reader;
+    thread_local bool unavailable = false;
+    if (!reader && !unavailable) {
+      if (auto ring = detail::IoUring::create(max_depth)) {
+        reader.reset(new UringReader(std::move(ring)));
+      } else {
+        unavailable = true;
+      }
+    }
+    return reader.get();
+  }
+
+  /**
+   * reads fd to the end into the hasher, which must be reset.
+   * @param seekable if the reads can be at explicit offsets, which allows
+   * more than one in flight. otherwise the next read is in flight while the
+   * previous is hashed.
+   * @param size the size of the file, if known. a short read reaching it is
+   * the end, instead of reading the rest of the range. with direct io, that
+   * read would be unaligned and fail.
+   */
+  std::uint64_t read_all(LeMac& hasher, int fd, bool seekable,
+                         std::size_t buffer_size, unsigned depth,
+                         DirectIo* direct, const std::string& name,
+                         std::optional<std::uint64_t> size) {
+    depth = seekable ? std::clamp(depth, 1U, max_depth) : 2;
+    set_up_buffers(buffer_size, depth);
+
+    // the reads in flight must finish before the buffers are reused, also
+    // when leaving with an exception
+    struct drain_guard {
+      UringReader* reader;
+      ~drain_guard() { reader->drain(); }
+    } guard{this};
+
+    const auto start_offset = seekable ? lseek(fd, 0, SEEK_CUR) : off_t{-1};
+    std::uint64_t next_offset = static_cast<std::uint64_t>(start_offset);
+    if (seekable) {
+      for (unsigned k = 0; k < depth; ++k) {
+        issue(fd, k, next_offset, m_slots[k].buffer);
+        next_offset += m_buffer_size;
+      }
+    } else {
+      issue(fd, 0, stream_offset, m_slots[0].buffer);
+    }
+
+    std::uint64_t total = 0;
+    unsigned head = 0;
+    for (;;) {
+      auto& slot = m_slots[head];
+      wait_for(slot);
+      const auto res = slot.result;
+      if (res == -EINTR || res == -EAGAIN) {
+        issue(fd, head, slot.offset, slot.destination);
+        continue;
+      }
+      if (res == -EINVAL && direct && direct->enabled()) {
+        // the file system does not support direct io after all
+        direct->disable();
+        issue(fd, head, slot.offset, slot.destination);
+        continue;
+      }
+      if (res < 0) {
+        throw_error(static_cast<int>(-res), "failed reading from " + name);
+      }
+      if (res == 0) {
+        break;
+      }
+      const auto got = static_cast<std::size_t>(res);
+      const auto data = slot.destination.first(got);
+      total += got;
+      if (!seekable) {
+        // start the next read before hashing this one
+        const unsigned next = head ^ 1U;
+        issue(fd, next, stream_offset, m_slots[next].buffer);
+        hasher.update(data);
+        head = next;
+      } else if (got < slot.destination.size()) {
+        hasher.update(data);
+        if (size && slot.offset + got >= *size) {
+          break;
+        }
+        // a short read, the rest of the range is read into the same slot
+        issue(fd, head, slot.offset + got, slot.destination.subspan(got));
+      } else {
+        hasher.update(data);
+        issue(fd, head, next_offset, slot.buffer);
+        next_offset += m_buffer_size;
+        head = (head + 1) % depth;
+      }
+    }
+    if (seekable) {
+      // leave the file position where read() would have
+      lseek(fd, start_offset + static_cast<off_t>(total), SEEK_SET);
+    }
+    return total;
+  }
+
+private:
+  /// means the file position, for reading from pipes
+  static constexpr std::uint64_t stream_offset = static_cast<std::uint64_t>(-1);
+
+  struct Slot {
+    /// the whole buffer of the slot
+    std::span<std::uint8_t> buffer;
+    /// the part of the buffer the current read is into
+    std::span<std::uint8_t> destination;
+    std::uint64_t offset{};
+    long long result{};
+    bool busy{};
+  };
+
+  explicit UringReader(std::unique_ptr<detail::IoUring> ring)
+      : m_ring(std::move(ring)) {}
+
+  void set_up_buffers(std::size_t buffer_size, unsigned depth) {
+    buffer_size = aligned_size(buffer_size);
+    const auto all = m_storage.get(buffer_size * depth);
+    if (all.data() == m_registered && buffer_size == m_buffer_size &&
+        depth == m_depth) {
+      return;
+    }
+    m_buffer_size = buffer_size;
+    m_depth = depth;
+    std::array<iovec, max_depth> iovecs{};
+    for (unsigned k = 0; k < depth; ++k) {
+      m_slots[k].buffer = all.subspan(k * buffer_size, buffer_size);
+      iovecs[k].iov_base = m_slots[k].buffer.data();
+      iovecs[k].iov_len = buffer_size;
+    }
+    // registering can fail, for instance on the memlock limit of older
+    // kernels. plain reads into the same buffers work anyway.
+    m_fixed = m_ring->register_buffers(iovecs.data(), depth) == 0;
+    m_registered = all.data();
+  }
+
+  void issue(int fd, unsigned k, std::uint64_t offset,
+             std::span<std::uint8_t> destination) {
+    auto& s = m_slots[k];
+    s.offset = offset;
+    s.destination = destination;
+    const auto size = static_cast<unsigned>(destination.size());
+    const bool queued =
+        m_fixed ? m_ring->prepare_read_fixed(fd, destination.data(), size,
+                                             offset, k, k)
+                : m_ring->prepare_read(fd, destination.data(), size, offset, k);
+    if (!queued) {
+      // can not happen, there are never more reads than entries
+      throw_error(EBUSY, "io_uring submission queue is full");
+    }
+    s.busy = true;
+    ++m_in_flight;
+    // submit right away, so the kernel reads while the caller hashes
+    check(m_ring->submit());
+  }
+
+  void wait_for(const Slot& s) {
+    while (s.busy) {
+      check(m_ring->submit(1));
+      collect();
+    }
+  }
+
+  void collect() {
+    m_ring->reap([this](std::uint64_t user_data, int res) {
+      auto& s = m_slots[user_data];
+      s.result = res;
+      s.busy = false;
+      --m_in_flight;
+    });
+  }
+
+  void drain() noexcept {
+    while (m_in_flight > 0) {
+      if (m_ring->submit(1) < 0) {
+        // nothing more can be done, and the buffers must not be reused
+        std::terminate();
+      }
+      collect();
+    }
+  }
+
+  static void check(int ret) {
+    if (ret < 0) {
+      throw_error(-ret, "io_uring_enter failed");
+    }
+  }
+
+  std::unique_ptr<detail::IoUring> m_ring;
+  ReadBuffer m_storage;
+  std::array<Slot, max_depth> m_slots{};
+  const void* m_registered{};
+  std::size_t m_buffer_size{};
+  unsigned m_depth{};
+  bool m_fixed{};
+  unsigned m_in_flight{};
+};
+#endif
+
+file_result hash_fd(LeMac& hasher, int fd, const file_options& options,
+                    const std::string& name) {
+  const auto start = std::chrono::steady_clock::now();
+
+  struct stat statbuf{};
+  if (fstat(fd, &statbuf) != 0) {
+    throw_error(errno, "failed fstat for " + name);
+  }
+  if (S_ISDIR(statbuf.st_mode)) {
+    throw_error(EISDIR, name);
+  }
+
+  file_result result;
+  const bool automatic = options.strategy == io_strategy::automatic;
+  result.strategy = automatic ? pick_strategy(statbuf) : options.strategy;
+  const bool bypass_cache =
+      options.bypass_cache || (automatic && pick_bypass_cache(statbuf));
+
+  if (result.strategy == io_strategy::mmap) {
+    // the file is mapped from the start, which only matches reading it if
+    // the descriptor is there
+    if (!S_ISREG(statbuf.st_mode) || statbuf.st_size <= 0 ||
+        lseek(fd, 0, SEEK_CUR) != 0) {
+      result.strategy = io_strategy::read;
+    } else {
+      const auto length = static_cast<std::uint64_t>(statbuf.st_size);
+      if (const auto hash = hash_mapped(hasher, fd, length, options,
+                                        bypass_cache, name)) {
+        result.hash = *hash;
+        result.bypassed_cache = bypass_cache && can_drop_cached;
+        result.bytes = length;
+        result.seconds = seconds_since(start);
+        return result;
+      }
+      result.strategy = io_strategy::read;
+    }
+  }
+
+  if (result.strategy == io_strategy::read && !bypass_cache &&
+      S_ISREG(statbuf.st_mode) &&
+      static_cast<std::uint64_t>(statbuf.st_size) < mmap_threshold) {
+    // a single read, with room for a byte more which is only filled if the
+    // file grew. that also saves the read which would find the end.
+    const auto size = static_cast<std::size_t>(statbuf.st_size);
+    const auto buffer = thread_buffer(size + 1);
+    const auto ret = read_some(fd, buffer.first(size + 1), nullptr);
+    if (ret < 0) {
+      throw_error(static_cast<int>(-ret), "failed reading from " + name);
+    }
+    const auto got = static_cast<std::size_t>(ret);
+    if (got == size) {
+      result.hash = hasher.oneshot(buffer.first(size), options.nonce);
+      result.bytes = size;
+    } else {
+      // the size changed, read the rest as usual
+      hasher.reset();
+      hasher.update(buffer.first(got));
+      result.bytes = got + read_all(hasher, fd, buffer, nullptr, name);
+      result.hash = hasher.finalize(options.nonce);
+    }
+    result.seconds = seconds_since(start);
+    return result;
+  }
+
+  hasher.reset();
+  std::optional<DirectIo> direct;
+  if (bypass_cache) {
+    direct.emplace(fd);
+  }
+  DirectIo* const direct_io = direct && direct->enabled() ? &*direct : nullptr;
+
+#if LEMAC_HAS_IO_URING
+  UringReader* const reader =
+      result.strategy == io_strategy::uring ? UringReader::get() : nullptr;
+  if (reader) {
+    const bool seekable =
+        (S_ISREG(statbuf.st_mode) || S_ISBLK(statbuf.st_mode)) &&
+        lseek(fd, 0, SEEK_CUR) >= 0;
+    std::optional<std::uint64_t> size;
+    if (S_ISREG(statbuf.st_mode)) {
+      size = static_cast<std::uint64_t>(statbuf.st_size);
+    }
+    result.bytes =
+        reader->read_all(hasher, fd, seekable, options.buffer_size,
+                         options.uring_depth, direct_io, name, size);
+  } else
+#endif
+  if (result.strategy == io_strategy::reader_thread) {
+    result.bytes = read_all_threaded(hasher, fd, options.buffer_size,
+                                     direct_io, name);
+  } else {
+    result.strategy = io_strategy::read;
+    result.bytes = read_all(hasher, fd, thread_buffer(options.buffer_size),
+                            direct_io, name);
+  }
+  result.bypassed_cache = direct_io && direct_io->enabled();
+  result.hash = hasher.finalize(options.nonce);
+  result.seconds = seconds_since(start);
+  return result;
+}
+
+int open_flags(const file_options& options) {
+  return O_RDONLY | O_CLOEXEC | (options.follow_symlinks ? 0 : O_NOFOLLOW);
+}
+
+/// @return the last component of path, which is opened relative to the
+/// directory it is in
+const char* file_name(const std::filesystem::path& path) {
+  const auto& native = path.native();
+  const auto slash = native.rfind('/');
+  return native.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+/**
+ * like hash_file(hasher, path, options). if dirfd is a directory, it is the
+ * one path is in and only the file name is opened, relative to it.
+ */
+file_result hash_file_at(LeMac& hasher, int dirfd,
+                         const std::filesystem::path& path,
+                         const file_options& options) {
+  const auto start = std::chrono::steady_clock::now();
+  const auto fd = fdcloser{dirfd >= 0
+                               ? openat(dirfd, file_name(path),
+                                        open_flags(options))
+                               : open(path.c_str(), open_flags(options))};
+  if (fd.m_fd == -1) {
+    throw_error(errno, "failed opening file " + path.string());
+  }
+  auto result = hash_fd(hasher, fd.m_fd, options, path.string());
+  result.seconds = seconds_since(start);
+  return result;
+}
+
+#if LEMAC_HAS_URING_BATCH
+/**
+ * opens, stats, reads and closes files through io_uring a batch at a time, so
+ * a run over many small files makes a few system calls per batch instead of
+ * five per file. each thread has its own.
+ */
+class UringBatch {
+public:
+  static constexpr std::size_t max_batch = 64;
+
+  /// @return the batch of the calling thread, or null if io_uring is not
+  /// available
+  static UringBatch* get() {
+    thread_local std::unique_ptr<UringBatch> batch;
+    thread_local bool unavailable = false;
+    if (!batch && !unavailable) {
+      if (auto ring = detail::IoUring::create(2 * max_batch)) {
+        batch.reset(new UringBatch(std::move(ring)));
+      } else {
+        unavailable = true;
+      }
+    }
+    return batch && batch->m_ring ? batch.get() : nullptr;
+  }
+
+  /**
+   * hashes at most max_batch files into the outcomes. if io_uring fails, the
+   * files the batch knows to be open are closed, the error is thrown and the
+   * batch is not available after that.
+   * @param dirfd as for hash_file_at()
+   */
+  void hash(LeMac& hasher, int dirfd,
+            std::span<const std::filesystem::path> paths,
+            const file_options& options, std::span<file_outcome> outcomes) {
+    try {
+      hash_batch(hasher, dirfd, paths, options, outcomes);
+    } catch (...) {
+      abandon(paths.size());
+      throw;
+    }
+  }
+
+private:
+  explicit UringBatch(std::unique_ptr<detail::IoUring> ring)
+      : m_ring(std::move(ring)) {}
+
+  /// what a request is for, in the high bits of its user data
+  enum class op : std::uint64_t { open, stat, read, close };
+
+  static std::uint64_t user_data(op o, std::size_t i) {
+    return static_cast<std::uint64_t>(o) << 32 | i;
+  }
+
+  struct File {
+    static constexpr std::size_t unread = SIZE_MAX;
+
+    int fd{-1};
+    int stat_result{-1};
+    long long read_result{-1};
+    /// where in the storage the file is read to, if it is
+    std::size_t offset{unread};
+    /// the position of the close among those queued, if it is
+    std::size_t close_order{unread};
+    bool closed{};
+    struct statx stat{};
+  };
+
+  void hash_batch(LeMac& hasher, int dirfd,
+                  std::span<const std::filesystem::path> paths,
+                  const file_options& options,
+                  std::span<file_outcome> outcomes) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto n = paths.size();
+    m_closes = 0;
+    std::fill_n(m_files.begin(), n, File{});
+
+    const int stat_flags = options.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+    for (std::size_t i = 0; i < n; ++i) {
+      const char* const path =
+          dirfd >= 0 ? file_name(paths[i]) : paths[i].c_str();
+      const int at = dirfd >= 0 ? dirfd : AT_FDCWD;
+      while (!m_ring->prepare_openat(at, path, open_flags(options),
+                                     user_data(op::open, i))) {
+        check(m_ring->submit());
+      }
+      while (!m_ring->prepare_statx(at, path, stat_flags,
+                                    STATX_TYPE | STATX_SIZE, &m_files[i].stat,
+                                    user_data(op::stat, i))) {
+        check(m_ring->submit());
+      }
+    }
+    run(2 * n);
+
+    // small regular files are read whole, with room for a byte more which is
+    // only filled if the file grew
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      auto& file = m_files[i];
+      if (file.fd >= 0 && file.stat_result == 0 && !options.bypass_cache &&
+          S_ISREG(file.stat.stx_mode) && file.stat.stx_size < mmap_threshold) {
+        file.offset = total;
+        total += (file.stat.stx_size + 1 + 63) / 64 * 64;
+      }
+    }
+    const auto storage = m_storage.get(total);
+    std::size_t reads = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      const auto& file = m_files[i];
+      if (file.offset != File::unread) {
+        while (!m_ring->prepare_read(
+            file.fd, storage.data() + file.offset,
+            static_cast<unsigned>(file.stat.stx_size + 1), 0,
+            user_data(op::read, i))) {
+          check(m_ring->submit());
+        }
+        ++reads;
+      }
+    }
+    run(reads);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      const auto& file = m_files[i];
+      auto& outcome = outcomes[i];
+      if (file.fd < 0) {
+        continue;
+      }
+      try {
+        if (file.offset != File::unread &&
+            file.read_result == static_cast<long long>(file.stat.stx_size)) {
+          const auto size = static_cast<std::size_t>(file.stat.stx_size);
+          outcome.result.hash = hasher.oneshot(
+              storage.subspan(file.offset, size), options.nonce);
+          outcome.result.strategy = io_strategy::read;
+          outcome.result.bytes = size;
+          outcome.result.seconds = seconds_since(start);
+        } else {
+          // the reads were at an offset, so the file position is at the start
+          outcome.result = hash_fd(hasher, file.fd, options, paths[i].string());
+        }
+      } catch (...) {
+        outcome.error = std::current_exception();
+      }
+    }
+
+    // the queue is empty here, so the closes are queued and submitted in
+    // order, which abandon() relies on
+    for (std::size_t i = 0; i < n; ++i) {
+      if (m_files[i].fd >= 0) {
+        while (!m_ring->prepare_close(m_files[i].fd, user_data(op::close, i))) {
+          check(m_ring->submit());
+        }
+        m_files[i].close_order = m_closes++;
+      }
+    }
+    run(m_closes);
+
+    // the files which could not be opened are tried again, now that the
+    // batch is closed in case it was out of file descriptors. otherwise this
+    // gives the error hash_file() gives.
+    for (std::size_t i = 0; i < n; ++i) {
+      if (m_files[i].fd < 0) {
+        try {
+          outcomes[i].result = hash_file_at(hasher, dirfd, paths[i], options);
+        } catch (...) {
+          outcomes[i].error = std::current_exception();
+        }
+      }
+    }
+  }
+
+  /**
+   * closes the files of a failed batch which are open and not going to be
+   * closed by the kernel. the completions already there are taken first, as
+   * they may be of files opened or closed meanwhile. a file whose open is
+   * still in flight can not be known, and is left open.
+   */
+  void abandon(std::size_t n) noexcept {
+    if (m_ring) {
+      m_ring->reap([this](std::uint64_t u, int res) { complete(u, res); });
+    }
+    // the closes queued last are the ones not handed to the kernel
+    const auto unsubmitted = m_ring ? m_ring->queued() : 0U;
+    for (std::size_t i = 0; i < n; ++i) {
+      const auto& file = m_files[i];
+      if (file.fd < 0 || file.closed) {
+        continue;
+      }
+      if (file.close_order == File::unread ||
+          file.close_order + unsubmitted >= m_closes) {
+        ::close(file.fd);
+      }
+    }
+    // requests may still be in flight, writing into the members. the ring
+    // is not used again, so their completions are not mistaken for later
+    // ones.
+    m_ring.reset();
+  }
+
+  void complete(std::uint64_t data, int res) {
+    auto& file = m_files[data & 0xffffffff];
+    switch (static_cast<op>(data >> 32)) {
+    case op::open:
+      file.fd = res;
+      break;
+    case op::stat:
+      file.stat_result = res;
+      break;
+    case op::read:
+      file.read_result = res;
+      break;
+    case op::close:
+      file.closed = true;
+      break;
+    }
+  }
+
+  /// submits what is queued and waits for count completions
+  void run(std::size_t count) {
+    while (count > 0) {
+      check(m_ring->submit(1));
+      count -= m_ring->reap(
+          [this](std::uint64_t u, int res) { complete(u, res); });
+    }
+  }
+
+  void check(int ret) {
+    if (ret < 0) {
+      throw_error(-ret, "io_uring_enter failed");
+    }
+  }
+
+  std::unique_ptr<detail::IoUring> m_ring;
+  ReadBuffer m_storage;
+  std::array<File, max_batch> m_files{};
+  /// the closes queued in the current batch
+  std::size_t m_closes{};
+};
+#endif
+#else
+template <typename Source>
+file_result hash_stream(LeMac& hasher, Source&& read_some,
+                        const file_options& options, const std::string& name,
+                        std::chrono::steady_clock::time_point start) {
+  file_result result;
+  result.strategy = io_strategy::read;
+  hasher.reset();
+  const auto buffer = thread_buffer(options.buffer_size);
+  for (;;) {
+    const auto ret = read_some(buffer);
+    if (ret < 0) {
+      throw_error(errno, "failed reading from " + name);
+    }
+    if (ret == 0) {
+      break;
+    }
+    hasher.update(buffer.first(static_cast<std::size_t>(ret)));
+    result.bytes += static_cast<std::uint64_t>(ret);
+  }
+  result.hash = hasher.finalize(options.nonce);
+  result.seconds = seconds_since(start);
+  return result;
+}
+
+/// there are no directory descriptors here, so the whole path is opened
+file_result hash_file_at(LeMac& hasher, int /*dirfd*/,
+                         const std::filesystem::path& path,
+                         const file_options& options) {
+  return hash_file(hasher, path, options);
+}
+#endif
+
+/// hash_files(), with dirfd as for hash_file_at()
+std::vector<file_outcome>
+hash_files_at(LeMac& hasher, int dirfd,
+              std::span<const std::filesystem::path> paths,
+              const file_options& options) {
+  std::vector<file_outcome> outcomes(paths.size());
+  std::size_t done = 0;
+#if LEMAC_HAS_URING_BATCH
+  if (options.strategy == io_strategy::automatic ||
+      options.strategy == io_strategy::uring) {
+    while (done < paths.size()) {
+      auto* const batch = UringBatch::get();
+      if (!batch) {
+        break;
+      }
+      const auto n = std::min(UringBatch::max_batch, paths.size() - done);
+      try {
+        batch->hash(hasher, dirfd, paths.subspan(done, n), options,
+                    std::span{outcomes}.subspan(done, n));
+      } catch (...) {
+        // io_uring failed, and the batch closed its files. this and the
+        // batches after it are hashed one file at a time instead.
+        break;
+      }
+      done += n;
+    }
+  }
+#endif
+  for (std::size_t i = done; i < paths.size(); ++i) {
+    outcomes[i] = file_outcome{};
+    try {
+      outcomes[i].result = hash_file_at(hasher, dirfd, paths[i], options);
+    } catch (...) {
+      outcomes[i].error = std::current_exception();
+    }
+  }
+  return outcomes;
+}
+} // namespace
+
+std::string_view to_string(const io_strategy strategy) {
+  switch (strategy) {
+  case io_strategy::automatic:
+    return "automatic";
+  case io_strategy::mmap:
+    return "mmap";
+  case io_strategy::read:
+    return "read";
+  case io_strategy::uring:
+    return "uring";
+  case io_strategy::reader_thread:
+    return "reader_thread";
+  }
+  return "unknown";
+}
+
+#if !defined(_WIN32)
+file_result hash_file(LeMac& hasher, const std::filesystem::path& path,
+                      const file_options& options) {
+  return hash_file_at(hasher, -1, path, options);
+}
+
+file_result hash_file(LeMac& hasher, const int fd,
+                      const file_options& options) {
+  return hash_fd(hasher, fd, options, "file descriptor " + std::to_string(fd));
+}
+#else
+file_result hash_file(LeMac& hasher, const std::filesystem::path& path,
+                      const file_options& options) {
+  const auto start = std::chrono::steady_clock::now();
+  if (std::filesystem::is_directory(path)) {
+    throw_error(EISDIR, path.string());
+  }
+  std::ifstream ifs(path, std::ios_base::in | std::ios_base::binary);
+  if (!ifs) {
+    throw_error(ENOENT, "failed opening file " + path.string());
+  }
+  return hash_stream(
+      hasher,
+      [&](std::span<std::uint8_t> buffer) -> long long {
+        ifs.read(reinterpret_cast<char*>(buffer.data()),
+                 static_cast<std::streamsize>(buffer.size()));
+        if (ifs.bad()) {
+          errno = EIO;
+          return -1;
+        }
+        return ifs.gcount();
+      },
+      options, path.string(), start);
+}
+
+file_result hash_file(LeMac& hasher, const int fd,
+                      const file_options& options) {
+  const auto start = std::chrono::steady_clock::now();
+  return hash_stream(
+      hasher,
+      [&](std::span<std::uint8_t> buffer) -> long long {
+        const auto chunk = static_cast<unsigned>(
+            std::min<std::size_t>(buffer.size(), 1U << 30));
+        return _read(fd, buffer.data(), chunk);
+      },
+      options, "file descriptor " + std::to_string(fd), start);
+}
+#endif
+
+std::vector<file_outcome>
+hash_files(LeMac& hasher, std::span<const std::filesystem::path> paths,
+           const file_options& options) {
+  return hash_files_at(hasher, -1, paths, options);
+}
+
+#if !defined(_WIN32)
+std::vector<file_outcome>
+hash_files(LeMac& hasher, int dirfd,
+           std::span<const std::filesystem::path> paths,
+           const file_options& options) {
+  return hash_files_at(hasher, dirfd, paths, options);
+}
+#endif
+
+} // namespace lemac::inline v1
@@ -0,0 +1,135 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept> // std::runtime_error
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "lemac_parallel.h"
+
+namespace lemac::inline v1 {
+
+namespace {
+/// the cost of hashing a message on top of its size, expressed in bytes. this
+/// is mostly the finalization, which takes about as long as hashing this many
+/// bytes.
+constexpr std::size_t per_message_cost = 1024;
+
+/// the least amount of work (including per_message_cost) worth starting a
+/// thread for
+constexpr std::size_t min_work_per_thread = 1024 * 1024;
+
+/// the work is split in this many pieces per thread. more pieces evens out
+/// the load better, at the cost of more contention on the shared counter.
+constexpr std::size_t pieces_per_thread = 16;
+
+constexpr std::size_t cache_line_size = 64;
+
+/// decides where a piece of the outputs may begin, so that no two pieces
+/// share a cache line
+class PieceBoundary {
+public:
+  explicit PieceBoundary(std::span<const tag> outputs) {
+    const auto address = reinterpret_cast<std::uintptr_t>(outputs.data());
+    if (address % sizeof(tag) == 0) {
+      m_first = (cache_line_size - address % cache_line_size) %
+                cache_line_size / sizeof(tag);
+      m_step = cache_line_size / sizeof(tag);
+    }
+  }
+
+  /// @return true if a piece may start at the given index
+  bool allowed(const std::size_t index) const noexcept {
+    return index >= m_first && (index - m_first) % m_step == 0;
+  }
+
+private:
+  // if outputs is not aligned to a multiple of the tag size, cache lines
+  // will be shared whatever is done so let the pieces start anywhere
+  std::size_t m_first{};
+  std::size_t m_step{1};
+};
+} // namespace
+
+void parallel_oneshot(const LeMac& proto,
+                      std::span<const std::span<const std::uint8_t>> inputs,
+                      std::span<tag> outputs, unsigned threads) {
+  if (outputs.size() != inputs.size()) {
+    throw std::runtime_error("outputs and inputs must have the same size");
+  }
+
+  std::size_t total_cost = 0;
+  for (const auto& input : inputs) {
+    total_cost += input.size() + per_message_cost;
+  }
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<unsigned>(std::min<std::size_t>(
+      threads, std::max<std::size_t>(1, total_cost / min_work_per_thread)));
+
+  if (threads == 1) {
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+      outputs[i] = proto.oneshot(inputs[i]);
+    }
+    return;
+  }
+
+  // split the messages into pieces of about the same cost
+  const auto piece_cost = total_cost / (threads * pieces_per_thread) + 1;
+  const PieceBoundary boundary(outputs);
+  std::vector<std::size_t> piece_begin{0};
+  std::size_t cost = 0;
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    cost += inputs[i].size() + per_message_cost;
+    if (cost >= piece_cost && boundary.allowed(i + 1)) {
+      piece_begin.push_back(i + 1);
+      cost = 0;
+    }
+  }
+  if (piece_begin.back() != inputs.size()) {
+    piece_begin.push_back(inputs.size());
+  }
+  const auto npieces = piece_begin.size() - 1;
+
+  // each thread grabs the next piece until there are none left. proto is
+  // shared, oneshot() is const and thread safe.
+  std::atomic<std::size_t> next_piece{0};
+  auto work = [&]() noexcept {
+    for (;;) {
+      const auto piece = next_piece.fetch_add(1, std::memory_order_relaxed);
+      if (piece >= npieces) {
+        return;
+      }
+      for (auto i = piece_begin[piece]; i != piece_begin[piece + 1]; ++i) {
+        outputs[i] = proto.oneshot(inputs[i]);
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+  for (unsigned i = 1; i < threads; ++i) {
+    try {
+      workers.emplace_back(work);
+    } catch (const std::system_error&) {
+      // make do with the threads started so far
+      break;
+    }
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+} // namespace lemac::inline v1
@@ -0,0 +1,159 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "lemac_pool.h"
+
+namespace lemac::inline v1 {
+
+namespace {
+constexpr std::size_t cache_line_size = 64;
+
+/// where each thread starts looking for a free hasher, so threads do not all
+/// compete for the first ones
+std::size_t start_index() noexcept {
+  static std::atomic<std::size_t> next{0};
+  thread_local const std::size_t index =
+      next.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+/// hands out memory on whole cache lines, from a few large blocks. the
+/// memory is only given back when the arena is destroyed.
+class CacheLineArena final : public std::pmr::memory_resource {
+public:
+  explicit CacheLineArena(std::size_t initial_size)
+      : m_upstream(initial_size) {}
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    const auto rounded =
+        (bytes + cache_line_size - 1) / cache_line_size * cache_line_size;
+    return m_upstream.allocate(rounded, std::max(alignment, cache_line_size));
+  }
+
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::monotonic_buffer_resource m_upstream;
+};
+
+/// roughly what a hasher takes, to size the first block of the arena
+constexpr std::size_t hasher_size_estimate = 1152;
+#endif
+} // namespace
+
+struct alignas(cache_line_size) HasherPool::Slot {
+  std::atomic<bool> busy{};
+  std::optional<LeMac> hasher;
+};
+
+struct HasherPool::State {
+  State(std::span<const std::uint8_t> key, std::size_t size)
+      : prototype(key),
+#if LEMAC_HAS_MEMORY_RESOURCE
+        arena(std::max<std::size_t>(1, size) * hasher_size_estimate),
+#endif
+        slots(std::make_unique<Slot[]>(size)), nslots(size) {
+    // copying the prototype is much cheaper than setting up the key again
+    for (std::size_t i = 0; i < nslots; ++i) {
+#if LEMAC_HAS_MEMORY_RESOURCE
+      slots[i].hasher.emplace(prototype, &arena);
+#else
+      slots[i].hasher.emplace(prototype);
+#endif
+    }
+  }
+
+  /// extra hashers are copied from this
+  LeMac prototype;
+#if LEMAC_HAS_MEMORY_RESOURCE
+  /// must outlive the hashers in the slots
+  CacheLineArena arena;
+#endif
+  std::unique_ptr<Slot[]> slots;
+  std::size_t nslots;
+};
+
+HasherPool::HasherPool(std::span<const std::uint8_t> key,
+                       const std::size_t size)
+    : m_state(std::make_unique<State>(key, size)) {}
+
+HasherPool::~HasherPool() = default;
+
+HasherPool::handle HasherPool::acquire() {
+  const auto n = m_state->nslots;
+  const auto start = n == 0 ? 0 : start_index() % n;
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& slot = m_state->slots[(start + i) % n];
+    if (!slot.busy.load(std::memory_order_relaxed) &&
+        !slot.busy.exchange(true, std::memory_order_acquire)) {
+      return handle(&slot);
+    }
+  }
+  return handle(m_state->prototype);
+}
+
+std::size_t HasherPool::size() const noexcept { return m_state->nslots; }
+
+std::size_t HasherPool::available() const noexcept {
+  std::size_t ret = 0;
+  for (std::size_t i = 0; i < m_state->nslots; ++i) {
+    if (!m_state->slots[i].busy.load(std::memory_order_relaxed)) {
+      ++ret;
+    }
+  }
+  return ret;
+}
+
+HasherPool::handle::handle(Slot* slot) noexcept
+    : m_slot(slot), m_hasher(&*slot->hasher) {}
+
+HasherPool::handle::handle(const LeMac& prototype)
+    : m_extra(prototype), m_hasher(&*m_extra) {}
+
+HasherPool::handle::handle(handle&& other) noexcept
+    : m_slot(std::exchange(other.m_slot, nullptr)),
+      m_extra(std::move(other.m_extra)) {
+  m_hasher = m_slot ? other.m_hasher : (m_extra ? &*m_extra : nullptr);
+  other.m_extra.reset();
+  other.m_hasher = nullptr;
+}
+
+HasherPool::handle&
+HasherPool::handle::operator=(handle&& other) noexcept {
+  if (this != &other) {
+    release();
+    m_slot = std::exchange(other.m_slot, nullptr);
+    m_extra = std::move(other.m_extra);
+    m_hasher = m_slot ? other.m_hasher : (m_extra ? &*m_extra : nullptr);
+    other.m_extra.reset();
+    other.m_hasher = nullptr;
+  }
+  return *this;
+}
+
+HasherPool::handle::~handle() { release(); }
+
+void HasherPool::handle::release() noexcept {
+  if (m_slot) {
+    m_slot->hasher->reset();
+    m_slot->busy.store(false, std::memory_order_release);
+    m_slot = nullptr;
+  }
+  m_extra.reset();
+  m_hasher = nullptr;
+}
+
+} // namespace lemac::inline v1
@@ -0,0 +1,376 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept> // std::runtime_error
+#include <thread>
+#include <vector>
+
+#include "impl_interface.h"
+#include "lemac_batch.h"
+#include "lemac_service.h"
+
+namespace lemac::inline v1 {
+
+namespace {
+constexpr std::size_t cache_line_size = 64;
+
+/// the requests preallocated per worker. requests in flight beyond this are
+/// allocated from the heap.
+constexpr std::uint32_t pooled_requests = 256;
+
+/// the head of a free list packs a counter, bumped on every change to avoid
+/// the aba problem, with one plus the index of the first free request (zero
+/// if there is none)
+constexpr std::uint64_t make_head(const std::uint64_t counter,
+                                  const std::uint32_t index) {
+  return counter << 32 | index;
+}
+
+constexpr std::uint32_t head_index(const std::uint64_t head) {
+  return static_cast<std::uint32_t>(head);
+}
+
+/// raises a counter which only one thread writes to
+void raise(std::atomic<std::size_t>& counter, const std::size_t value) {
+  if (value > counter.load(std::memory_order_relaxed)) {
+    counter.store(value, std::memory_order_relaxed);
+  }
+}
+} // namespace
+
+struct HashService::Request {
+  std::span<const std::uint8_t> message;
+  std::array<std::uint8_t, 16> nonce;
+  completion done;
+  /// set instead of done, if the caller asked for a future
+  std::optional<std::promise<tag>> promise;
+  /// the request submitted before this one, while in the queue
+  Request* next{};
+  /// the next request in the free list, like head_index()
+  std::atomic<std::uint32_t> next_free{};
+  /// false if allocated from the heap, true if it belongs to the pool of a
+  /// worker
+  bool pooled{};
+};
+
+struct alignas(cache_line_size) HashService::Worker {
+  /// the queue is a lock free stack which producers push to. the worker
+  /// takes all of it at once and reverses it to get the submission order.
+  std::atomic<Request*> head{};
+  std::atomic<std::uint64_t> submitted{};
+  /// free requests of pool, see make_head(). popped by the producers and
+  /// pushed by the worker.
+  std::atomic<std::uint64_t> free_head{};
+
+  std::unique_ptr<Request[]> pool;
+
+  /// pushed by the destructor, after everything else
+  Request stop;
+
+  // the counters below are only written to by the worker thread
+  alignas(cache_line_size) std::atomic<std::uint64_t> taken{};
+  std::atomic<std::uint64_t> completed{};
+  std::atomic<std::uint64_t> batches{};
+  std::atomic<std::size_t> max_batch_size{};
+  std::atomic<std::size_t> max_queue_depth{};
+
+  std::thread thread;
+};
+
+namespace {
+/// requests taken from the queue of a worker, in submission order
+template <typename Request> class RequestList {
+public:
+  /// moves everything in the queue to the end of the list
+  /// @return false if the stop request was found
+  bool take(std::atomic<Request*>& head, const Request* stop) noexcept {
+    Request* stack = head.exchange(nullptr, std::memory_order_acquire);
+    bool keep_going = true;
+    if (stack == stop) {
+      // nothing can be pushed after the stop request, so it is on top
+      keep_going = false;
+      stack = stack->next;
+    }
+    Request* const last = stack;
+    Request* reversed = nullptr;
+    while (stack) {
+      Request* const next = stack->next;
+      stack->next = reversed;
+      reversed = stack;
+      stack = next;
+      ++m_size;
+    }
+    if (reversed) {
+      *m_tail = reversed;
+      m_tail = &last->next;
+    }
+    return keep_going;
+  }
+
+  /// removes and returns the first request
+  Request* pop() noexcept {
+    Request* const ret = m_first;
+    m_first = ret->next;
+    if (--m_size == 0) {
+      m_tail = &m_first;
+    }
+    return ret;
+  }
+
+  std::size_t size() const noexcept { return m_size; }
+
+private:
+  Request* m_first{};
+  Request** m_tail{&m_first};
+  std::size_t m_size{};
+};
+} // namespace
+
+HashService::HashService(const LeMac& hasher) : HashService(hasher, {}) {}
+
+HashService::HashService(const LeMac& hasher, const options& opts)
+    : m_hasher(hasher), m_options(opts) {
+  if (m_options.max_batch == 0) {
+    throw std::runtime_error("max_batch must be positive");
+  }
+  if (m_options.workers == 0) {
+    m_options.workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  m_workers = std::make_unique<Worker[]>(m_options.workers);
+  for (unsigned i = 0; i < m_options.workers; ++i) {
+    auto& worker = m_workers[i];
+    worker.pool = std::make_unique<Request[]>(pooled_requests);
+    for (std::uint32_t j = 0; j < pooled_requests; ++j) {
+      worker.pool[j].pooled = true;
+      worker.pool[j].next_free.store(j + 1 < pooled_requests ? j + 2 : 0,
+                                     std::memory_order_relaxed);
+    }
+    worker.free_head.store(make_head(0, 1), std::memory_order_relaxed);
+  }
+  try {
+    for (; m_nworkers < m_options.workers; ++m_nworkers) {
+      auto& worker = m_workers[m_nworkers];
+      worker.thread = std::thread([this, &worker] { run(worker); });
+    }
+  } catch (...) {
+    stop_workers();
+    throw;
+  }
+}
+
+HashService::~HashService() { stop_workers(); }
+
+void HashService::stop_workers() noexcept {
+  for (std::size_t i = 0; i < m_nworkers; ++i) {
+    auto& worker = m_workers[i];
+    Request* old = worker.head.load(std::memory_order_relaxed);
+    do {
+      worker.stop.next = old;
+    } while (!worker.head.compare_exchange_weak(
+        old, &worker.stop, std::memory_order_release,
+        std::memory_order_relaxed));
+    worker.head.notify_one();
+  }
+  for (std::size_t i = 0; i < m_nworkers; ++i) {
+    m_workers[i].thread.join();
+  }
+}
+
+void HashService::submit(std::span<const std::uint8_t> message,
+                         std::span<const std::uint8_t> nonce,
+                         completion done) {
+  if (nonce.size() != 16) {
+    throw std::runtime_error("wrong size of nonce");
+  }
+  auto& worker = pick_worker();
+  Request* const request = acquire(worker);
+  request->message = message;
+  std::memcpy(request->nonce.data(), nonce.data(), request->nonce.size());
+  request->done = std::move(done);
+  push(worker, request);
+}
+
+void HashService::submit(std::span<const std::uint8_t> message,
+                         completion done) {
+  static constexpr std::array<const std::uint8_t, 16> zeros{};
+  submit(message, zeros, std::move(done));
+}
+
+std::future<tag> HashService::submit(std::span<const std::uint8_t> message,
+                                     std::span<const std::uint8_t> nonce) {
+  if (nonce.size() != 16) {
+    throw std::runtime_error("wrong size of nonce");
+  }
+  std::promise<tag> promise;
+  auto ret = promise.get_future();
+  auto& worker = pick_worker();
+  Request* const request = acquire(worker);
+  request->message = message;
+  std::memcpy(request->nonce.data(), nonce.data(), request->nonce.size());
+  request->promise.emplace(std::move(promise));
+  push(worker, request);
+  return ret;
+}
+
+std::future<tag> HashService::submit(std::span<const std::uint8_t> message) {
+  static constexpr std::array<const std::uint8_t, 16> zeros{};
+  return submit(message, zeros);
+}
+
+HashService::Worker& HashService::pick_worker() noexcept {
+  // each submitting thread sticks to one worker, spreading the threads
+  // evenly without sharing anything between them
+  static std::atomic<std::size_t> next_slot{0};
+  thread_local const std::size_t slot =
+      next_slot.fetch_add(1, std::memory_order_relaxed);
+  return m_workers[slot % m_nworkers];
+}
+
+HashService::Request* HashService::acquire(Worker& worker) {
+  auto head = worker.free_head.load(std::memory_order_acquire);
+  while (head_index(head) != 0) {
+    Request* const request = &worker.pool[head_index(head) - 1];
+    const auto next = request->next_free.load(std::memory_order_relaxed);
+    if (worker.free_head.compare_exchange_weak(
+            head, make_head((head >> 32) + 1, next),
+            std::memory_order_acquire, std::memory_order_acquire)) {
+      return request;
+    }
+  }
+  return new Request;
+}
+
+void HashService::release(Worker& worker, Request* request) noexcept {
+  if (!request->pooled) {
+    delete request;
+    return;
+  }
+  request->done = nullptr;
+  request->promise.reset();
+  const auto index =
+      static_cast<std::uint32_t>(request - worker.pool.get()) + 1;
+  auto head = worker.free_head.load(std::memory_order_relaxed);
+  do {
+    request->next_free.store(head_index(head), std::memory_order_relaxed);
+  } while (!worker.free_head.compare_exchange_weak(
+      head, make_head((head >> 32) + 1, index), std::memory_order_release,
+      std::memory_order_relaxed));
+}
+
+void HashService::push(Worker& worker, Request* const node) noexcept {
+  Request* old = worker.head.load(std::memory_order_relaxed);
+  do {
+    node->next = old;
+  } while (!worker.head.compare_exchange_weak(
+      old, node, std::memory_order_release, std::memory_order_relaxed));
+  worker.submitted.fetch_add(1, std::memory_order_relaxed);
+  if (old == nullptr) {
+    // the worker may be waiting for the queue to become non-empty
+    worker.head.notify_one();
+  }
+}
+
+void HashService::run(Worker& worker) noexcept {
+  const auto& impl = detail::Access::impl(m_hasher);
+  const auto max_batch = m_options.max_batch;
+
+  RequestList<Request> queued;
+  bool keep_going = true;
+  std::vector<Request*> batch;
+  std::vector<std::span<const std::uint8_t>> messages;
+  std::vector<std::span<const std::uint8_t>> nonces;
+  std::vector<tag> hashes;
+
+  auto take = [&] {
+    const auto before = queued.size();
+    keep_going = queued.take(worker.head, &worker.stop) && keep_going;
+    worker.taken.fetch_add(queued.size() - before, std::memory_order_relaxed);
+    raise(worker.max_queue_depth, queued.size());
+  };
+
+  for (;;) {
+    if (queued.size() == 0) {
+      if (!keep_going) {
+        return;
+      }
+      worker.head.wait(nullptr, std::memory_order_acquire);
+    }
+    take();
+    if (queued.size() < max_batch && keep_going &&
+        m_options.max_delay.count() > 0) {
+      const auto deadline =
+          std::chrono::steady_clock::now() + m_options.max_delay;
+      while (queued.size() < max_batch && keep_going &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+        take();
+      }
+    }
+    if (queued.size() == 0) {
+      continue;
+    }
+
+    const auto n = std::min(queued.size(), max_batch);
+    batch.clear();
+    messages.clear();
+    nonces.clear();
+    for (std::size_t i = 0; i < n; ++i) {
+      auto* const request = queued.pop();
+      batch.push_back(request);
+      messages.push_back(request->message);
+      nonces.push_back(request->nonce);
+    }
+    hashes.resize(n);
+    detail::oneshot_batch(impl, messages, nonces, hashes);
+
+    // count before completing, so a caller who has been notified sees it
+    worker.completed.fetch_add(n, std::memory_order_relaxed);
+    worker.batches.fetch_add(1, std::memory_order_relaxed);
+    raise(worker.max_batch_size, n);
+    for (std::size_t i = 0; i < n; ++i) {
+      Request* const request = batch[i];
+      if (request->promise) {
+        request->promise->set_value(hashes[i]);
+      } else {
+        request->done(hashes[i]);
+      }
+      release(worker, request);
+    }
+  }
+}
+
+HashService::statistics HashService::get_statistics() const noexcept {
+  statistics ret;
+  for (std::size_t i = 0; i < m_nworkers; ++i) {
+    const auto& worker = m_workers[i];
+    const auto submitted = worker.submitted.load(std::memory_order_relaxed);
+    const auto taken = worker.taken.load(std::memory_order_relaxed);
+    ret.submitted += submitted;
+    ret.completed += worker.completed.load(std::memory_order_relaxed);
+    ret.batches += worker.batches.load(std::memory_order_relaxed);
+    ret.max_batch_size =
+        std::max(ret.max_batch_size,
+                 worker.max_batch_size.load(std::memory_order_relaxed));
+    ret.max_queue_depth =
+        std::max(ret.max_queue_depth,
+                 worker.max_queue_depth.load(std::memory_order_relaxed));
+    if (submitted > taken) {
+      ret.queue_depth += static_cast<std::size_t>(submitted - taken);
+    }
+  }
+  return ret;
+}
+
+std::size_t HashService::workers() const noexcept { return m_nworkers; }
+
+} // namespace lemac::inline v1
@@ -0,0 +1,192 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept> // std::runtime_error
+
+#include "impl_interface.h"
+#include "lemac_streamset.h"
+
+namespace lemac::inline v1 {
+
+struct StreamSet::Stream {
+  detail::StreamState state;
+  /// enqueued data which has not been absorbed yet
+  std::vector<std::uint8_t> pending;
+  bool open{};
+};
+
+StreamSet::StreamSet(const LeMac& hasher) : m_hasher(hasher) {}
+
+StreamSet::StreamSet(StreamSet&& other) noexcept = default;
+
+StreamSet& StreamSet::operator=(StreamSet&& other) noexcept = default;
+
+StreamSet::~StreamSet() = default;
+
+StreamSet::stream_id StreamSet::open() {
+  stream_id id;
+  if (m_free.empty()) {
+    id = m_streams.size();
+    m_streams.emplace_back();
+  } else {
+    id = m_free.back();
+    m_free.pop_back();
+  }
+  auto& stream = m_streams[id];
+  detail::Access::impl(m_hasher).init_stream(stream.state);
+  stream.open = true;
+  ++m_open_streams;
+  return id;
+}
+
+void StreamSet::enqueue(const stream_id id,
+                        std::span<const std::uint8_t> data) {
+  using detail::block_size;
+
+  auto& stream = get_open(id);
+  auto& pending = stream.pending;
+  if (pending.size() + data.size() < direct_threshold) {
+    pending.insert(pending.end(), data.begin(), data.end());
+    return;
+  }
+
+  // large pieces are absorbed right away, straight from data instead of
+  // through a copy. first complete the partial block, if any.
+  const auto fill =
+      std::min((block_size - pending.size() % block_size) % block_size,
+               data.size());
+  pending.insert(pending.end(), data.begin(),
+                 data.begin() + static_cast<std::ptrdiff_t>(fill));
+  data = data.subspan(fill);
+  Stream* const streams[1]{&stream};
+  absorb(streams);
+  if (data.empty()) {
+    return;
+  }
+  assert(pending.empty());
+  const auto nblocks = data.size() / block_size;
+  detail::StreamState* const state = &stream.state;
+  const std::uint8_t* const ptr = data.data();
+  detail::Access::impl(m_hasher).absorb_streams({&state, 1}, {&ptr, 1},
+                                                nblocks);
+  data = data.subspan(nblocks * block_size);
+  pending.assign(data.begin(), data.end());
+}
+
+void StreamSet::flush() {
+  std::array<Stream*, group_size> group;
+  std::size_t n = 0;
+  for (auto& stream : m_streams) {
+    if (stream.open && stream.pending.size() >= detail::block_size) {
+      group[n++] = &stream;
+      if (n == group.size()) {
+        absorb(group);
+        n = 0;
+      }
+    }
+  }
+  absorb(std::span(group).first(n));
+}
+
+void StreamSet::absorb(std::span<Stream* const> streams) {
+  using detail::block_size;
+  assert(streams.size() <= group_size);
+
+  // all the streams in the group absorb the same number of blocks at a time,
+  // limited by the one with the fewest. a stream leaves the group when all
+  // its whole blocks are absorbed.
+  std::array<Stream*, group_size> active;
+  std::array<std::size_t, group_size> offset;
+  std::array<std::size_t, group_size> remaining;
+  std::size_t n = 0;
+  for (Stream* stream : streams) {
+    if (stream->pending.size() >= block_size) {
+      active[n] = stream;
+      offset[n] = 0;
+      remaining[n] = stream->pending.size() / block_size;
+      ++n;
+    }
+  }
+
+  std::array<detail::StreamState*, group_size> states;
+  std::array<const std::uint8_t*, group_size> data;
+  const auto& impl = detail::Access::impl(m_hasher);
+  while (n != 0) {
+    const auto nblocks = *std::min_element(remaining.begin(),
+                                           remaining.begin() + n);
+    for (std::size_t i = 0; i < n; ++i) {
+      states[i] = &active[i]->state;
+      data[i] = active[i]->pending.data() + offset[i];
+    }
+    impl.absorb_streams(std::span(states).first(n), std::span(data).first(n),
+                        nblocks);
+    for (std::size_t i = 0; i < n;) {
+      offset[i] += nblocks * block_size;
+      remaining[i] -= nblocks;
+      if (remaining[i] == 0) {
+        // keep the partial block
+        auto& pending = active[i]->pending;
+        pending.erase(pending.begin(),
+                      pending.begin() + static_cast<std::ptrdiff_t>(offset[i]));
+        --n;
+        active[i] = active[n];
+        offset[i] = offset[n];
+        remaining[i] = remaining[n];
+      } else {
+        ++i;
+      }
+    }
+  }
+}
+
+std::array<std::uint8_t, 16> StreamSet::finalize(const stream_id id) {
+  static constexpr std::array<const std::uint8_t, 16> zeros{};
+  return finalize(id, zeros);
+}
+
+std::array<std::uint8_t, 16>
+StreamSet::finalize(const stream_id id, std::span<const std::uint8_t> nonce) {
+  using detail::block_size;
+
+  auto& stream = get_open(id);
+  Stream* const streams[1]{&stream};
+  absorb(streams);
+  assert(stream.pending.size() < block_size);
+
+  std::array<std::uint8_t, 16> ret;
+  detail::Access::impl(m_hasher).finalize_stream(stream.state, stream.pending,
+                                                 nonce, ret);
+  close(id);
+  return ret;
+}
+
+void StreamSet::close(const stream_id id) {
+  auto& stream = get_open(id);
+  stream.pending.clear();
+  stream.open = false;
+  m_free.push_back(id);
+  --m_open_streams;
+}
+
+std::size_t StreamSet::pending_bytes() const noexcept {
+  std::size_t ret = 0;
+  for (const auto& stream : m_streams) {
+    ret += stream.pending.size();
+  }
+  return ret;
+}
+
+StreamSet::Stream& StreamSet::get_open(const stream_id id) {
+  if (id >= m_streams.size() || !m_streams[id].open) {
+    throw std::runtime_error("not an open stream");
+  }
+  return m_streams[id];
+}
+
+} // namespace lemac::inline v1
@@ -0,0 +1,222 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include "lemac_uring.h"
+
+#if LEMAC_HAS_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace lemac::inline v1::detail {
+
+namespace {
+void* map_ring(int fd, std::size_t size, off_t offset) noexcept {
+  void* ret = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ret == MAP_FAILED ? nullptr : ret;
+}
+
+template <typename T> T* at(void* base, std::uint32_t offset) noexcept {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+} // namespace
+
+std::unique_ptr<IoUring> IoUring::create(const unsigned entries) {
+  io_uring_params params{};
+  const auto fd =
+      static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<IoUring> ring(new IoUring);
+  ring->m_fd = fd;
+
+  // reading from the file position needs RW_CUR_POS, and NODROP makes sure
+  // no completion is lost. both are from linux 5.5/5.6.
+  constexpr auto required = IORING_FEAT_RW_CUR_POS | IORING_FEAT_NODROP;
+  if ((params.features & required) != required) {
+    return nullptr;
+  }
+
+  ring->m_sq_entries = params.sq_entries;
+  ring->m_cq_entries = params.cq_entries;
+  ring->m_sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->m_cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->m_sq_ring_size = ring->m_cq_ring_size =
+        std::max(ring->m_sq_ring_size, ring->m_cq_ring_size);
+  }
+
+  ring->m_sq_ring = map_ring(fd, ring->m_sq_ring_size, IORING_OFF_SQ_RING);
+  if (!ring->m_sq_ring) {
+    return nullptr;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->m_cq_ring = ring->m_sq_ring;
+  } else {
+    ring->m_cq_ring = map_ring(fd, ring->m_cq_ring_size, IORING_OFF_CQ_RING);
+    if (!ring->m_cq_ring) {
+      return nullptr;
+    }
+  }
+  ring->m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  ring->m_sqes = static_cast<io_uring_sqe*>(
+      map_ring(fd, ring->m_sqes_size, IORING_OFF_SQES));
+  if (!ring->m_sqes) {
+    return nullptr;
+  }
+
+  auto* const sq = ring->m_sq_ring;
+  ring->m_sq_head = at<unsigned>(sq, params.sq_off.head);
+  ring->m_sq_tail = at<unsigned>(sq, params.sq_off.tail);
+  ring->m_sq_mask = at<unsigned>(sq, params.sq_off.ring_mask);
+  ring->m_sq_array = at<unsigned>(sq, params.sq_off.array);
+  auto* const cq = ring->m_cq_ring;
+  ring->m_cq_head = at<unsigned>(cq, params.cq_off.head);
+  ring->m_cq_tail = at<unsigned>(cq, params.cq_off.tail);
+  ring->m_cq_mask = at<unsigned>(cq, params.cq_off.ring_mask);
+  ring->m_cqes = at<io_uring_cqe>(cq, params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (m_sqes) {
+    munmap(m_sqes, m_sqes_size);
+  }
+  if (m_cq_ring && m_cq_ring != m_sq_ring) {
+    munmap(m_cq_ring, m_cq_ring_size);
+  }
+  if (m_sq_ring) {
+    munmap(m_sq_ring, m_sq_ring_size);
+  }
+  if (m_fd != -1) {
+    close(m_fd);
+  }
+}
+
+bool IoUring::prepare_read(const int fd, void* buffer, const unsigned size,
+                           const std::uint64_t offset,
+                           const std::uint64_t user_data) noexcept {
+  auto* const sqe = prepare(IORING_OP_READ, fd, user_data);
+  if (!sqe) {
+    return false;
+  }
+  sqe->addr = reinterpret_cast<std::uintptr_t>(buffer);
+  sqe->len = size;
+  sqe->off = offset;
+  return true;
+}
+
+bool IoUring::prepare_read_fixed(const int fd, void* buffer,
+                                 const unsigned size,
+                                 const std::uint64_t offset,
+                                 const unsigned buffer_index,
+                                 const std::uint64_t user_data) noexcept {
+  auto* const sqe = prepare(IORING_OP_READ_FIXED, fd, user_data);
+  if (!sqe) {
+    return false;
+  }
+  sqe->addr = reinterpret_cast<std::uintptr_t>(buffer);
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->buf_index = static_cast<std::uint16_t>(buffer_index);
+  return true;
+}
+
+bool IoUring::prepare_openat(const int dirfd, const char* path,
+                             const int flags,
+                             const std::uint64_t user_data) noexcept {
+  auto* const sqe = prepare(IORING_OP_OPENAT, dirfd, user_data);
+  if (!sqe) {
+    return false;
+  }
+  sqe->addr = reinterpret_cast<std::uintptr_t>(path);
+  sqe->open_flags = static_cast<std::uint32_t>(flags);
+  return true;
+}
+
+bool IoUring::prepare_statx(const int dirfd, const char* path, const int flags,
+                            const unsigned mask, struct statx* result,
+                            const std::uint64_t user_data) noexcept {
+  auto* const sqe = prepare(IORING_OP_STATX, dirfd, user_data);
+  if (!sqe) {
+    return false;
+  }
+  sqe->addr = reinterpret_cast<std::uintptr_t>(path);
+  sqe->len = mask;
+  sqe->addr2 = reinterpret_cast<std::uintptr_t>(result);
+  sqe->statx_flags = static_cast<std::uint32_t>(flags);
+  return true;
+}
+
+bool IoUring::prepare_close(const int fd,
+                            const std::uint64_t user_data) noexcept {
+  return prepare(IORING_OP_CLOSE, fd, user_data) != nullptr;
+}
+
+int IoUring::register_buffers(const iovec* buffers,
+                              const unsigned count) noexcept {
+  if (m_has_buffers) {
+    syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, nullptr,
+            0);
+    m_has_buffers = false;
+  }
+  if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers,
+              count) != 0) {
+    return -errno;
+  }
+  m_has_buffers = true;
+  return 0;
+}
+
+io_uring_sqe* IoUring::prepare(const std::uint8_t opcode, const int fd,
+                               const std::uint64_t user_data) noexcept {
+  const unsigned tail = *m_sq_tail;
+  const unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= m_sq_entries) {
+    return nullptr;
+  }
+  const unsigned index = tail & *m_sq_mask;
+  auto* const sqe = &m_sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  m_sq_array[index] = index;
+  // the entry is filled in by the caller before the kernel sees it, which
+  // is not until submit()
+  __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++m_to_submit;
+  return sqe;
+}
+
+int IoUring::submit(const unsigned wait_for) noexcept {
+  for (;;) {
+    const unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    const auto ret = syscall(__NR_io_uring_enter, m_fd, m_to_submit, wait_for,
+                             flags, nullptr, 0);
+    if (ret >= 0) {
+      m_to_submit -= static_cast<unsigned>(ret);
+      return 0;
+    }
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+} // namespace lemac::inline v1::detail
+
+#endif
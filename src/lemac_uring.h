@@ -0,0 +1,145 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define LEMAC_HAS_IO_URING 1
+#else
+#define LEMAC_HAS_IO_URING 0
+#endif
+
+#if LEMAC_HAS_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+struct statx;
+
+namespace lemac::inline v1::detail {
+
+/**
+ * a minimal io_uring, set up through the system calls directly so there is
+ * no dependency on liburing. only what lemac needs is supported.
+ *
+ * not thread safe, a ring is used by one thread at a time.
+ */
+class IoUring {
+public:
+  /// @return null if io_uring is not supported by the kernel, or not
+  /// permitted (containers often forbid it)
+  static std::unique_ptr<IoUring> create(unsigned entries);
+
+  IoUring(const IoUring& other) = delete;
+  IoUring& operator=(const IoUring& other) = delete;
+  ~IoUring();
+
+  /// the ring, which polls readable when there are completions
+  int fd() const noexcept { return m_fd; }
+
+  /// the most completions which can be pending without loss
+  unsigned cq_entries() const noexcept { return m_cq_entries; }
+
+  /**
+   * queues a read. it is handed to the kernel by the next submit().
+   * @param offset where to read from, or -1 for the file position
+   * @return false if the submission queue is full
+   */
+  bool prepare_read(int fd, void* buffer, unsigned size, std::uint64_t offset,
+                    std::uint64_t user_data) noexcept;
+
+  /// like prepare_read(), into a part of the registered buffer buffer_index
+  bool prepare_read_fixed(int fd, void* buffer, unsigned size,
+                          std::uint64_t offset, unsigned buffer_index,
+                          std::uint64_t user_data) noexcept;
+
+  /// queues opening path relative to dirfd, like openat(). the path must be
+  /// kept until the request is complete.
+  bool prepare_openat(int dirfd, const char* path, int flags,
+                      std::uint64_t user_data) noexcept;
+
+  /// queues statx() of path relative to dirfd into result
+  bool prepare_statx(int dirfd, const char* path, int flags, unsigned mask,
+                     struct statx* result, std::uint64_t user_data) noexcept;
+
+  /// queues closing fd
+  bool prepare_close(int fd, std::uint64_t user_data) noexcept;
+
+  /**
+   * registers buffers with the kernel, which saves mapping them for each
+   * read. replaces the buffers registered before, if any.
+   * @return zero on success, otherwise a negative errno
+   */
+  int register_buffers(const iovec* buffers, unsigned count) noexcept;
+
+  /**
+   * hands the queued requests to the kernel and waits until there are at
+   * least wait_for completions.
+   * @return zero on success, otherwise a negative errno
+   */
+  int submit(unsigned wait_for = 0) noexcept;
+
+  /// @return the number of requests queued but not handed to the kernel. if
+  /// submit() failed, these are the ones queued last.
+  unsigned queued() const noexcept { return m_to_submit; }
+
+  /**
+   * calls f(user_data, result) for each completion, where result is what the
+   * corresponding system call would have returned, or a negative errno. f may
+   * queue new requests but must not call reap().
+   * @return the number of completions
+   */
+  template <typename F> std::size_t reap(F&& f) {
+    unsigned head = *m_cq_head;
+    const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    std::size_t n = 0;
+    for (; head != tail; ++head, ++n) {
+      const auto& cqe = m_cqes[head & *m_cq_mask];
+      f(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+private:
+  IoUring() = default;
+
+  /// @return a cleared entry which is submitted by the next submit(), or
+  /// null if the submission queue is full
+  io_uring_sqe* prepare(std::uint8_t opcode, int fd,
+                        std::uint64_t user_data) noexcept;
+
+  int m_fd{-1};
+  unsigned m_sq_entries{};
+  unsigned m_cq_entries{};
+  /// queued but not yet submitted
+  unsigned m_to_submit{};
+  bool m_has_buffers{};
+
+  void* m_sq_ring{};
+  std::size_t m_sq_ring_size{};
+  void* m_cq_ring{};
+  std::size_t m_cq_ring_size{};
+  io_uring_sqe* m_sqes{};
+  std::size_t m_sqes_size{};
+
+  unsigned* m_sq_head{};
+  unsigned* m_sq_tail{};
+  unsigned* m_sq_mask{};
+  unsigned* m_sq_array{};
+  unsigned* m_cq_head{};
+  unsigned* m_cq_tail{};
+  unsigned* m_cq_mask{};
+  io_uring_cqe* m_cqes{};
+};
+
+} // namespace lemac::inline v1::detail
+
+#endif
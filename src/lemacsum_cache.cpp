@@ -0,0 +1,222 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include "lemacsum_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/// the start of a cache file, the last byte is the version of the format
+constexpr char magic[8] = {'l', 'e', 'm', 'a', 'c', 'c', 'h', '\x01'};
+
+/// the size of an entry in the file: the key, then the hash
+constexpr std::size_t record_size = 5 * 8 + 16;
+
+/**
+ * files changed this recently are not cached. their times may not change if
+ * they are written again, since the clock of the file system is coarser than
+ * the times it records.
+ */
+constexpr std::int64_t settle_ns = 2'000'000'000;
+
+struct file_closer {
+  void operator()(std::FILE* f) const { std::fclose(f); }
+};
+using file_ptr = std::unique_ptr<std::FILE, file_closer>;
+
+template <typename T> void put(unsigned char*& out, const T& value) {
+  std::memcpy(out, &value, sizeof(value));
+  out += sizeof(value);
+}
+
+template <typename T> void get(const unsigned char*& in, T& value) {
+  std::memcpy(&value, in, sizeof(value));
+  in += sizeof(value);
+}
+
+#if !defined(_WIN32)
+std::int64_t nanoseconds(const timespec& t) {
+  return std::int64_t{t.tv_sec} * 1'000'000'000 + t.tv_nsec;
+}
+#endif
+
+std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/// @return true with the given probability
+bool sample(double fraction) {
+  if (fraction <= 0) {
+    return false;
+  }
+  thread_local std::minstd_rand rng{std::random_device{}()};
+  return std::uniform_real_distribution<double>(0, 1)(rng) < fraction;
+}
+
+} // namespace
+
+HashCache::HashCache(std::string filename, double verify_fraction)
+    : m_filename(std::move(filename)), m_verify_fraction(verify_fraction) {
+  file_ptr file(std::fopen(m_filename.c_str(), "rb"));
+  if (!file) {
+    // starts empty
+    return;
+  }
+  // read whole, with as few reads as the size takes
+  std::vector<unsigned char> data;
+  unsigned char chunk[64 * 1024];
+  while (const auto got = std::fread(chunk, 1, sizeof(chunk), file.get())) {
+    data.insert(data.end(), chunk, chunk + got);
+  }
+  if (std::ferror(file.get())) {
+    throw std::runtime_error("failed reading cache " + m_filename);
+  }
+  if (data.size() < sizeof(magic) ||
+      std::memcmp(data.data(), magic, sizeof(magic)) != 0 ||
+      (data.size() - sizeof(magic)) % record_size != 0) {
+    // refuse to overwrite what may be some other file
+    throw std::runtime_error(m_filename + " is not a lemacsum cache");
+  }
+  const auto n = (data.size() - sizeof(magic)) / record_size;
+  m_entries.reserve(n);
+  const unsigned char* in = data.data() + sizeof(magic);
+  for (std::size_t i = 0; i < n; ++i) {
+    entry e;
+    get(in, e.key.dev);
+    get(in, e.key.ino);
+    get(in, e.key.size);
+    get(in, e.key.mtime_ns);
+    get(in, e.key.ctime_ns);
+    get(in, e.hash);
+    m_entries[file_id{e.key.dev, e.key.ino}] = e;
+  }
+}
+
+HashCache::probe HashCache::lookup(const std::string& path) {
+  probe ret;
+#if !defined(_WIN32)
+  struct stat statbuf{};
+  if (stat(path.c_str(), &statbuf) != 0 || !S_ISREG(statbuf.st_mode)) {
+    return ret;
+  }
+  ret.cacheable = true;
+  ret.key.dev = static_cast<std::uint64_t>(statbuf.st_dev);
+  ret.key.ino = static_cast<std::uint64_t>(statbuf.st_ino);
+  ret.key.size = static_cast<std::uint64_t>(statbuf.st_size);
+#if defined(__APPLE__)
+  ret.key.mtime_ns = nanoseconds(statbuf.st_mtimespec);
+  ret.key.ctime_ns = nanoseconds(statbuf.st_ctimespec);
+#else
+  ret.key.mtime_ns = nanoseconds(statbuf.st_mtim);
+  ret.key.ctime_ns = nanoseconds(statbuf.st_ctim);
+#endif
+  {
+    std::lock_guard lock(m_mutex);
+    const auto it = m_entries.find(file_id{ret.key.dev, ret.key.ino});
+    if (it == m_entries.end()) {
+      return ret;
+    }
+    const auto& cached = it->second.key;
+    if (cached.size != ret.key.size || cached.mtime_ns != ret.key.mtime_ns ||
+        cached.ctime_ns != ret.key.ctime_ns) {
+      return ret;
+    }
+    ret.hash = it->second.hash;
+  }
+  ret.verify = sample(m_verify_fraction);
+#else
+  (void)path;
+#endif
+  return ret;
+}
+
+bool HashCache::store(const probe& before, const lemac::tag& hash) {
+  if (!before.cacheable) {
+    return true;
+  }
+  const bool same = !before.hash || *before.hash == hash;
+  const bool settled =
+      std::max(before.key.mtime_ns, before.key.ctime_ns) < now_ns() - settle_ns;
+  std::lock_guard lock(m_mutex);
+  if (!same) {
+    ++m_mismatches;
+  }
+  if (settled && !(before.hash && same)) {
+    m_entries[file_id{before.key.dev, before.key.ino}] =
+        entry{before.key, hash};
+    m_changed = true;
+  }
+  return same;
+}
+
+bool HashCache::save() {
+  std::lock_guard lock(m_mutex);
+  if (!m_changed) {
+    return true;
+  }
+  // written next to it and renamed over it, so it is never half written
+  std::string temporary = m_filename + ".tmp";
+#if !defined(_WIN32)
+  temporary += std::to_string(getpid());
+#endif
+  std::vector<unsigned char> data(sizeof(magic) +
+                                  m_entries.size() * record_size);
+  std::memcpy(data.data(), magic, sizeof(magic));
+  unsigned char* out = data.data() + sizeof(magic);
+  for (const auto& [id, e] : m_entries) {
+    put(out, e.key.dev);
+    put(out, e.key.ino);
+    put(out, e.key.size);
+    put(out, e.key.mtime_ns);
+    put(out, e.key.ctime_ns);
+    put(out, e.hash);
+  }
+  {
+    file_ptr file(std::fopen(temporary.c_str(), "wb"));
+    bool ok = file && std::fwrite(data.data(), 1, data.size(), file.get()) ==
+                          data.size();
+    ok = ok && std::fflush(file.get()) == 0;
+#if !defined(_WIN32)
+    ok = ok && fsync(fileno(file.get())) == 0;
+#endif
+    if (!ok) {
+      file.reset();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+#if defined(_WIN32)
+  // rename does not replace an existing file on windows
+  std::remove(m_filename.c_str());
+#endif
+  if (std::rename(temporary.c_str(), m_filename.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  m_changed = false;
+  return true;
+}
+
+std::size_t HashCache::mismatches() const {
+  std::lock_guard lock(m_mutex);
+  return m_mismatches;
+}
@@ -0,0 +1,103 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <lemac.h>
+
+/**
+ * remembers the hashes of files by their device, inode, size, modification
+ * and status change times, so files which have not changed since they were
+ * hashed need not be read again. a lookup costs one stat().
+ *
+ * the cache is kept in a file, which is read whole when created and written
+ * whole by save(). it only makes sense on the machine it was made on, and is
+ * not used on windows where there are no inode numbers.
+ *
+ * thread safe.
+ */
+class HashCache {
+public:
+  /// what identifies the contents of a file, as far as the cache knows
+  struct file_key {
+    std::uint64_t dev{};
+    std::uint64_t ino{};
+    std::uint64_t size{};
+    std::int64_t mtime_ns{};
+    std::int64_t ctime_ns{};
+  };
+
+  /// what lookup() found out about a file
+  struct probe {
+    /// false if the file could not be stat'ed or is not a regular file, then
+    /// it is not cached
+    bool cacheable{};
+    file_key key;
+    /// the hash, if cached
+    std::optional<lemac::tag> hash;
+    /// the file should be hashed anyway, and compared to the cached hash
+    bool verify{};
+  };
+
+  /**
+   * reads the cache from filename, starting empty if it does not exist.
+   * @param verify_fraction how many of the cached files to hash again to
+   * check them, from zero to one
+   * throws std::runtime_error if the file exists but can not be read.
+   */
+  HashCache(std::string filename, double verify_fraction);
+
+  HashCache(const HashCache&) = delete;
+  HashCache& operator=(const HashCache&) = delete;
+
+  probe lookup(const std::string& path);
+
+  /**
+   * records the hash of a file which was looked up before it was hashed. a
+   * cached hash being verified which differs is counted as a mismatch.
+   * @return false on a mismatch
+   */
+  bool store(const probe& before, const lemac::tag& hash);
+
+  /// writes the cache to its file if anything was added
+  /// @return false on failure
+  bool save();
+
+  /// the number of verified files whose hash differed from the cached one
+  std::size_t mismatches() const;
+
+private:
+  struct file_id {
+    std::uint64_t dev{};
+    std::uint64_t ino{};
+    bool operator==(const file_id&) const = default;
+  };
+  struct file_id_hash {
+    std::size_t operator()(const file_id& id) const noexcept {
+      return std::hash<std::uint64_t>{}(id.ino * 0x9e3779b97f4a7c15ULL ^
+                                        id.dev);
+    }
+  };
+  struct entry {
+    file_key key;
+    lemac::tag hash{};
+  };
+
+  std::string m_filename;
+  double m_verify_fraction{};
+  mutable std::mutex m_mutex;
+  std::unordered_map<file_id, entry, file_id_hash> m_entries;
+  bool m_changed{};
+  std::size_t m_mismatches{};
+};
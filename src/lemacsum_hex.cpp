@@ -0,0 +1,124 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include "lemacsum_hex.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LEMACSUM_HEX_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define LEMACSUM_HEX_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+constexpr char digits[] = "0123456789abcdef";
+
+#if LEMACSUM_HEX_SSE2
+/**
+ * the values of 16 lowercase hex digits. ok is cleared in the bytes which are
+ * not such a digit.
+ */
+__m128i decode_digits(__m128i c, __m128i& ok) {
+  const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  const __m128i letter = _mm_sub_epi8(c, _mm_set1_epi8('a'));
+  // unsigned x <= n, as min(x, n) == x
+  const __m128i is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  const __m128i is_letter =
+      _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  ok = _mm_and_si128(ok, _mm_or_si128(is_digit, is_letter));
+  return _mm_or_si128(
+      _mm_and_si128(is_digit, digit),
+      _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+/// joins pairs of digit values, the first the high nibble, into the low byte
+/// of each 16 bit lane
+__m128i join_nibbles(__m128i v) {
+  const __m128i high = _mm_slli_epi16(v, 4);
+  const __m128i low = _mm_srli_epi16(v, 8);
+  return _mm_and_si128(_mm_or_si128(high, low), _mm_set1_epi16(0x00ff));
+}
+#endif
+
+#if LEMACSUM_HEX_NEON
+/// like the sse2 version
+uint8x16_t decode_digits(uint8x16_t c, uint8x16_t& ok) {
+  const uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+  const uint8x16_t letter = vsubq_u8(c, vdupq_n_u8('a'));
+  const uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+  const uint8x16_t is_letter = vcleq_u8(letter, vdupq_n_u8(5));
+  ok = vandq_u8(ok, vorrq_u8(is_digit, is_letter));
+  return vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+}
+#endif
+
+#if !LEMACSUM_HEX_SSE2 && !LEMACSUM_HEX_NEON
+/// @return the value of a lowercase hex digit, or -1
+int digit_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+#endif
+} // namespace
+
+std::string tohex(std::span<const std::uint8_t> binary) {
+  std::string ret(2 * binary.size(), '\0');
+  for (std::size_t i = 0; i < binary.size(); ++i) {
+    ret[2 * i] = digits[binary[i] >> 4];
+    ret[2 * i + 1] = digits[binary[i] & 0xf];
+  }
+  return ret;
+}
+
+std::optional<lemac::tag> fromhex(std::string_view hex) {
+  lemac::tag ret;
+  if (hex.size() != 2 * ret.size()) {
+    return {};
+  }
+#if LEMACSUM_HEX_SSE2
+  __m128i ok = _mm_set1_epi8(-1);
+  const __m128i first = decode_digits(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex.data())), ok);
+  const __m128i second = decode_digits(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex.data() + 16)), ok);
+  if (_mm_movemask_epi8(ok) != 0xffff) {
+    return {};
+  }
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(ret.data()),
+      _mm_packus_epi16(join_nibbles(first), join_nibbles(second)));
+#elif LEMACSUM_HEX_NEON
+  // the high digits go to val[0] and the low to val[1]
+  const uint8x16x2_t c =
+      vld2q_u8(reinterpret_cast<const std::uint8_t*>(hex.data()));
+  uint8x16_t ok = vdupq_n_u8(0xff);
+  const uint8x16_t high = decode_digits(c.val[0], ok);
+  const uint8x16_t low = decode_digits(c.val[1], ok);
+  const uint8x8_t all = vand_u8(vget_low_u8(ok), vget_high_u8(ok));
+  if (vget_lane_u64(vreinterpret_u64_u8(all), 0) != ~std::uint64_t{0}) {
+    return {};
+  }
+  vst1q_u8(ret.data(), vorrq_u8(vshlq_n_u8(high, 4), low));
+#else
+  for (std::size_t i = 0; i < ret.size(); ++i) {
+    const int high = digit_value(hex[2 * i]);
+    const int low = digit_value(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return {};
+    }
+    ret[i] = static_cast<std::uint8_t>(high << 4 | low);
+  }
+#endif
+  return ret;
+}
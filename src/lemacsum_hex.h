@@ -0,0 +1,26 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <lemac.h>
+
+/// @return the bytes as lowercase hex
+std::string tohex(std::span<const std::uint8_t> binary);
+
+/**
+ * decodes a checksum, sixteen bytes as 32 lowercase hex digits. uses sse2 on
+ * x86-64 and neon on arm, where all the digits are decoded and checked at
+ * once.
+ * @return the checksum, or empty if hex is not one
+ */
+std::optional<lemac::tag> fromhex(std::string_view hex);
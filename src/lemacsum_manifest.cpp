@@ -0,0 +1,211 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include "lemacsum_manifest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char magic[8] = {'l', 'e', 'm', 'a', 'c', 's', 'u', 'm'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t header_size = 32;
+constexpr std::size_t entry_size = 32;
+
+struct file_closer {
+  void operator()(std::FILE* f) const { std::fclose(f); }
+};
+using file_ptr = std::unique_ptr<std::FILE, file_closer>;
+
+template <typename T> void store_le(unsigned char* out, T value) {
+  for (std::size_t i = 0; i < sizeof(T); ++i) {
+    out[i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+template <typename T> T load_le(const unsigned char* in) {
+  T value{};
+  for (std::size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<T>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+} // namespace
+
+bool write_binary_manifest(std::FILE* out,
+                           std::vector<manifest_entry>& entries) {
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.name < b.name; });
+  std::uint64_t names_size = 0;
+  for (const auto& e : entries) {
+    names_size += e.name.size();
+  }
+
+  unsigned char header[header_size]{};
+  std::memcpy(header, magic, sizeof(magic));
+  store_le<std::uint32_t>(header + 8, version);
+  store_le<std::uint64_t>(header + 16, entries.size());
+  store_le<std::uint64_t>(header + 24, names_size);
+  if (std::fwrite(header, 1, sizeof(header), out) != sizeof(header)) {
+    return false;
+  }
+
+  // the index, a part at a time
+  std::vector<unsigned char> buffer;
+  std::uint64_t offset = 0;
+  for (std::size_t i = 0; i < entries.size(); i += 4096) {
+    const auto n = std::min<std::size_t>(4096, entries.size() - i);
+    buffer.assign(n * entry_size, 0);
+    for (std::size_t k = 0; k < n; ++k) {
+      const auto& e = entries[i + k];
+      unsigned char* const p = buffer.data() + k * entry_size;
+      store_le<std::uint64_t>(p, offset);
+      store_le<std::uint32_t>(p + 8,
+                              static_cast<std::uint32_t>(e.name.size()));
+      std::memcpy(p + 16, e.hash.data(), e.hash.size());
+      offset += e.name.size();
+    }
+    if (std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+      return false;
+    }
+  }
+  for (const auto& e : entries) {
+    if (std::fwrite(e.name.data(), 1, e.name.size(), out) != e.name.size()) {
+      return false;
+    }
+  }
+  return std::fflush(out) == 0;
+}
+
+bool is_binary_manifest(const char* filename) {
+  // reading the start of a pipe would take it away from the text parser
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(filename, ec)) {
+    return false;
+  }
+  file_ptr file(std::fopen(filename, "rb"));
+  char start[sizeof(magic)];
+  return file && std::fread(start, 1, sizeof(start), file.get()) ==
+                     sizeof(start) &&
+         std::memcmp(start, magic, sizeof(magic)) == 0;
+}
+
+BinaryManifest::BinaryManifest(const char* filename) : m_filename(filename) {
+#if !defined(_WIN32)
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw std::runtime_error("failed opening " + m_filename);
+  }
+  struct stat statbuf{};
+  if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+      statbuf.st_size > 0) {
+    const auto length = static_cast<std::size_t>(statbuf.st_size);
+    void* const p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      m_mapping = {static_cast<const unsigned char*>(p), unmapper{length}};
+      m_data = {m_mapping.get(), length};
+    }
+  }
+  close(fd);
+#endif
+  if (!m_mapping) {
+    file_ptr file(std::fopen(filename, "rb"));
+    if (!file) {
+      throw std::runtime_error("failed opening " + m_filename);
+    }
+    unsigned char chunk[64 * 1024];
+    while (const auto got = std::fread(chunk, 1, sizeof(chunk), file.get())) {
+      m_copy.insert(m_copy.end(), chunk, chunk + got);
+    }
+    if (std::ferror(file.get())) {
+      throw std::runtime_error("failed reading " + m_filename);
+    }
+    m_data = m_copy;
+  }
+
+  const auto malformed = [&] {
+    return std::runtime_error(m_filename + " is not a valid binary manifest");
+  };
+  if (m_data.size() < header_size ||
+      std::memcmp(m_data.data(), magic, sizeof(magic)) != 0) {
+    throw malformed();
+  }
+  if (load_le<std::uint32_t>(m_data.data() + 8) != version) {
+    throw std::runtime_error(m_filename +
+                             " is a binary manifest of an unknown version");
+  }
+  const auto count = load_le<std::uint64_t>(m_data.data() + 16);
+  const auto names_size = load_le<std::uint64_t>(m_data.data() + 24);
+  const auto room = m_data.size() - header_size;
+  if (count > room / entry_size || names_size != room - count * entry_size) {
+    throw malformed();
+  }
+  m_count = static_cast<std::size_t>(count);
+  m_names = m_data.subspan(header_size + m_count * entry_size);
+}
+
+void BinaryManifest::unmapper::operator()(const unsigned char* p) const {
+#if !defined(_WIN32)
+  munmap(const_cast<unsigned char*>(p), length);
+#else
+  (void)p;
+#endif
+}
+
+const unsigned char* BinaryManifest::entry(std::size_t i) const {
+  return m_data.data() + header_size + i * entry_size;
+}
+
+std::string_view BinaryManifest::name(std::size_t i) const {
+  const auto* const e = entry(i);
+  const auto offset = load_le<std::uint64_t>(e);
+  const auto size = load_le<std::uint32_t>(e + 8);
+  if (offset > m_names.size() || size > m_names.size() - offset) {
+    throw std::runtime_error(m_filename + " is not a valid binary manifest");
+  }
+  return {reinterpret_cast<const char*>(m_names.data()) + offset, size};
+}
+
+lemac::tag BinaryManifest::hash(std::size_t i) const {
+  lemac::tag ret;
+  std::memcpy(ret.data(), entry(i) + 16, ret.size());
+  return ret;
+}
+
+std::pair<std::size_t, std::size_t>
+BinaryManifest::find(std::string_view name) const {
+  // binary search over the indices, comparing the names they point to
+  std::size_t first = 0;
+  std::size_t count = m_count;
+  while (count > 0) {
+    const auto half = count / 2;
+    if (this->name(first + half) < name) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  auto last = first;
+  while (last < m_count && this->name(last) == name) {
+    ++last;
+  }
+  return {first, last};
+}
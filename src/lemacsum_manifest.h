@@ -0,0 +1,90 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <lemac.h>
+
+/**
+ * the binary checksum file written by lemacsum --format=bin. all numbers are
+ * little endian.
+ *
+ *   header, 32 bytes:  magic "lemacsum", u32 version (1), u32 flags (0),
+ *                      u64 number of entries, u64 size of the names
+ *   entries, 32 bytes each, sorted by name:
+ *                      u64 offset of the name, u32 size of the name,
+ *                      u32 reserved (0), 16 byte tag
+ *   names:             the names, not terminated, which the offsets are
+ *                      relative to
+ *
+ * since the entries have a fixed size and are sorted, a file is found by
+ * binary search, touching only the parts of the index on the way.
+ */
+
+/// a checksum and the name of its file
+struct manifest_entry {
+  std::string name;
+  lemac::tag hash{};
+};
+
+/**
+ * writes a binary checksum file, after sorting entries by name.
+ * @return false on failure
+ */
+bool write_binary_manifest(std::FILE* out,
+                           std::vector<manifest_entry>& entries);
+
+/**
+ * @return true if filename is a regular file which starts like a binary
+ * checksum file. anything else, such as a pipe, is not looked at, since
+ * that would consume what is read from it.
+ */
+bool is_binary_manifest(const char* filename);
+
+/// a binary checksum file, mapped into memory where possible
+class BinaryManifest {
+public:
+  /// throws std::runtime_error if the file can not be read or is malformed
+  explicit BinaryManifest(const char* filename);
+  BinaryManifest(const BinaryManifest&) = delete;
+  BinaryManifest& operator=(const BinaryManifest&) = delete;
+
+  std::size_t size() const { return m_count; }
+
+  /// throws std::runtime_error if the entry points outside the file
+  std::string_view name(std::size_t i) const;
+
+  lemac::tag hash(std::size_t i) const;
+
+  /// @return the range of entries named name
+  std::pair<std::size_t, std::size_t> find(std::string_view name) const;
+
+private:
+  const unsigned char* entry(std::size_t i) const;
+
+  struct unmapper {
+    std::size_t length;
+    void operator()(const unsigned char* p) const;
+  };
+
+  std::string m_filename;
+  std::unique_ptr<const unsigned char, unmapper> m_mapping;
+  /// the file when it could not be mapped
+  std::vector<unsigned char> m_copy;
+  std::span<const unsigned char> m_data;
+  std::size_t m_count{};
+  std::span<const unsigned char> m_names;
+};
@@ -0,0 +1,409 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+#include "lemacsum_walk.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <filesystem>
+#else
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace {
+
+/// the files of a directory are visited this many at a time
+constexpr std::size_t files_per_batch = 16;
+
+/// @return the root, if it is a directory
+bool is_directory(const std::string& root) {
+#if defined(_WIN32)
+  std::error_code ec;
+  return std::filesystem::is_directory(root, ec);
+#else
+  struct stat statbuf{};
+  return stat(root.c_str(), &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+#endif
+}
+
+std::string join(const std::string& dir, std::string_view name) {
+  std::string ret;
+  ret.reserve(dir.size() + 1 + name.size());
+  ret.append(dir);
+  if (!ret.empty() && ret.back() != '/') {
+    ret.push_back('/');
+  }
+  ret.append(name);
+  return ret;
+}
+
+#if !defined(_WIN32)
+/// an open directory, kept while there are subdirectories left to open
+/// relative to it
+struct Directory {
+  explicit Directory(int descriptor) : fd(descriptor) {}
+  Directory(const Directory&) = delete;
+  Directory& operator=(const Directory&) = delete;
+  ~Directory() { close(fd); }
+
+  const int fd;
+};
+
+/// a directory on the way from the root, to detect loops through links
+struct Ancestor {
+  dev_t dev{};
+  ino_t ino{};
+  std::shared_ptr<const Ancestor> parent;
+};
+
+/**
+ * calls f(name, type) for each entry of the directory fd, except . and ..,
+ * where type is a DT_ constant or DT_UNKNOWN.
+ * @return zero, or an errno
+ */
+template <typename F> int read_entries(int fd, F&& f) {
+#if defined(__linux__)
+  // the layout the kernel fills in, which is not in the glibc headers
+  struct linux_dirent64 {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+  alignas(linux_dirent64) thread_local char buffer[64 * 1024];
+  for (;;) {
+    const auto ret = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    if (ret == 0) {
+      return 0;
+    }
+    for (long pos = 0; pos < ret;) {
+      const auto* entry = reinterpret_cast<const linux_dirent64*>(buffer + pos);
+      pos += entry->d_reclen;
+      const std::string_view name(entry->d_name);
+      if (name != "." && name != "..") {
+        f(name, entry->d_type);
+      }
+    }
+  }
+#else
+  // readdir closes the descriptor it is given along with the stream
+  const int copy = dup(fd);
+  if (copy == -1) {
+    return errno;
+  }
+  DIR* dir = fdopendir(copy);
+  if (!dir) {
+    const int error = errno;
+    close(copy);
+    return error;
+  }
+  errno = 0;
+  while (const dirent* entry = readdir(dir)) {
+    const std::string_view name(entry->d_name);
+    if (name != "." && name != "..") {
+      f(name, entry->d_type);
+    }
+    errno = 0;
+  }
+  const int error = errno;
+  closedir(dir);
+  return error;
+#endif
+}
+#endif
+
+/// a pool of threads taking jobs from a stack, which they add jobs to
+class Walker {
+public:
+  Walker(const walk_options& options, const walk_visitor& visit,
+         const walk_error& fail)
+      : m_options(options), m_visit(visit), m_fail(fail) {}
+
+  void add_root(const std::string& root) {
+    if (root != "-" && is_directory(root)) {
+      Job job;
+      job.name = root;
+      job.path = root;
+      job.root = true;
+      m_jobs.push_back(std::move(job));
+    } else {
+      // hashed as usual, which reports any error
+      Job job;
+      job.files.push_back(root);
+      m_jobs.push_back(std::move(job));
+    }
+  }
+
+  void run() {
+    // the stack is taken from the back, and the roots go first
+    std::reverse(m_jobs.begin(), m_jobs.end());
+    const auto nthreads = std::max(1U, m_options.threads);
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for (unsigned i = 1; i < nthreads; ++i) {
+      threads.emplace_back([this, i] { work(i); });
+    }
+    work(0);
+    for (auto& t : threads) {
+      t.join();
+    }
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+  }
+
+private:
+  struct Job {
+    /// files to visit, or if empty the directory to read
+    std::vector<std::string> files;
+#if !defined(_WIN32)
+    /// the directory the files are in, or name is relative to. null for the
+    /// roots.
+    std::shared_ptr<Directory> parent;
+    std::shared_ptr<const Ancestor> ancestors;
+    dev_t root_dev{};
+#endif
+    std::string name;
+    std::string path;
+    bool root{};
+  };
+
+  void work(unsigned self) {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock lock(m_mutex);
+        m_cv.wait(lock, [this] {
+          return m_error || !m_jobs.empty() || m_busy == 0;
+        });
+        if (m_error || m_jobs.empty()) {
+          return;
+        }
+        job = std::move(m_jobs.back());
+        m_jobs.pop_back();
+        ++m_busy;
+      }
+      try {
+        if (job.files.empty()) {
+          read_directory(self, job);
+        } else {
+          m_visit(self, directory_fd(job), job.files);
+        }
+      } catch (...) {
+        std::lock_guard lock(m_mutex);
+        if (!m_error) {
+          m_error = std::current_exception();
+        }
+      }
+      std::lock_guard lock(m_mutex);
+      if (--m_busy == 0 || m_error) {
+        m_cv.notify_all();
+      }
+    }
+  }
+
+  void push(std::vector<Job>& jobs) {
+    if (jobs.empty()) {
+      return;
+    }
+    {
+      std::lock_guard lock(m_mutex);
+      // reversed, so they are taken in the order they were found
+      std::move(jobs.rbegin(), jobs.rend(), std::back_inserter(m_jobs));
+    }
+    jobs.clear();
+    m_cv.notify_all();
+  }
+
+  /// @return the directory the files of job are in, or -1
+  static int directory_fd([[maybe_unused]] const Job& job) {
+#if defined(_WIN32)
+    return -1;
+#else
+    return job.parent ? job.parent->fd : -1;
+#endif
+  }
+
+  /// visits the files of found in batches, all but the first are left to any
+  /// thread
+  void visit_files(unsigned self, Job& found, std::vector<Job>& jobs) {
+    auto& files = found.files;
+    if (files.empty()) {
+      return;
+    }
+    for (std::size_t i = files_per_batch; i < files.size();
+         i += files_per_batch) {
+      Job job;
+#if !defined(_WIN32)
+      job.parent = found.parent;
+#endif
+      const auto end = std::min(i + files_per_batch, files.size());
+      job.files.assign(std::make_move_iterator(files.begin() + i),
+                       std::make_move_iterator(files.begin() + end));
+      jobs.push_back(std::move(job));
+    }
+    files.resize(std::min(files.size(), files_per_batch));
+    // the subdirectories and other batches can be taken meanwhile
+    push(jobs);
+    m_visit(self, directory_fd(found), files);
+  }
+
+#if defined(_WIN32)
+  void read_directory(unsigned self, Job& job) {
+    namespace fs = std::filesystem;
+    Job found;
+    auto& files = found.files;
+    std::vector<Job> jobs;
+    std::error_code ec;
+    for (fs::directory_iterator it(job.path, ec), end; !ec && it != end;
+         it.increment(ec)) {
+      const auto status = m_options.follow_symlinks
+                              ? it->status(ec)
+                              : it->symlink_status(ec);
+      const auto name = it->path().filename().string();
+      if (fs::is_directory(status)) {
+        Job sub;
+        sub.name = sub.path = join(job.path, name);
+        jobs.push_back(std::move(sub));
+      } else if (fs::is_regular_file(status)) {
+        files.push_back(join(job.path, name));
+      }
+    }
+    if (ec) {
+      m_fail(job.path, ec);
+    }
+    push(jobs);
+    visit_files(self, found, jobs);
+  }
+#else
+  void read_directory(unsigned self, Job& job) {
+    const int dirfd = job.parent ? job.parent->fd : AT_FDCWD;
+    const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+                      (job.root || m_options.follow_symlinks ? 0 : O_NOFOLLOW);
+    const int fd = openat(dirfd, job.name.c_str(), flags);
+    // the parent is not needed once this is open
+    job.parent.reset();
+    if (fd == -1) {
+      m_fail(job.path, std::error_code(errno, std::generic_category()));
+      return;
+    }
+    auto directory = std::make_shared<Directory>(fd);
+
+    struct stat statbuf{};
+    if (fstat(fd, &statbuf) != 0) {
+      m_fail(job.path, std::error_code(errno, std::generic_category()));
+      return;
+    }
+    if (job.root) {
+      job.root_dev = statbuf.st_dev;
+    } else if (m_options.one_file_system && statbuf.st_dev != job.root_dev) {
+      return;
+    }
+    for (auto* a = job.ancestors.get(); a; a = a->parent.get()) {
+      if (a->dev == statbuf.st_dev && a->ino == statbuf.st_ino) {
+        // a link back up the tree
+        m_fail(job.path, std::make_error_code(
+                             std::errc::too_many_symbolic_link_levels));
+        return;
+      }
+    }
+    auto self_ancestor = std::make_shared<const Ancestor>(
+        Ancestor{statbuf.st_dev, statbuf.st_ino, std::move(job.ancestors)});
+
+    // the files are opened relative to the directory
+    Job found;
+    found.parent = directory;
+    auto& files = found.files;
+    std::vector<Job> jobs;
+    auto add_directory = [&](std::string_view name) {
+      Job sub;
+      sub.parent = directory;
+      sub.ancestors = self_ancestor;
+      sub.root_dev = job.root_dev;
+      sub.name = name;
+      sub.path = join(job.path, name);
+      jobs.push_back(std::move(sub));
+    };
+    const int error = read_entries(fd, [&](std::string_view name,
+                                           unsigned char type) {
+      if (type == DT_UNKNOWN || (type == DT_LNK && m_options.follow_symlinks)) {
+        // the file system does not tell, or the link is followed
+        struct stat entry{};
+        const int stat_flags =
+            m_options.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+        if (fstatat(fd, std::string(name).c_str(), &entry, stat_flags) != 0) {
+          m_fail(join(job.path, name),
+                 std::error_code(errno, std::generic_category()));
+          return;
+        }
+        type = S_ISDIR(entry.st_mode)   ? DT_DIR
+               : S_ISREG(entry.st_mode) ? DT_REG
+                                        : DT_UNKNOWN;
+      }
+      if (type == DT_DIR) {
+        add_directory(name);
+      } else if (type == DT_REG) {
+        files.push_back(join(job.path, name));
+      }
+    });
+    if (error != 0) {
+      m_fail(job.path, std::error_code(error, std::generic_category()));
+    }
+    // subdirectories and files keep it open for as long as they need it
+    directory.reset();
+    push(jobs);
+    visit_files(self, found, jobs);
+  }
+#endif
+
+  const walk_options& m_options;
+  const walk_visitor& m_visit;
+  const walk_error& m_fail;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<Job> m_jobs;
+  /// jobs being worked on, which may add more
+  unsigned m_busy{};
+  std::exception_ptr m_error;
+};
+
+} // namespace
+
+void walk_files(std::span<const std::string> roots, const walk_options& options,
+                const walk_visitor& visit, const walk_error& fail) {
+  Walker walker(options, visit, fail);
+  for (const auto& root : roots) {
+    walker.add_root(root);
+  }
+  walker.run();
+}
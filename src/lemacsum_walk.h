@@ -0,0 +1,44 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+#pragma once
+
+#include <functional>
+#include <span>
+#include <string>
+#include <system_error>
+
+struct walk_options {
+  /// follow symbolic links found in the directories. the roots are always
+  /// followed.
+  bool follow_symlinks = false;
+  /// do not descend into directories on another file system than their root
+  bool one_file_system = false;
+  /// the number of threads walking, which also run the visitor
+  unsigned threads = 1;
+};
+
+/// called with files found together, and the index of the calling thread.
+/// dirfd is the open directory the files are in, or -1 for roots which are
+/// not directories (and on windows).
+using walk_visitor = std::function<void(unsigned thread, int dirfd,
+                                        std::span<const std::string> files)>;
+
+/// called for a directory which could not be read
+using walk_error =
+    std::function<void(const std::string& path, std::error_code error)>;
+
+/**
+ * finds the regular files in and under the roots, on several threads. roots
+ * which are not directories are passed to visit as they are. the files of a
+ * directory are passed in batches, which several threads may visit at the
+ * same time. on linux, directories are opened relative to their parent and
+ * read with getdents64. a directory is kept open while its files are
+ * visited, so they can be opened relative to it. symbolic links are skipped
+ * unless followed, as are fifos, sockets and devices.
+ */
+void walk_files(std::span<const std::string> roots, const walk_options& options,
+                const walk_visitor& visit, const walk_error& fail);
@@ -4,205 +4,433 @@
  * https://github.com/pauldreik/lemac
  * SPDX-License-Identifier: BSL-1.0
  */
-#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
-#include <fstream>
+#include <deque>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <cstdint>
 #include <stdint.h>
 
 #include <lemac.h>
+#include <lemac_file.h>
+
+#include "lemacsum_cache.h"
+#include "lemacsum_hex.h"
+#include "lemacsum_manifest.h"
+#include "lemacsum_walk.h"
 
 #include <span>
 
-#if !defined(_WIN32)
-// for mmap to work
-#include <fcntl.h>    //open
-#include <sys/mman.h> //mmap
-#include <sys/stat.h> //fstat
-#include <unistd.h>   //close
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
 #endif
 
-std::string tohex(std::span<const std::uint8_t> binary) {
-  std::string ret;
-  char buf[3];
-  for (auto c : binary) {
-    std::snprintf(buf, sizeof(buf), "%02x", (unsigned char)c);
-    ret.append(buf);
-  }
-  return ret;
-}
-
 void usage() {
   std::cout << "calculates or verifies lemac checksums, behaves similar to "
-               "sha256sum\n";
+               "sha256sum\n"
+               "\n"
+               "options:\n"
+               "  -c, --check         verify the checksums in the files\n"
+               "      --ignore-missing  with --check, skip missing files\n"
+               "      --strict        with --check, fail on malformed lines\n"
+               "  -j, --threads N     hash N files at a time, 0 means one per\n"
+               "                      hardware thread. the default is 1.\n"
+               "      --io=METHOD     how files are read: auto (the default),\n"
+               "                      mmap, read or uring\n"
+               "  -r, --recursive     hash the files in directories and their\n"
+               "                      subdirectories\n"
+               "  -L, --follow-symlinks  with -r, follow symbolic links\n"
+               "  -x, --one-file-system  with -r, stay on the file system of\n"
+               "                      each directory given\n"
+               "      --sort          with -r, print the files sorted by name\n"
+               "                      instead of as they are found\n"
+               "      --files-from FILE   read the names of the files from\n"
+               "                      FILE, one per line, - for stdin\n"
+               "      --files0-from FILE  like --files-from, with the names\n"
+               "                      separated by NUL\n"
+               "      --cache FILE    remember the checksums in FILE, and do\n"
+               "                      not read files again whose size, inode\n"
+               "                      and times are the same as then\n"
+               "      --verify-cache[=PERCENT]  with --cache, read PERCENT\n"
+               "                      (1 by default) of the remembered files\n"
+               "                      again and fail if they differ\n"
+               "      --format=FORMAT write the checksums as text (the\n"
+               "                      default), or bin for an indexed binary\n"
+               "                      file which --check recognizes\n"
+               "      --only FILE     with --check, only verify FILE, can be\n"
+               "                      given several times\n";
 }
 
-#if !defined(_WIN32)
-namespace {
-// RAII for file descriptor
-struct fdcloser {
-  explicit fdcloser(int fd) : m_fd(fd) {}
+/// the file descriptor of stdin, on all platforms
+constexpr int stdin_fd = 0;
 
-  // DesDeMovA to prevent copy
+/// prints the error of a file which could not be hashed
+void report_error(const std::exception& e) {
+  // one write, so messages from several threads do not mix
+  std::cerr << (e.what() + std::string(1, '\n'));
+}
 
-  fdcloser& operator=(fdcloser&&) = delete;
+/// @return the checksum, or empty on failure
+std::optional<lemac::tag> checksum(lemac::LeMac& lemac,
+                                   const std::string& filename,
+                                   const lemac::file_options& io) {
+  try {
+    // special case "-" to mean stdin, just like sha256sum
+    const auto result = filename == "-"
+                            ? lemac::hash_file(lemac, stdin_fd, io)
+                            : lemac::hash_file(lemac, filename, io);
+    return result.hash;
+  } catch (const std::exception& e) {
+    report_error(e);
+    return {};
+  }
+}
 
-  ~fdcloser() { close(m_fd); }
+/**
+ * like checksum() for several files, which lets hash_files() open, read and
+ * close the small ones together. files found in the cache, if any, are not
+ * read unless picked to verify it.
+ * @param known the outcome of cache->lookup() for each file, if the caller
+ * has already done it. empty otherwise.
+ * @param dirfd the open directory the files are in, which they are opened
+ * relative to, or -1
+ * @return the checksums in the order of files
+ */
+std::vector<std::optional<lemac::tag>>
+checksums(lemac::LeMac& lemac, std::span<const std::string> files,
+          const lemac::file_options& io, HashCache* cache,
+          std::span<const HashCache::probe> known = {}, int dirfd = -1) {
+  std::vector<std::optional<lemac::tag>> answers(files.size());
+  std::vector<HashCache::probe> probes(cache ? files.size() : 0);
+  // the files to read, except stdin
+  std::vector<std::size_t> indices;
+  std::vector<std::filesystem::path> paths;
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    if (files[i] == "-") {
+      answers[i] = checksum(lemac, files[i], io);
+      continue;
+    }
+    if (cache) {
+      probes[i] = known.empty() ? cache->lookup(files[i]) : known[i];
+      if (probes[i].hash && !probes[i].verify) {
+        answers[i] = probes[i].hash;
+        continue;
+      }
+    }
+    indices.push_back(i);
+    paths.emplace_back(files[i]);
+  }
+#if defined(_WIN32)
+  const auto outcomes = lemac::hash_files(lemac, paths, io);
+#else
+  const auto outcomes = dirfd >= 0
+                            ? lemac::hash_files(lemac, dirfd, paths, io)
+                            : lemac::hash_files(lemac, paths, io);
+#endif
+  for (std::size_t k = 0; k < outcomes.size(); ++k) {
+    const auto i = indices[k];
+    if (outcomes[k].error) {
+      try {
+        std::rethrow_exception(outcomes[k].error);
+      } catch (const std::exception& e) {
+        report_error(e);
+      }
+      continue;
+    }
+    answers[i] = outcomes[k].result.hash;
+    if (cache && !cache->store(probes[i], outcomes[k].result.hash)) {
+      std::cerr << (files[i] +
+                    ": differs from the cache, though its size and times "
+                    "do not\n");
+    }
+  }
+  return answers;
+}
 
-  int m_fd{-1};
-};
+namespace {
+/// the files a thread hashes. the thread takes from the front, which has the
+/// larger files. threads which run out of work steal from the back.
+class WorkQueue {
+public:
+  void push_back(std::size_t item) { m_items.push_back(item); }
 
-// RAII for memory map
-struct mmapper {
-  mmapper(void* addr, size_t length) : m_addr(addr), m_len(length) {}
+  /// moves items from the front to batch, while there are any, batch is
+  /// smaller than max and small(item) holds
+  template <typename Predicate>
+  void pop_front_while(std::vector<std::size_t>& batch, std::size_t max,
+                       Predicate&& small) {
+    std::lock_guard lock(m_mutex);
+    while (!m_items.empty() && batch.size() < max && small(m_items.front())) {
+      batch.push_back(m_items.front());
+      m_items.pop_front();
+    }
+  }
 
-  // DesDeMovA to prevent copy
-  mmapper& operator=(mmapper&&) = delete;
+  std::optional<std::size_t> pop_front() {
+    std::lock_guard lock(m_mutex);
+    if (m_items.empty()) {
+      return {};
+    }
+    const auto item = m_items.front();
+    m_items.pop_front();
+    return item;
+  }
 
-  ~mmapper() { munmap((void*)m_addr, m_len); }
+  std::optional<std::size_t> pop_back() {
+    std::lock_guard lock(m_mutex);
+    if (m_items.empty()) {
+      return {};
+    }
+    const auto item = m_items.back();
+    m_items.pop_back();
+    return item;
+  }
 
-  void* m_addr{MAP_FAILED};
-  size_t m_len{0};
+private:
+  std::mutex m_mutex;
+  std::deque<std::size_t> m_items;
 };
-} // namespace
 
-// use std::string for filename to guarantee null termination
-std::string checksum(lemac::LeMac& lemac, const std::string& filename) {
-
-  lemac.reset();
-
-  // special case "-" to mean stdin, just like sha256sum
-  const auto fd = fdcloser{filename == "-" ? dup(STDIN_FILENO)
-                                           : open(filename.c_str(), O_RDONLY)};
-
-  if (fd.m_fd == -1) {
-    std::cerr << "failed opening file " << filename << ", got error "
-              << std::strerror(errno) << '\n';
-    return {};
+/// the size of a file for scheduling, zero if it is not known
+std::uintmax_t size_hint(const std::string& filename) {
+  if (filename == "-") {
+    return 0;
   }
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(filename, ec);
+  return ec ? 0 : size;
+}
 
-  // get the filesize and kind
-  struct stat statbuf {};
-  if (fstat(fd.m_fd, &statbuf) != 0) {
-    std::cerr << "failed fstat for file " << filename << ", got error "
-              << std::strerror(errno) << '\n';
-    return {};
+/**
+ * the threads hashing with -j, each with its own copy of the hasher. they are
+ * kept for all the windows of a list, instead of being started for each.
+ */
+class ChecksumThreads {
+public:
+  ChecksumThreads(unsigned nthreads, const lemac::LeMac& prototype)
+      // copying the prototype avoids setting up the key again
+      : m_hashers(nthreads, prototype) {
+    m_threads.reserve(nthreads - 1);
+    for (unsigned i = 1; i < nthreads; ++i) {
+      m_threads.emplace_back([this, i] { serve(i); });
+    }
   }
-
-  bool use_mmap = false;
-
-  switch (statbuf.st_mode & S_IFMT) {
-  case S_IFBLK:
-    // block device, works fine
-    break;
-  case S_IFCHR:
-    // character device, works fine. test with /dev/null or /dev/stdin
-    break;
-  case S_IFDIR:
-    std::cerr << filename << " is a directory\n";
-    return {};
-  case S_IFIFO:
-    // FIFO/pipe, works fine (test with mkfifo /tmp/pipe)
-    break;
-  case S_IFLNK:
-    // works fine, we never come here because we open with open() which resolves
-    // the symlink
-    break;
-  case S_IFREG:
-    // reqular file, only use mmap if size is strictly positive
-    use_mmap = (statbuf.st_size > 0);
-    break;
-  case S_IFSOCK:
-    // socket, won't happen, does not come past open()
-    break;
-  default:
-    std::cerr << "unknown file type " << +(statbuf.st_mode & S_IFMT) << '\n';
-    return {};
+  ChecksumThreads(const ChecksumThreads&) = delete;
+  ChecksumThreads& operator=(const ChecksumThreads&) = delete;
+  ~ChecksumThreads() {
+    {
+      std::lock_guard lock(m_mutex);
+      m_stop = true;
+    }
+    m_start.notify_all();
+    for (auto& t : m_threads) {
+      t.join();
+    }
   }
 
-  if (use_mmap) {
-    assert(statbuf.st_size > 0);
-    const auto length = static_cast<size_t>(statbuf.st_size);
+  unsigned size() const { return static_cast<unsigned>(m_hashers.size()); }
 
-    const auto memory_map = mmapper(mmap(NULL, length, PROT_READ,
-                                         MAP_FILE | MAP_PRIVATE
-#ifdef __linux__
-                                             | MAP_POPULATE
-#endif
-                                         ,
-                                         fd.m_fd, 0),
-                                    length);
-    if (memory_map.m_addr == MAP_FAILED) {
-
-      std::cerr << "failed memory mapping file " << filename << ", got errno "
-                << std::strerror(errno) << ", file size " << statbuf.st_size
-                << '\n';
-      return {};
-    } else {
-      const auto* addr =
-          reinterpret_cast<const std::uint8_t*>(memory_map.m_addr);
-      return tohex(lemac.oneshot(std::span{addr, length}));
+  lemac::LeMac& hasher(unsigned thread) { return m_hashers[thread]; }
+
+  /// runs work(index) on all the threads, index zero being the calling
+  /// thread, and returns when it has returned on all
+  void run(const std::function<void(unsigned)>& work) {
+    {
+      std::lock_guard lock(m_mutex);
+      m_work = &work;
+      m_running = m_threads.size();
+      ++m_generation;
     }
-  } else if (!use_mmap) {
-    std::vector<std::uint8_t> buf(1 << 20);
+    m_start.notify_all();
+    work(0);
+    std::unique_lock lock(m_mutex);
+    m_done.wait(lock, [this] { return m_running == 0; });
+    m_work = nullptr;
+  }
+
+private:
+  void serve(unsigned self) {
+    std::uint64_t seen = 0;
     for (;;) {
-      const auto ret = read(fd.m_fd, buf.data(), buf.size());
-      if (ret < 0) {
-        std::cerr << "failed reading from " << filename << ", got "
-                  << std::strerror(errno) << '\n';
-        return {};
-      }
-      if (ret == 0) {
-        // end of file
-        break;
+      const std::function<void(unsigned)>* work;
+      {
+        std::unique_lock lock(m_mutex);
+        m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+        if (m_stop) {
+          return;
+        }
+        seen = m_generation;
+        work = m_work;
+      }
+      (*work)(self);
+      std::lock_guard lock(m_mutex);
+      if (--m_running == 0) {
+        m_done.notify_one();
       }
-      lemac.update(std::span(buf).first(ret));
     }
-    return tohex(lemac.finalize());
-  } else if (statbuf.st_size < 0) {
-    std::cerr << "negative filesize from stat for file " << filename << '\n';
-    return {};
   }
 
-  std::cerr << "coming here indicates a programming error\n";
+  std::vector<lemac::LeMac> m_hashers;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_start;
+  std::condition_variable m_done;
+  const std::function<void(unsigned)>* m_work{};
+  /// counts the calls to run(), so each thread takes part once in each
+  std::uint64_t m_generation{};
+  std::size_t m_running{};
+  bool m_stop{};
+};
 
-  return {};
-}
-#else
-std::string checksum(lemac::LeMac& lemac, const std::string& filename) {
+/// files smaller than this are taken by the threads a batch at a time, so
+/// they can be opened and read together
+constexpr std::uintmax_t batch_size_limit = 64 * 1024;
 
-  lemac.reset();
+/// the most files taken at once
+constexpr std::size_t max_batch = 32;
 
-  auto impl = [&](auto& ifs) -> std::string {
-    if (!ifs) {
-      std::cerr << "failed opening file " << filename << " for reading.\n";
-      return {};
+/// the number of files taken from a list at a time
+constexpr std::size_t list_window = 4096;
+} // namespace
+
+/**
+ * calculates checksum() of each file on the threads of pool, or as many of
+ * them as there are files. the largest files are started first so they do
+ * not hold up the end, the small ones are taken in batches. report(index,
+ * checksum) is called in the order of files, from one thread at a time, as
+ * soon as all files before have been reported.
+ */
+template <typename Report>
+void parallel_checksums(ChecksumThreads& pool,
+                        std::span<const std::string> files,
+                        const lemac::file_options& io, HashCache* cache,
+                        Report&& report) {
+  const auto n = files.size();
+  if (n == 0) {
+    return;
+  }
+  // stdin can not be read by several threads at once
+  const auto nthreads =
+      std::count(files.begin(), files.end(), "-") > 1
+          ? 1U
+          : static_cast<unsigned>(std::clamp<std::size_t>(pool.size(), 1, n));
+
+  // finding the sizes is mostly waiting for the file system, so it is done
+  // on all the threads. with a cache, its lookup gives the size and is kept
+  // for later instead of doing another stat. a file which will not be read
+  // counts as empty.
+  std::vector<std::uintmax_t> sizes(n);
+  std::vector<HashCache::probe> probes(cache ? n : 0);
+  std::atomic<std::size_t> next_to_stat{0};
+  pool.run([&](unsigned self) {
+    if (self >= nthreads) {
+      return;
     }
-    std::vector<std::uint8_t> buffer(1 << 20);
-    while (ifs) {
-      ifs.read((char*)buffer.data(), buffer.size());
-      lemac.update(std::span(buffer).first(ifs.gcount()));
+    constexpr std::size_t chunk = 64;
+    for (;;) {
+      const auto begin = next_to_stat.fetch_add(chunk);
+      if (begin >= n) {
+        return;
+      }
+      for (auto i = begin; i < std::min(n, begin + chunk); ++i) {
+        if (!cache || files[i] == "-") {
+          sizes[i] = size_hint(files[i]);
+          continue;
+        }
+        probes[i] = cache->lookup(files[i]);
+        const bool read = !probes[i].hash || probes[i].verify;
+        sizes[i] = read ? probes[i].key.size : 0;
+      }
     }
-    if (!ifs.eof()) {
-      std::cerr << "failed reading from file " << filename << '\n';
-      return {};
+  });
+  std::vector<std::size_t> order(n);
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+    return sizes[a] > sizes[b];
+  });
+  // deal the files like cards, so each queue is sorted by size
+  auto queues = std::make_unique<WorkQueue[]>(nthreads);
+  for (std::size_t i = 0; i < n; ++i) {
+    queues[i % nthreads].push_back(order[i]);
+  }
+
+  // reorders the results to the order of the files
+  std::mutex reorder_mutex;
+  std::vector<std::optional<lemac::tag>> pending(n);
+  std::vector<char> done(n);
+  std::size_t next_to_report = 0;
+  auto finish = [&](std::size_t index,
+                    const std::optional<lemac::tag>& answer) {
+    std::lock_guard lock(reorder_mutex);
+    pending[index] = answer;
+    done[index] = true;
+    for (; next_to_report < n && done[next_to_report]; ++next_to_report) {
+      report(next_to_report, pending[next_to_report]);
     }
-    return tohex(lemac.finalize());
   };
 
-  if (filename == "-") {
-    return impl(std::cin);
-  } else {
-    std::ifstream ifs(filename, std::ios_base::in | std::ios_base::binary);
-    return impl(ifs);
-  }
+  auto small = [&](std::size_t item) {
+    return sizes[item] < batch_size_limit && files[item] != "-";
+  };
+  pool.run([&](unsigned self) {
+    if (self >= nthreads) {
+      return;
+    }
+    auto& lemac = pool.hasher(self);
+    std::vector<std::size_t> batch;
+    std::vector<std::string> names;
+    std::vector<HashCache::probe> batch_probes;
+    for (;;) {
+      auto item = queues[self].pop_front();
+      for (unsigned k = 1; !item && k < nthreads; ++k) {
+        item = queues[(self + k) % nthreads].pop_back();
+      }
+      if (!item) {
+        // nothing is added to the queues, so all work is taken
+        return;
+      }
+      if (!small(*item)) {
+        const auto known =
+            cache ? std::span(probes).subspan(*item, 1)
+                  : std::span<const HashCache::probe>{};
+        finish(*item,
+               checksums(lemac, files.subspan(*item, 1), io, cache, known)[0]);
+        continue;
+      }
+      // the rest of the own queue is as small, since it is sorted by size
+      batch.assign(1, *item);
+      queues[self].pop_front_while(batch, max_batch, small);
+      names.clear();
+      batch_probes.clear();
+      for (const auto i : batch) {
+        names.push_back(files[i]);
+        if (cache) {
+          batch_probes.push_back(probes[i]);
+        }
+      }
+      const auto answers = checksums(lemac, names, io, cache, batch_probes);
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        finish(batch[i], answers[i]);
+      }
+    }
+  });
 }
 
-#endif
+enum class output_format { text, binary };
 
 struct options {
   // see coreutils sha256sum for explanation of these
@@ -211,79 +439,577 @@ struct options {
   bool strict = false;
   // --tag
   bool bsd_style_checksum = false;
+  // -j, --threads
+  unsigned threads = 1;
+  // --io
+  lemac::file_options io;
+  // -r, --recursive
+  bool recursive = false;
+  // -L, --follow-symlinks
+  bool follow_symlinks = false;
+  // -x, --one-file-system
+  bool one_file_system = false;
+  // --sort
+  bool sort = false;
+  // --files-from, --files0-from
+  const char* files_from = nullptr;
+  char files_separator = '\n';
+  // --cache
+  const char* cache_file = nullptr;
+  // --verify-cache, from zero to one
+  double verify_cache = 0;
+  // the cache opened from cache_file
+  HashCache* cache = nullptr;
+  // the threads for -j, unless recursive
+  ChecksumThreads* pool = nullptr;
+  // --format
+  output_format format = output_format::text;
+  // --only, sorted
+  std::vector<std::string> only;
   std::vector<const char*> filelist;
 };
 
+/**
+ * the names of files in a list, separated by newlines or NULs. it is read a
+ * part at a time, so the list can be longer than what fits in memory.
+ */
+class FileList {
+public:
+  /// @param filename the list, or "-" for stdin
+  FileList(const char* filename, char separator)
+      : m_file(std::strcmp(filename, "-") == 0 ? stdin
+                                                : std::fopen(filename, "rb")),
+        m_separator(separator), m_buffer(64 * 1024) {}
+  FileList(const FileList&) = delete;
+  FileList& operator=(const FileList&) = delete;
+  ~FileList() {
+    if (m_file && m_file != stdin) {
+      std::fclose(m_file);
+    }
+  }
+
+  /// false if the list could not be opened
+  explicit operator bool() const { return m_file != nullptr; }
+
+  /// true if reading the list failed
+  bool failed() const { return m_failed; }
+
+  /**
+   * sets name to the next name in the list, which refers to the list until
+   * the next call. empty names are skipped.
+   * @return false when there are no more names
+   */
+  bool next(std::string_view& name) {
+    for (;;) {
+      const char* const begin = m_buffer.data() + m_begin;
+      const char* const end = m_buffer.data() + m_end;
+      const auto* const separator = static_cast<const char*>(
+          std::memchr(begin, m_separator, m_end - m_begin));
+      if (separator) {
+        m_begin += static_cast<std::size_t>(separator - begin) + 1;
+        if (separator != begin) {
+          name = std::string_view(begin, separator);
+          return true;
+        }
+        continue;
+      }
+      if (m_eof) {
+        // the last name needs no separator
+        m_begin = m_end;
+        name = std::string_view(begin, end);
+        return !name.empty();
+      }
+      // keep what is left of the name and read more
+      std::memmove(m_buffer.data(), begin, m_end - m_begin);
+      m_end -= m_begin;
+      m_begin = 0;
+      if (m_end == m_buffer.size()) {
+        m_buffer.resize(2 * m_buffer.size());
+      }
+      const auto got = std::fread(m_buffer.data() + m_end, 1,
+                                  m_buffer.size() - m_end, m_file);
+      m_end += got;
+      if (got == 0) {
+        m_eof = true;
+        m_failed = std::ferror(m_file) != 0;
+      }
+    }
+  }
+
+  /**
+   * replaces names with up to max names from the list.
+   * @return false when there are no more names
+   */
+  bool next(std::vector<std::string>& names, std::size_t max) {
+    names.clear();
+    std::string_view name;
+    while (names.size() < max && next(name)) {
+      names.emplace_back(name);
+    }
+    return !names.empty();
+  }
+
+private:
+  std::FILE* m_file;
+  char m_separator;
+  std::vector<char> m_buffer;
+  /// the part of the buffer which is read but not used yet
+  std::size_t m_begin{};
+  std::size_t m_end{};
+  bool m_eof{};
+  bool m_failed{};
+};
+
+/// the outcome of parsing a line from a checksum file
+enum class line_status { ok, malformed, blank };
+
+/**
+ * parses a line of a checksum file, "HASH  FILE" where HASH is in hex. item
+ * refers to the line.
+ */
+line_status parse_checksum_line(std::string_view line,
+                                lemac::tag& expected_hash,
+                                std::string_view& item) {
+  // plain loops, find_first_of searches the set for each character
+  auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+  const auto begin = static_cast<std::size_t>(
+      std::find_if_not(line.begin(), line.end(), is_space) - line.begin());
+  if (begin == line.size()) {
+    return line_status::blank;
+  }
+  const auto end = static_cast<std::size_t>(
+      std::find_if(line.begin() + begin, line.end(), is_space) - line.begin());
+  const auto hex = line.substr(begin, end - begin);
+  if (hex.size() != 32) {
+    std::cerr << "wrong size of hash " << hex.size() << "\n";
+    return line_status::malformed;
+  }
+  const auto decoded = fromhex(hex);
+  if (!decoded) {
+    std::cerr << "wrong content of hash: \"" << hex << "\"\n";
+    return line_status::malformed;
+  }
+  expected_hash = *decoded;
+  // the two characters after the hash are a separator
+  item = line.substr(std::min(end + 2, line.size()));
+  if (item.empty()) {
+    std::cerr << "no file name after hash " << hex << '\n';
+    return line_status::malformed;
+  }
+  return line_status::ok;
+}
+
+/// prints the outcome of checking a file
+/// @return false if it counts as a failure
+bool report_verification(const options& opt, const std::string& item,
+                         const lemac::tag& expected_hash,
+                         const std::optional<lemac::tag>& actual_hash) {
+  if (!actual_hash) {
+    std::cout << item << ": FAILED open or read\n";
+    return opt.ignore_missing;
+  }
+  if (*actual_hash == expected_hash) {
+    std::cout << item << ": OK\n";
+    return true;
+  }
+  std::cerr << "got " << tohex(*actual_hash) << " expected "
+            << tohex(expected_hash) << '\n';
+  std::cout << item << ": FAILED\n";
+  return false;
+}
+
+/**
+ * checks the files against the checksums expected of them, on opt.threads
+ * threads.
+ * @return true if all were as expected
+ */
+bool verify_items(const options& opt, lemac::LeMac& lemac,
+                  std::span<const std::string> items,
+                  std::span<const lemac::tag> expected_hashes) {
+  bool good = true;
+  if (!opt.pool) {
+    // a batch at a time, to hash the files together
+    for (std::size_t i = 0; i < items.size(); i += max_batch) {
+      const auto batch =
+          items.subspan(i, std::min(max_batch, items.size() - i));
+      const auto actual_hashes = checksums(lemac, batch, opt.io, opt.cache);
+      for (std::size_t k = 0; k < batch.size(); ++k) {
+        if (!report_verification(opt, batch[k], expected_hashes[i + k],
+                                 actual_hashes[k])) {
+          good = false;
+        }
+      }
+    }
+    return good;
+  }
+  parallel_checksums(
+      *opt.pool, items, opt.io, opt.cache,
+      [&](std::size_t index, const std::optional<lemac::tag>& actual_hash) {
+        if (!report_verification(opt, items[index], expected_hashes[index],
+                                 actual_hash)) {
+          good = false;
+        }
+      });
+  return good;
+}
+
+/// @return the position of name among the files given to --only, if any
+std::optional<std::size_t> find_only(const options& opt,
+                                     std::string_view name) {
+  const auto it = std::lower_bound(opt.only.begin(), opt.only.end(), name);
+  if (it == opt.only.end() || *it != name) {
+    return {};
+  }
+  return static_cast<std::size_t>(it - opt.only.begin());
+}
+
+/// reports the files given to --only which were not found in a checksum file
+/// @return false if there were any
+bool report_unlisted(const options& opt, const std::vector<char>& found,
+                     const char* filename) {
+  bool good = true;
+  for (std::size_t i = 0; i < opt.only.size(); ++i) {
+    if (!found[i]) {
+      std::cerr << opt.only[i] << " is not listed in " << filename << '\n';
+      good = false;
+    }
+  }
+  return good;
+}
+
+/**
+ * verifies a checksum file written with --format=bin. with --only, the files
+ * are looked up in its index instead of going through all of it.
+ * @return true on success
+ */
+bool verify_binary_manifest(const options& opt, lemac::LeMac& lemac,
+                            const char* filename) {
+  try {
+    const BinaryManifest manifest(filename);
+    bool retval = true;
+    std::vector<lemac::tag> expected_hashes;
+    std::vector<std::string> items;
+    // a window of files at a time
+    auto add = [&](std::size_t i) {
+      items.emplace_back(manifest.name(i));
+      expected_hashes.push_back(manifest.hash(i));
+      if (items.size() == list_window) {
+        if (!verify_items(opt, lemac, items, expected_hashes)) {
+          retval = false;
+        }
+        items.clear();
+        expected_hashes.clear();
+      }
+    };
+    if (opt.only.empty()) {
+      for (std::size_t i = 0; i < manifest.size(); ++i) {
+        add(i);
+      }
+    } else {
+      std::vector<char> found(opt.only.size());
+      for (std::size_t k = 0; k < opt.only.size(); ++k) {
+        const auto [first, last] = manifest.find(opt.only[k]);
+        found[k] = first != last;
+        for (auto i = first; i < last; ++i) {
+          add(i);
+        }
+      }
+      if (!report_unlisted(opt, found, filename)) {
+        retval = false;
+      }
+    }
+    if (!verify_items(opt, lemac, items, expected_hashes)) {
+      retval = false;
+    }
+    return retval;
+  } catch (const std::exception& e) {
+    report_error(e);
+    return false;
+  }
+}
+
 /// @return true on success
 bool verify_checksum_from_file(const options& opt, lemac::LeMac& lemac,
                                const char* filename) {
+  if (std::strcmp(filename, "-") != 0 && is_binary_manifest(filename)) {
+    return verify_binary_manifest(opt, lemac, filename);
+  }
   bool retval = true;
-  std::ifstream list(filename);
+  FileList list(filename, '\n');
   if (!list) {
     std::cerr << "failed opening " << filename << '\n';
     return false;
   }
 
-  while (list) {
-    std::string expected_hash;
-    std::string item;
-    list >> expected_hash;
-    bool line_read_ok = true;
-    if (list.eof()) {
-      // reached the end of the file
-      break;
-    }
-    if (expected_hash.size() != 32) {
-      std::cerr << "wrong size of hash " << expected_hash.size() << "\n";
-      line_read_ok = false;
-    } else if (expected_hash.find_first_not_of("0123456789abcdef") !=
-               std::string::npos) {
-      std::cerr << "wrong content of hash: \"" << expected_hash << "\"\n";
-      line_read_ok = false;
-    }
-    list.ignore(2);
-    std::getline(list, item);
-    if (list.bad()) {
-      std::cerr << "failed parsing checksum line from " << filename << '\n';
-      line_read_ok = false;
-    }
-    if (!line_read_ok) {
-      if (opt.strict) {
-        retval = false;
+  // a window of lines at a time, so the list can be of any length
+  lemac::tag expected_hash;
+  std::string_view line;
+  std::string_view item;
+  std::vector<lemac::tag> expected_hashes;
+  std::vector<std::string> items;
+  std::vector<char> found(opt.only.size());
+  bool end = false;
+  while (!end) {
+    expected_hashes.clear();
+    items.clear();
+    while (items.size() < list_window) {
+      if (!list.next(line)) {
+        end = true;
+        break;
       }
-      continue;
-    }
-    const auto actual_hash = checksum(lemac, std::string(item));
-    if (actual_hash.empty()) {
-      std::cout << item << ": FAILED open or read\n";
-      if (!opt.ignore_missing) {
-        retval = false;
+      const auto status = parse_checksum_line(line, expected_hash, item);
+      if (status == line_status::blank) {
+        continue;
       }
-    } else {
-      if (actual_hash == expected_hash) {
-        std::cout << item << ": OK\n";
-      } else {
-        std::cerr << "got " << actual_hash << " expected " << expected_hash
-                  << '\n';
-        std::cout << item << ": FAILED\n";
-        retval = false;
+      if (status == line_status::malformed) {
+        if (opt.strict) {
+          retval = false;
+        }
+        continue;
+      }
+      if (!opt.only.empty()) {
+        const auto k = find_only(opt, item);
+        if (!k) {
+          continue;
+        }
+        found[*k] = true;
       }
+      expected_hashes.push_back(expected_hash);
+      items.emplace_back(item);
     }
+    if (!verify_items(opt, lemac, items, expected_hashes)) {
+      retval = false;
+    }
+  }
+  if (list.failed()) {
+    std::cerr << "failed reading " << filename << '\n';
+    retval = false;
+  }
+  if (!report_unlisted(opt, found, filename)) {
+    retval = false;
   }
   return retval;
 }
 
 /// @return true on success
-bool generate_checksum([[maybe_unused]] const options& opt, lemac::LeMac& lemac,
-                       const char* filename) {
-  auto answer = checksum(lemac, std::string(filename));
-  if (answer.empty()) {
+bool print_checksum(const std::optional<lemac::tag>& answer,
+                    const std::string& filename) {
+  if (!answer) {
     return false;
   } else {
     // use two spaces, just like sha256sum
-    std::cout << answer << "  " << filename << '\n';
+    std::cout << tohex(*answer) << "  " << filename << '\n';
+    return true;
+  }
+}
+
+/// a file and its checksum, for --sort and --format=bin
+using named_checksum = std::pair<std::string, lemac::tag>;
+
+/**
+ * prints the checksum of a file, or with --sort or --format=bin appends it to
+ * kept, to be output when all files are done.
+ * @return true if there was a checksum
+ */
+bool output_checksum(const options& opt,
+                     const std::optional<lemac::tag>& answer,
+                     const std::string& filename,
+                     std::vector<named_checksum>& kept) {
+  if (!answer) {
+    return false;
+  }
+  if (opt.sort || opt.format == output_format::binary) {
+    kept.emplace_back(filename, *answer);
+    return true;
+  }
+  return print_checksum(answer, filename);
+}
+
+/// @return true if all files were checksummed
+bool generate_checksums(const options& opt, lemac::LeMac& lemac,
+                        std::span<const std::string> files,
+                        std::vector<named_checksum>& kept) {
+  bool good = true;
+  // a batch at a time, so the output keeps up with the hashing
+  for (std::size_t i = 0; i < files.size(); i += max_batch) {
+    const auto batch = files.subspan(i, std::min(max_batch, files.size() - i));
+    const auto answers = checksums(lemac, batch, opt.io, opt.cache);
+    for (std::size_t k = 0; k < batch.size(); ++k) {
+      if (!output_checksum(opt, answers[k], batch[k], kept)) {
+        good = false;
+      }
+    }
+  }
+  return good;
+}
+
+/// @return true if all files were checksummed
+bool generate_checksums_parallel(const options& opt,
+                                 std::span<const std::string> files,
+                                 std::vector<named_checksum>& kept) {
+  bool good = true;
+  parallel_checksums(*opt.pool, files, opt.io, opt.cache,
+                     [&](std::size_t index,
+                         const std::optional<lemac::tag>& answer) {
+                       if (!output_checksum(opt, answer, files[index], kept)) {
+                         good = false;
+                       }
+                     });
+  return good;
+}
+
+/**
+ * checksums the files in and under roots.
+ * @return true if all files were checksummed
+ */
+bool generate_checksums_recursive(const options& opt,
+                                  const lemac::LeMac& prototype,
+                                  std::span<const std::string> roots,
+                                  std::vector<named_checksum>& kept) {
+  walk_options walk;
+  walk.follow_symlinks = opt.follow_symlinks;
+  walk.one_file_system = opt.one_file_system;
+  walk.threads = opt.threads;
+  // copying the prototype avoids setting up the key again
+  std::vector<lemac::LeMac> hashers(std::max(1U, opt.threads), prototype);
+  // the files found in directories are regular files unless links are
+  // followed, so one which is a link now has been replaced meanwhile
+  auto in_directory = opt.io;
+  in_directory.follow_symlinks = opt.follow_symlinks;
+
+  std::mutex mutex;
+  bool good = true;
+  walk_files(
+      roots, walk,
+      [&](unsigned thread, int dirfd, std::span<const std::string> files) {
+        const auto answers =
+            checksums(hashers[thread], files,
+                      dirfd >= 0 ? in_directory : opt.io, opt.cache, {}, dirfd);
+        std::lock_guard lock(mutex);
+        for (std::size_t i = 0; i < files.size(); ++i) {
+          if (!output_checksum(opt, answers[i], files[i], kept)) {
+            good = false;
+          }
+        }
+      },
+      [&](const std::string& path, std::error_code error) {
+        std::cerr << (path + ": " + error.message() + '\n');
+        std::lock_guard lock(mutex);
+        good = false;
+      });
+  return good;
+}
+
+/**
+ * outputs the checksums kept by output_checksum(), sorted by name.
+ * @return false on failure
+ */
+bool output_kept(const options& opt, std::vector<named_checksum>& kept) {
+  if (opt.format == output_format::binary) {
+    std::vector<manifest_entry> entries;
+    entries.reserve(kept.size());
+    for (auto& [file, answer] : kept) {
+      entries.push_back({std::move(file), answer});
+    }
+#if defined(_WIN32)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    if (!write_binary_manifest(stdout, entries)) {
+      std::cerr << "failed writing the checksums\n";
+      return false;
+    }
     return true;
   }
+  std::sort(kept.begin(), kept.end());
+  for (const auto& [file, answer] : kept) {
+    print_checksum(answer, file);
+  }
+  return true;
+}
+
+/**
+ * calls f(files) with the files to process, a part at a time: those listed in
+ * the file given to --files-from or --files0-from, or else those on the
+ * command line.
+ * @return false if the list could not be read
+ */
+template <typename F> bool for_each_window(const options& opt, F&& f) {
+  if (!opt.files_from) {
+    const std::vector<std::string> files(opt.filelist.begin(),
+                                         opt.filelist.end());
+    f(std::span<const std::string>(files));
+    return true;
+  }
+  FileList list(opt.files_from, opt.files_separator);
+  if (!list) {
+    std::cerr << "failed opening file list " << opt.files_from << '\n';
+    return false;
+  }
+  std::vector<std::string> files;
+  while (list.next(files, list_window)) {
+    f(std::span<const std::string>(files));
+  }
+  if (list.failed()) {
+    std::cerr << "failed reading file list " << opt.files_from << '\n';
+    return false;
+  }
+  return true;
+}
+
+/// @return the number of threads given to -j or --threads
+unsigned parse_threads(std::string_view value) {
+  unsigned threads{};
+  const auto* const end = value.data() + value.size();
+  const auto [ptr, ec] = std::from_chars(value.data(), end, threads);
+  if (ec != std::errc{} || ptr != end) {
+    std::cerr << "invalid number of threads \"" << value << "\"\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  return threads;
+}
+
+/// @return the strategy given to --io
+lemac::io_strategy parse_io(std::string_view value) {
+  if (value == "auto") {
+    return lemac::io_strategy::automatic;
+  }
+  for (const auto strategy : {lemac::io_strategy::mmap,
+                              lemac::io_strategy::read,
+                              lemac::io_strategy::uring}) {
+    if (value == lemac::to_string(strategy)) {
+      return strategy;
+    }
+  }
+  std::cerr << "invalid io method \"" << value
+            << "\", use auto, mmap, read or uring\n";
+  std::exit(EXIT_FAILURE);
+}
+
+/// @return the percentage given to --verify-cache, as a fraction
+double parse_percent(std::string_view value) {
+  double percent{};
+  const auto* const end = value.data() + value.size();
+  const auto [ptr, ec] = std::from_chars(value.data(), end, percent);
+  if (ec != std::errc{} || ptr != end || !(percent >= 0 && percent <= 100)) {
+    std::cerr << "invalid percentage \"" << value << "\"\n";
+    std::exit(EXIT_FAILURE);
+  }
+  return percent / 100;
+}
+
+/// @return the format given to --format
+output_format parse_format(std::string_view value) {
+  if (value == "text") {
+    return output_format::text;
+  }
+  if (value == "bin") {
+    return output_format::binary;
+  }
+  std::cerr << "invalid format \"" << value << "\", use text or bin\n";
+  std::exit(EXIT_FAILURE);
 }
 
 void parse_args(options& opt, int argc, char* argv[]) {
@@ -300,6 +1026,73 @@ void parse_args(options& opt, int argc, char* argv[]) {
     } else if ("--strict"sv == arg) {
       // exit non-zero for improperly formatted checksum lines
       opt.strict = true;
+    } else if ("-j"sv == arg || "--threads"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a number of threads\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.threads = parse_threads(argv[++i]);
+    } else if (arg.starts_with("--threads=")) {
+      opt.threads = parse_threads(arg.substr(10));
+    } else if (arg.starts_with("-j")) {
+      opt.threads = parse_threads(arg.substr(2));
+    } else if ("-r"sv == arg || "--recursive"sv == arg) {
+      opt.recursive = true;
+    } else if ("-L"sv == arg || "--follow-symlinks"sv == arg) {
+      opt.follow_symlinks = true;
+    } else if ("-x"sv == arg || "--one-file-system"sv == arg) {
+      opt.one_file_system = true;
+    } else if ("--sort"sv == arg) {
+      opt.sort = true;
+    } else if ("--files-from"sv == arg || "--files0-from"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a file\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.files_from = argv[++i];
+      opt.files_separator = arg == "--files0-from" ? '\0' : '\n';
+    } else if (arg.starts_with("--files-from=")) {
+      opt.files_from = argv[i] + 13;
+      opt.files_separator = '\n';
+    } else if (arg.starts_with("--files0-from=")) {
+      opt.files_from = argv[i] + 14;
+      opt.files_separator = '\0';
+    } else if ("--io"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a method\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.io.strategy = parse_io(argv[++i]);
+    } else if (arg.starts_with("--io=")) {
+      opt.io.strategy = parse_io(arg.substr(5));
+    } else if ("--cache"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a file\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.cache_file = argv[++i];
+    } else if (arg.starts_with("--cache=")) {
+      opt.cache_file = argv[i] + 8;
+    } else if ("--verify-cache"sv == arg) {
+      opt.verify_cache = 0.01;
+    } else if (arg.starts_with("--verify-cache=")) {
+      opt.verify_cache = parse_percent(arg.substr(15));
+    } else if ("--format"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a format\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.format = parse_format(argv[++i]);
+    } else if (arg.starts_with("--format=")) {
+      opt.format = parse_format(arg.substr(9));
+    } else if ("--only"sv == arg) {
+      if (i + 1 == argc) {
+        std::cerr << arg << " needs a file\n";
+        std::exit(EXIT_FAILURE);
+      }
+      opt.only.emplace_back(argv[++i]);
+    } else if (arg.starts_with("--only=")) {
+      opt.only.emplace_back(arg.substr(7));
     } else if ("--"sv == arg) {
       // end of options
       opt.filelist.reserve(argc - i);
@@ -325,11 +1118,42 @@ void parse_args(options& opt, int argc, char* argv[]) {
       std::cerr << "--ignore-missing can only be used in check mode\n";
       std::exit(EXIT_FAILURE);
     }
+    if (!opt.only.empty()) {
+      std::cerr << "--only can only be used in check mode\n";
+      std::exit(EXIT_FAILURE);
+    }
+  } else if (opt.recursive) {
+    std::cerr << "--recursive can not be used in check mode\n";
+    std::exit(EXIT_FAILURE);
+  } else if (opt.format != output_format::text) {
+    std::cerr << "--format can not be used in check mode, the format of "
+                 "checksum files is recognized\n";
+    std::exit(EXIT_FAILURE);
+  }
+  std::sort(opt.only.begin(), opt.only.end());
+  opt.only.erase(std::unique(opt.only.begin(), opt.only.end()),
+                 opt.only.end());
+  if (!opt.recursive &&
+      (opt.follow_symlinks || opt.one_file_system || opt.sort)) {
+    std::cerr << "--follow-symlinks, --one-file-system and --sort need "
+                 "--recursive\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (opt.verify_cache > 0 && !opt.cache_file) {
+    std::cerr << "--verify-cache needs --cache\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (opt.files_from && !opt.filelist.empty()) {
+    std::cerr << "files can not be given both as arguments and with "
+                 "--files-from or --files0-from\n";
+    std::exit(EXIT_FAILURE);
   }
 
   // if no files were given, use stdin (both in --check mode and generation
   // mode)
-  if (opt.filelist.empty()) {
+  if (opt.filelist.empty() && !opt.files_from) {
     opt.filelist.emplace_back("-");
   }
 }
@@ -341,13 +1165,49 @@ int main(int argc, char* argv[]) {
 
   lemac::LeMac lemac;
 
+  std::optional<HashCache> cache;
+  if (opt.cache_file) {
+    try {
+      cache.emplace(opt.cache_file, opt.verify_cache);
+    } catch (const std::exception& e) {
+      report_error(e);
+      std::exit(EXIT_FAILURE);
+    }
+    opt.cache = &*cache;
+  }
+  // -r has threads of its own for walking the directories
+  std::optional<ChecksumThreads> pool;
+  if (opt.threads > 1 && !opt.recursive) {
+    pool.emplace(opt.threads, lemac);
+    opt.pool = &*pool;
+  }
+  // writes the cache back, and fails if verifying it found a difference
+  auto save_cache = [&] {
+    if (!cache) {
+      return true;
+    }
+    bool good = cache->mismatches() == 0;
+    if (!cache->save()) {
+      std::cerr << "failed writing cache " << opt.cache_file << '\n';
+      good = false;
+    }
+    return good;
+  };
+
   if (opt.check) {
     // verify checksums given on a file or stdin
     bool bad = false;
-    for (auto f : opt.filelist) {
-      if (!verify_checksum_from_file(opt, lemac, f)) {
-        bad = true;
-      }
+    if (!for_each_window(opt, [&](std::span<const std::string> files) {
+          for (const auto& f : files) {
+            if (!verify_checksum_from_file(opt, lemac, f.c_str())) {
+              bad = true;
+            }
+          }
+        })) {
+      bad = true;
+    }
+    if (!save_cache()) {
+      bad = true;
     }
     if (bad) {
       std::exit(EXIT_FAILURE);
@@ -355,10 +1215,27 @@ int main(int argc, char* argv[]) {
   } else {
     // generate checksums
     bool bad = false;
-    for (auto f : opt.filelist) {
-      if (!generate_checksum(opt, lemac, f)) {
-        bad = true;
-      }
+    std::vector<named_checksum> kept;
+    if (!for_each_window(opt, [&](std::span<const std::string> files) {
+          bool good;
+          if (opt.recursive) {
+            good = generate_checksums_recursive(opt, lemac, files, kept);
+          } else if (opt.pool && files.size() > 1) {
+            good = generate_checksums_parallel(opt, files, kept);
+          } else {
+            good = generate_checksums(opt, lemac, files, kept);
+          }
+          if (!good) {
+            bad = true;
+          }
+        })) {
+      bad = true;
+    }
+    if (!output_kept(opt, kept)) {
+      bad = true;
+    }
+    if (!save_cache()) {
+      bad = true;
     }
     if (bad) {
       std::exit(EXIT_FAILURE);
@@ -0,0 +1,77 @@
+/*
+ * By Paul Dreik, https://www.pauldreik.se/
+ *
+ * https://github.com/pauldreik/lemac
+ * SPDX-License-Identifier: BSL-1.0
+ */
+
+/*
+ * checks that lemac_c.h can be used from C. the results are compared in
+ * depth to the c++ api by tests.cpp.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lemac_c.h>
+
+static int failures = 0;
+
+#define CHECK(x)                                                               \
+  do {                                                                         \
+    if (!(x)) {                                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x);    \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+int main(void) {
+  /* the tag of 16 zero bytes with a zero key and a zero nonce */
+  static const uint8_t expected[16] = {0x26, 0xfa, 0x47, 0x1b, 0x77, 0xfa,
+                                       0xcc, 0x73, 0xec, 0x2f, 0x9b, 0x50,
+                                       0xbb, 0x1a, 0xf8, 0x64};
+  const uint8_t key[16] = {0};
+  const uint8_t data[16] = {0};
+  const size_t alignment = lemac_state_alignment();
+  const size_t size = lemac_state_size();
+  unsigned char* const buffer = malloc(size + alignment);
+  void* storage;
+  uint8_t tag[16];
+  const uint8_t* messages[2];
+  size_t sizes[2];
+  uint8_t tags[32];
+
+  CHECK(buffer != NULL);
+  if (buffer == NULL) {
+    return EXIT_FAILURE;
+  }
+  storage = buffer + (alignment - (uintptr_t)buffer % alignment) % alignment;
+
+  CHECK(lemac_init(NULL, key) == -1);
+  CHECK(lemac_init(storage, NULL) == -1);
+  CHECK(lemac_init((unsigned char*)storage + 1, key) == -1);
+  CHECK(lemac_init(storage, key) == 0);
+
+  lemac_oneshot(storage, data, sizeof(data), NULL, tag);
+  CHECK(memcmp(tag, expected, sizeof(tag)) == 0);
+
+  lemac_update(storage, data, 5);
+  lemac_update(storage, data + 5, sizeof(data) - 5);
+  lemac_finalize(storage, NULL, tag);
+  CHECK(memcmp(tag, expected, sizeof(tag)) == 0);
+  lemac_reset(storage);
+
+  messages[0] = data;
+  messages[1] = data;
+  sizes[0] = sizeof(data);
+  sizes[1] = sizeof(data);
+  lemac_oneshot_batch(storage, 2, messages, sizes, NULL, tags);
+  CHECK(memcmp(tags, expected, sizeof(expected)) == 0);
+  CHECK(memcmp(tags + 16, expected, sizeof(expected)) == 0);
+
+  lemac_destroy(storage);
+  free(buffer);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
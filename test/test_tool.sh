@@ -74,6 +74,83 @@ echo "5f4aad4604ceefad43c9336d29671556  hej.txt" >tmp.txt
 cat tmp.txt tmp.txt >expected.txt
 compare_files multifiles.txt expected.txt
 
+echo "$me: check that hashing on several threads keeps the order of the files..."
+for i in $(seq 1 40); do
+  head -c $((i * 997)) /dev/zero >par$i.bin
+done
+"$tool" par*.bin >serial.txt
+for threads in "-j 4" "-j0" "--threads=3" "--threads 2"; do
+  "$tool" $threads par*.bin >parallel.txt
+  compare_files parallel.txt serial.txt
+done
+if "$tool" -j 2 / hej.txt >dir_parallel.txt; then
+  echo "$me: expected hashing a directory would fail, but it didn't"
+  exit 1
+fi
+echo "5f4aad4604ceefad43c9336d29671556  hej.txt" >expected.txt
+compare_files dir_parallel.txt expected.txt
+
+echo "$me: check that the files can be listed in a file or on stdin..."
+ls par*.bin >list.txt
+"$tool" --files-from list.txt >listed.txt
+compare_files listed.txt serial.txt
+tr '\n' '\0' <list.txt | "$tool" -j 3 --files0-from - >listed.txt
+compare_files listed.txt serial.txt
+"$tool" --files-from=list.txt --io=read >listed.txt
+compare_files listed.txt serial.txt
+if "$tool" --files-from list.txt hej.txt >/dev/null 2>&1; then
+  echo "$me: expected files both listed and as arguments would fail, but it didn't"
+  exit 1
+fi
+
+echo "$me: check that checksums can be cached..."
+mkdir cached
+for i in $(seq 1 5); do
+  echo $i >cached/c$i
+done
+# recently changed files are not cached
+sleep 3
+"$tool" cached/c* >expected.txt
+"$tool" --cache cache.db cached/c* >cached.txt
+compare_files cached.txt expected.txt
+"$tool" -j 3 --cache=cache.db cached/c* >cached.txt
+compare_files cached.txt expected.txt
+# the hash of the first entry is replaced, which only the cache knows of
+printf '\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0' |
+  dd of=cache.db bs=1 seek=48 conv=notrunc 2>/dev/null
+"$tool" --cache cache.db cached/c* >cached.txt
+if [ $(grep -c "^00000000000000000000000000000000 " cached.txt) -ne 1 ]; then
+  echo "$me: expected a checksum to be taken from the cache"
+  exit 1
+fi
+if "$tool" --cache cache.db --verify-cache=100 cached/c* >cached.txt; then
+  echo "$me: expected verifying the cache would fail, but it didn't"
+  exit 1
+fi
+compare_files cached.txt expected.txt
+"$tool" --cache cache.db cached/c* >cached.txt
+compare_files cached.txt expected.txt
+echo modified >>cached/c2
+"$tool" cached/c* >expected.txt
+"$tool" --cache cache.db cached/c* >cached.txt
+compare_files cached.txt expected.txt
+if "$tool" --cache expected.txt hej.txt >/dev/null 2>&1; then
+  echo "$me: expected using another file as cache would fail, but it didn't"
+  exit 1
+fi
+
+echo "$me: check that all io methods give the same result..."
+for io in "--io=auto" "--io=mmap" "--io=read" "--io uring"; do
+  "$tool" $io par*.bin >io.txt
+  compare_files io.txt serial.txt
+  "$tool" -j 3 $io par*.bin >io.txt
+  compare_files io.txt serial.txt
+done
+if "$tool" --io=fast hej.txt >/dev/null 2>&1; then
+  echo "$me: expected an invalid io method to fail, but it didn't"
+  exit 1
+fi
+
 echo "$me: check that block devices can be checksummed..."
 "$tool" /dev/null | head -c 32 >null.txt
 touch empty
@@ -103,6 +180,36 @@ fi
 echo "5f4aad4604ceefad43c9336d29671556  hej" >expected.txt
 compare_files dir.txt expected.txt
 
+echo "$me: check that directories can be checksummed recursively..."
+mkdir -p tree/a/b/c tree/d
+echo 1 >tree/x
+echo 2 >tree/a/y
+echo 3 >tree/a/b/c/z
+for i in $(seq 1 40); do
+  echo $i >tree/d/f$i
+done
+ln -s ../a tree/d/link
+mkfifo tree/fifo
+find tree -type f | LC_ALL=C sort | xargs "$tool" >expected.txt
+"$tool" -r --sort tree >recursive.txt
+compare_files recursive.txt expected.txt
+"$tool" --recursive -j 4 tree | LC_ALL=C sort -k2 >recursive.txt
+compare_files recursive.txt expected.txt
+"$tool" -r -x --sort tree >recursive.txt
+compare_files recursive.txt expected.txt
+"$tool" -r -L --sort tree | grep -c "tree/d/link/y" >link.txt
+echo 1 >expected.txt
+compare_files link.txt expected.txt
+ln -s ../.. tree/a/b/up
+if "$tool" -r -L tree >/dev/null 2>&1; then
+  echo "$me: expected a symlink loop would fail, but it didn't"
+  exit 1
+fi
+if "$tool" --sort tree/x >/dev/null 2>&1; then
+  echo "$me: expected --sort without --recursive would fail, but it didn't"
+  exit 1
+fi
+
 echo "$me: check that a checksum file can be checked..."
 echo a >a
 echo b >b
@@ -142,6 +249,82 @@ if "$tool" --strict --check malformed.txt; then
   exit 1
 fi
 
+echo "$me: check that a checksum file can be read from stdin..."
+echo b >b
+"$tool" --check abc.txt >check_file.txt
+"$tool" --check - <abc.txt >check_stdin.txt
+compare_files check_stdin.txt check_file.txt
+echo "$me: check that a checksum file can be read from a pipe..."
+"$tool" --check <(cat abc.txt) >check_pipe.txt
+compare_files check_pipe.txt check_file.txt
+mkfifo sums
+(cat abc.txt >sums) &
+"$tool" --check sums >check_fifo.txt
+wait
+compare_files check_fifo.txt check_file.txt
+echo "$me: check that --strict rejects a hash with other characters than hex..."
+sed 's/^./G/' abc.txt >nothex.txt
+if "$tool" --strict --check nothex.txt >/dev/null 2>&1; then
+  echo "$me: succeded, expected it to fail"
+  exit 1
+fi
+
+echo "$me: check that a binary checksum file can be checked..."
+echo b >b
+"$tool" --format=bin a b c >abc.bin
+"$tool" --check abc.txt >check_text.txt
+"$tool" --check abc.bin >check_bin.txt
+compare_files check_bin.txt check_text.txt
+"$tool" -j 3 --check abc.bin >check_bin.txt
+compare_files check_bin.txt check_text.txt
+"$tool" --only c --only a --check abc.bin >check_bin.txt
+printf "a: OK\nc: OK\n" >expected.txt
+compare_files check_bin.txt expected.txt
+"$tool" --only=c --check abc.txt >check_text.txt
+echo "c: OK" >expected.txt
+compare_files check_text.txt expected.txt
+if "$tool" --only d --check abc.bin >/dev/null 2>&1; then
+  echo "$me: expected checking a file which is not listed would fail, but it didn't"
+  exit 1
+fi
+head -c 40 abc.bin >truncated.bin
+if "$tool" --check truncated.bin >/dev/null 2>&1; then
+  echo "$me: expected a truncated binary checksum file would fail, but it didn't"
+  exit 1
+fi
+
+echo "$me: check that --check on several threads behaves the same..."
+echo b >b
+"$tool" par*.bin a b c >many.txt
+"$tool" --check many.txt >check_serial.txt
+"$tool" -j 4 --check many.txt >check_parallel.txt
+compare_files check_parallel.txt check_serial.txt
+echo modified >>b
+if "$tool" -j 4 --check many.txt >check_parallel.txt; then
+  echo "$me: went well, but expected the verification to fail"
+  exit 1
+fi
+grep -q "^b: FAILED$" check_parallel.txt
+rm b
+if "$tool" -j 4 --check many.txt >check_parallel.txt; then
+  echo "$me: went well, but expected the verification to fail"
+  exit 1
+fi
+if ! "$tool" -j 4 --ignore-missing --check many.txt >check_parallel.txt; then
+  echo "$me: failed, but expected success"
+  exit 1
+fi
+echo b >b
+cat many.txt malformed.txt >many_malformed.txt
+if ! "$tool" -j 4 --check many_malformed.txt >/dev/null 2>&1; then
+  echo "$me: failed, expected it to succeed"
+  exit 1
+fi
+if "$tool" -j 4 --strict --check many_malformed.txt >/dev/null 2>&1; then
+  echo "$me: succeded, expected it to fail"
+  exit 1
+fi
+
 # verify the one byte files
 echo "$me: testing all possible one byte files..."
 testdatadir="$rootdir/test/"
@@ -160,7 +343,9 @@ fi
 (
   cd "$testdatadir"
   "$tool" --strict --check one_byte_files.lemacsum >$workdir/one_byte_check
+  "$tool" -j 3 --strict --check one_byte_files.lemacsum >$workdir/one_byte_check_parallel
 )
+compare_files one_byte_check_parallel one_byte_check
 count=$(grep OK one_byte_check | wc -l)
 if [ $count -ne 256 ]; then
   echo "$me: failed count, expected 256 but got $count"
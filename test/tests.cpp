@@ -4,16 +4,34 @@
  * https://github.com/pauldreik/lemac
  * SPDX-License-Identifier: BSL-1.0
  */
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <numeric>
+#include <thread>
 #include <span>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/generators/catch_generators.hpp>
 
 #include <lemac.h>
+#include <lemac_async.h>
+#include <lemac_c.h>
+#include <lemac_cache.h>
+#include <lemac_file.h>
+#include <lemac_parallel.h>
+#include <lemac_pool.h>
+#include <lemac_service.h>
+#include <lemac_streamset.h>
 
 /*
  * from running ./test_vectors.py, taken from
@@ -309,6 +327,959 @@ TEST_CASE("unaligned access") {
   REQUIRE(tohex(lemac::LeMac{K}.oneshot(M.get(), N)) == expected);
 }
 
+TEST_CASE("large inputs give the same result regardless of chunking") {
+  // large enough to take the streaming path, with a partial block at the end
+  constexpr auto MSIZE = 1024 * 1024 + 17;
+
+  const std::size_t alignment = GENERATE(0u, 1u, 16u);
+  auto M = unaligned_buf(alignment, MSIZE);
+  auto inputdata = M.get();
+  std::iota(std::begin(inputdata), std::end(inputdata), 0);
+
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  lemac::LeMac lm(key);
+
+  // small chunks never reach the streaming path
+  constexpr std::size_t bytes_at_a_time = 1000;
+  for (auto remaining = inputdata; !remaining.empty();) {
+    const auto consumed = std::min(bytes_at_a_time, remaining.size());
+    lm.update(remaining.first(consumed));
+    remaining = remaining.subspan(consumed);
+  }
+  const auto expected = lm.finalize(nonce);
+
+  lm.reset();
+  lm.update(inputdata);
+  REQUIRE(lm.finalize(nonce) == expected);
+
+  REQUIRE(lm.oneshot(inputdata, nonce) == expected);
+}
+
+TEST_CASE("tuning the kernels does not change the result") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  std::vector<std::uint8_t> data(300 * 1000);
+  std::iota(data.begin(), data.end(), 0);
+
+  const std::size_t size =
+      GENERATE(0u, 1u, 64u, 257u, 4096u, 5000u, 70000u, 300000u);
+  const auto message = std::span(data).first(size);
+
+  lemac::LeMac lm(key);
+  const auto before = lm.oneshot(message, nonce);
+  lm.update(message);
+  REQUIRE(lm.finalize(nonce) == before);
+
+  const auto table = lemac::tune();
+  REQUIRE(table == lemac::get_tuning_table());
+  REQUIRE_FALSE(lemac::to_string(table).empty());
+  for (std::size_t i = 1; i < table.oneshot.size(); ++i) {
+    REQUIRE(table.oneshot[i - 1].max_size < table.oneshot[i].max_size);
+  }
+
+  REQUIRE(lm.oneshot(message, nonce) == before);
+  lm.reset();
+  lm.update(message);
+  REQUIRE(lm.finalize(nonce) == before);
+}
+
+TEST_CASE("all available backends give the same result") {
+  const auto backends = lemac::available_backends();
+  REQUIRE_FALSE(backends.empty());
+  REQUIRE(std::ranges::find(backends, lemac::current_backend()) !=
+          backends.end());
+  REQUIRE(lemac::LeMac{}.get_backend() == lemac::current_backend());
+
+  constexpr auto MSIZE = 65;
+  uint8_t M[MSIZE] = {};
+  uint8_t N[16] = {};
+  uint8_t K[16] = {};
+  std::iota(std::begin(M), std::end(M), 0);
+  std::iota(std::begin(N), std::end(N), 0);
+  std::iota(std::begin(K), std::end(K), 0);
+  const std::string expected = "d58dfdbe8b0224e1d5106ac4d775beef";
+
+  for (const auto backend : backends) {
+    lemac::LeMac lm(std::span(K, 16), backend);
+    REQUIRE(lm.get_backend() == backend);
+    REQUIRE(tohex(lm.oneshot(std::span(M), std::span(N))) == expected);
+    lm.update(std::span(M));
+    REQUIRE(tohex(lm.finalize(std::span(N))) == expected);
+
+    // the backend survives copying
+    const auto copy = lm;
+    REQUIRE(copy.get_backend() == backend);
+
+    REQUIRE(lemac::LeMac{backend}.oneshot({}) == lemac::LeMac{}.oneshot({}));
+  }
+}
+
+TEST_CASE("unavailable backends can not be selected") {
+  const auto backends = lemac::available_backends();
+  for (const auto backend :
+       {lemac::backend::aes128, lemac::backend::vaes512full,
+        lemac::backend::arm64_v8a}) {
+    if (std::ranges::find(backends, backend) == backends.end()) {
+      REQUIRE_THROWS(lemac::LeMac{backend});
+    }
+  }
+}
+
+TEST_CASE("copy and hash gives the same result as hash") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+
+  // the largest size is large enough to use non-temporal stores
+  const std::size_t size =
+      GENERATE(0u, 1u, 63u, 64u, 65u, 1000u, 4 * 1024 * 1024 + 5);
+  const std::size_t dst_alignment = GENERATE(0u, 1u);
+  const std::size_t bytes_at_a_time = GENERATE(1u, 100u, 4096u, 1u << 30);
+
+  std::vector<std::uint8_t> data(size);
+  std::iota(data.begin(), data.end(), 0);
+  auto dst_ = unaligned_buf(dst_alignment, size);
+  auto dst = dst_.get();
+
+  lemac::LeMac lm(key);
+  const auto expected = lm.oneshot(data, nonce);
+
+  REQUIRE(lm.copy_and_oneshot(dst, data, nonce) == expected);
+  REQUIRE(std::ranges::equal(dst, data));
+
+  std::ranges::fill(dst, 0);
+  for (std::size_t offset = 0; offset < size;) {
+    const auto consumed = std::min(bytes_at_a_time, size - offset);
+    lm.copy_and_update(dst.subspan(offset),
+                       std::span(data).subspan(offset, consumed));
+    offset += consumed;
+  }
+  REQUIRE(lm.finalize(nonce) == expected);
+  REQUIRE(std::ranges::equal(dst, data));
+}
+
+TEST_CASE("copy and hash requires a large enough destination") {
+  std::array<std::uint8_t, 10> data{};
+  std::array<std::uint8_t, 9> dst{};
+  lemac::LeMac lm;
+  REQUIRE_THROWS(lm.copy_and_update(dst, data));
+  REQUIRE_THROWS(lm.copy_and_oneshot(dst, data));
+}
+
+TEST_CASE("stream set gives the same result as hash") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  const std::size_t bytes_at_a_time = GENERATE(1u, 13u, 64u, 1000u);
+
+  for (const auto backend : lemac::available_backends()) {
+    const lemac::LeMac lm(key, backend);
+    lemac::StreamSet set(lm);
+
+    // streams of different length, so groups of different sizes are formed
+    constexpr std::size_t nstreams = 19;
+    std::vector<std::vector<std::uint8_t>> messages(nstreams);
+    std::vector<lemac::StreamSet::stream_id> ids;
+    for (std::size_t i = 0; i < nstreams; ++i) {
+      messages[i].resize(i * i * 17 + i);
+      std::iota(messages[i].begin(), messages[i].end(), i);
+      ids.push_back(set.open());
+    }
+    REQUIRE(set.size() == nstreams);
+
+    for (std::size_t offset = 0, round = 0;; offset += bytes_at_a_time) {
+      bool any = false;
+      for (std::size_t i = 0; i < nstreams; ++i) {
+        const std::span message(messages[i]);
+        if (offset < message.size()) {
+          const auto n = std::min(bytes_at_a_time, message.size() - offset);
+          set.enqueue(ids[i], message.subspan(offset, n));
+          any = true;
+        }
+      }
+      if (!any) {
+        break;
+      }
+      if (++round % 3 == 0) {
+        set.flush();
+        REQUIRE(set.pending_bytes() < nstreams * 64);
+      }
+    }
+
+    for (std::size_t i = 0; i < nstreams; ++i) {
+      const auto expected = i % 2 == 0 ? lm.oneshot(messages[i])
+                                       : lm.oneshot(messages[i], nonce);
+      const auto actual =
+          i % 2 == 0 ? set.finalize(ids[i]) : set.finalize(ids[i], nonce);
+      REQUIRE(actual == expected);
+    }
+    REQUIRE(set.size() == 0);
+
+    // ids are reused after being finalized
+    const auto id = set.open();
+    REQUIRE(id < nstreams);
+    set.enqueue(id, messages[3]);
+    REQUIRE(set.finalize(id) == lm.oneshot(messages[3]));
+  }
+}
+
+TEST_CASE("stream set rejects streams which are not open") {
+  lemac::StreamSet set{lemac::LeMac{}};
+  const std::array<std::uint8_t, 3> data{};
+  REQUIRE_THROWS(set.enqueue(0, data));
+  const auto id = set.open();
+  set.enqueue(id, data);
+  set.close(id);
+  REQUIRE_THROWS(set.enqueue(id, data));
+  REQUIRE_THROWS(set.finalize(id));
+  REQUIRE_THROWS(set.close(id));
+}
+
+TEST_CASE("parallel oneshot gives the same result as oneshot") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const unsigned threads = GENERATE(0u, 1u, 2u, 7u);
+  // the outputs are placed unaligned as well, to exercise the piece
+  // boundaries both with and without cache line alignment
+  const std::size_t output_offset = GENERATE(0u, 1u, 8u);
+
+  // large enough in total to be worth using several threads, with a few
+  // large messages among many small ones
+  std::vector<std::vector<std::uint8_t>> messages(3000);
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    messages[i].resize(i % 500 == 0 ? 1000000 + i : i % 300);
+    std::iota(messages[i].begin(), messages[i].end(), i);
+  }
+  const std::vector<std::span<const std::uint8_t>> inputs(messages.begin(),
+                                                          messages.end());
+
+  const lemac::LeMac lm(key);
+  std::vector<std::uint8_t> storage((inputs.size() + 1) * sizeof(lemac::tag));
+  const std::span outputs(
+      reinterpret_cast<lemac::tag*>(storage.data() + output_offset),
+      inputs.size());
+  lemac::parallel_oneshot(lm, inputs, outputs, threads);
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    REQUIRE(outputs[i] == lm.oneshot(inputs[i]));
+  }
+
+  // empty input is fine
+  lemac::parallel_oneshot(lm, {}, {}, threads);
+
+  REQUIRE_THROWS(lemac::parallel_oneshot(lm, inputs, outputs.first(3)));
+}
+
+TEST_CASE("verify accepts the right tag only") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  const std::array<std::uint8_t, 100> data{7};
+  const lemac::LeMac lm(key);
+  auto tag = lm.oneshot(data, nonce);
+  REQUIRE(lm.verify(data, nonce, tag));
+  const auto position = GENERATE(0u, 7u, 8u, 15u);
+  tag[position] ^= 0x10;
+  REQUIRE_FALSE(lm.verify(data, nonce, tag));
+
+  REQUIRE_THROWS(lm.verify(data, std::span(nonce).first(15), tag));
+  REQUIRE_THROWS(lm.verify(data, nonce, std::span(tag).first(15)));
+}
+
+TEST_CASE("verify many gives the same result as verify") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const lemac::LeMac lm(key);
+  const bool use_nonces = GENERATE(false, true);
+  const bool corrupt = GENERATE(false, true);
+
+  // more than fits in one chunk, of varying sizes
+  std::vector<std::vector<std::uint8_t>> messages(300);
+  std::vector<std::array<std::uint8_t, 16>> nonce_storage(messages.size());
+  std::vector<lemac::tag> tags(messages.size());
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    messages[i].resize(i * 7 % 500);
+    std::iota(messages[i].begin(), messages[i].end(), i);
+    nonce_storage[i][0] = static_cast<std::uint8_t>(i);
+    tags[i] = use_nonces ? lm.oneshot(messages[i], nonce_storage[i])
+                         : lm.oneshot(messages[i]);
+  }
+  if (corrupt) {
+    tags[3][5] ^= 1;
+    tags[299][0] ^= 1;
+  }
+  const std::vector<std::span<const std::uint8_t>> inputs(messages.begin(),
+                                                          messages.end());
+  std::vector<std::span<const std::uint8_t>> nonces;
+  if (use_nonces) {
+    nonces.assign(nonce_storage.begin(), nonce_storage.end());
+  }
+
+  std::unique_ptr<bool[]> results(new bool[messages.size()]);
+  const std::span result_span(results.get(), messages.size());
+  REQUIRE(lm.verify_many(inputs, nonces, tags, result_span) == !corrupt);
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    const bool expected = !corrupt || (i != 3 && i != 299);
+    REQUIRE(results[i] == expected);
+  }
+  // the combined result alone
+  REQUIRE(lm.verify_many(inputs, nonces, tags, {}) == !corrupt);
+
+  REQUIRE_THROWS(
+      lm.verify_many(inputs, nonces, std::span(tags).first(3), {}));
+  REQUIRE_THROWS(lm.verify_many(inputs, nonces, tags, result_span.first(3)));
+  REQUIRE_THROWS(
+      lm.verify_many(inputs, std::span(inputs).first(3), tags, {}));
+}
+
+TEST_CASE("context cache gives the same result as a new hasher") {
+  lemac::ContextCache cache(3);
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  const std::array<std::uint8_t, 100> data{7};
+  std::array<std::array<std::uint8_t, 16>, 5> keys{};
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    keys[i][0] = static_cast<std::uint8_t>(i + 1);
+  }
+
+  // go through the keys twice, so some are evicted and made again
+  for (int round = 0; round < 2; ++round) {
+    for (const auto& key : keys) {
+      REQUIRE(cache.oneshot(key, data, nonce) ==
+              lemac::LeMac(key).oneshot(data, nonce));
+      REQUIRE(cache.get(key)->oneshot(data) == lemac::LeMac(key).oneshot(data));
+    }
+  }
+  // evictions invalidate the per thread tables, so the exact number of
+  // misses depends on the order of the lookups
+  const auto stats = cache.get_statistics();
+  REQUIRE(stats.entries == 3);
+  REQUIRE(stats.hits + stats.misses == 20);
+  REQUIRE(stats.misses >= keys.size());
+  REQUIRE(stats.evictions == stats.misses - 3);
+
+  // a hasher lives on after it is dropped from the cache, but only as long
+  // as it is referred to from outside of it
+  const auto hasher = cache.get(keys[0]);
+  cache.clear();
+  REQUIRE(cache.get_statistics().entries == 0);
+  REQUIRE(hasher.use_count() == 1);
+  REQUIRE(hasher->oneshot(data) == lemac::LeMac(keys[0]).oneshot(data));
+  // after clear, even the per thread table misses
+  const auto misses = cache.get_statistics().misses;
+  cache.get(keys[0]);
+  REQUIRE(cache.get_statistics().misses == misses + 1);
+
+  REQUIRE_THROWS(cache.get(std::span(keys[0]).first(15)));
+  REQUIRE_THROWS(lemac::ContextCache(0));
+}
+
+TEST_CASE("free oneshot with a key gives the same result as a new hasher") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  const std::array<std::uint8_t, 100> data{7};
+  const lemac::LeMac lm(key);
+  for (int i = 0; i < 3; ++i) {
+    REQUIRE(lemac::oneshot(key, data, nonce) == lm.oneshot(data, nonce));
+    REQUIRE(lemac::oneshot(key, data) == lm.oneshot(data));
+  }
+}
+
+TEST_CASE("context cache can be used from several threads") {
+  lemac::ContextCache cache(4);
+  const std::array<std::uint8_t, 100> data{7};
+  std::array<lemac::tag, 8> expected;
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    const std::array<std::uint8_t, 16> key{static_cast<std::uint8_t>(i)};
+    expected[i] = lemac::LeMac(key).oneshot(data);
+  }
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (std::size_t i = 0; i < 1000; ++i) {
+        const auto k = (i * (t + 1)) % expected.size();
+        const std::array<std::uint8_t, 16> key{static_cast<std::uint8_t>(k)};
+        if (cache.oneshot(key, data, std::array<std::uint8_t, 16>{}) !=
+            expected[k]) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(failures == 0);
+  const auto stats = cache.get_statistics();
+  REQUIRE(stats.hits + stats.misses == 4000);
+  REQUIRE(stats.entries <= 4);
+}
+
+#if LEMAC_HAS_MEMORY_RESOURCE
+namespace {
+/// counts the allocations which are still outstanding
+class CountingResource final : public std::pmr::memory_resource {
+public:
+  int outstanding = 0;
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++outstanding;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, std::size_t bytes,
+                     std::size_t alignment) override {
+    --outstanding;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+} // namespace
+
+TEST_CASE("hasher can be allocated from a memory resource") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 100> data{7};
+  const auto expected = lemac::LeMac(key).oneshot(data);
+
+  CountingResource resource;
+  {
+    lemac::LeMac lm(key, &resource);
+    REQUIRE(resource.outstanding == 1);
+    REQUIRE(lm.get_memory_resource() == &resource);
+    REQUIRE(lm.oneshot(data) == expected);
+
+    // plain copies go to the global heap
+    auto copy = lm;
+    REQUIRE(resource.outstanding == 1);
+    REQUIRE(copy.get_memory_resource() == nullptr);
+    copy.update(data);
+    REQUIRE(copy.finalize() == expected);
+    copy = lm;
+    REQUIRE(resource.outstanding == 1);
+    REQUIRE(copy.get_memory_resource() == nullptr);
+
+    // unless told otherwise
+    const lemac::LeMac in_resource(lm, &resource);
+    REQUIRE(resource.outstanding == 2);
+    REQUIRE(in_resource.get_memory_resource() == &resource);
+    REQUIRE(in_resource.oneshot(data) == expected);
+    const lemac::LeMac on_heap(lm, nullptr);
+    REQUIRE(resource.outstanding == 2);
+    REQUIRE(on_heap.get_memory_resource() == nullptr);
+    REQUIRE(on_heap.oneshot(data) == expected);
+    lemac::LeMac back(on_heap, &resource);
+    REQUIRE(resource.outstanding == 3);
+
+    // moving takes the memory along
+    lemac::LeMac moved = std::move(back);
+    REQUIRE(resource.outstanding == 3);
+    REQUIRE(moved.get_memory_resource() == &resource);
+    moved = on_heap;
+    REQUIRE(resource.outstanding == 2);
+    REQUIRE(moved.oneshot(data) == expected);
+
+    for (const auto b : lemac::available_backends()) {
+      const lemac::LeMac with_backend(key, b, &resource);
+      REQUIRE(with_backend.get_backend() == b);
+      REQUIRE(with_backend.oneshot(data) == expected);
+    }
+  }
+  REQUIRE(resource.outstanding == 0);
+
+  REQUIRE(lemac::LeMac(key, nullptr).get_memory_resource() == nullptr);
+}
+#endif
+
+TEST_CASE("hasher pool hands out hashers in their initial state") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 100> data{7};
+  const auto expected = lemac::LeMac(key).oneshot(data);
+
+  lemac::HasherPool pool(key, 2);
+  REQUIRE(pool.size() == 2);
+  REQUIRE(pool.available() == 2);
+  {
+    auto a = pool.acquire();
+    auto b = pool.acquire();
+    REQUIRE(pool.available() == 0);
+    // the pool is empty, so this one is extra
+    auto c = pool.acquire();
+    REQUIRE(&*a != &*b);
+    for (auto* h : {&a, &b, &c}) {
+      (*h)->update(data);
+      REQUIRE((*h)->finalize() == expected);
+      // leave some data behind, which must not be seen by the next user
+      (*h)->update(data);
+    }
+    auto moved = std::move(c);
+    REQUIRE(moved->oneshot(data) == expected);
+    a = std::move(b);
+    REQUIRE(pool.available() == 1);
+  }
+  REQUIRE(pool.available() == 2);
+  for (int i = 0; i < 3; ++i) {
+    auto h = pool.acquire();
+    h->update(data);
+    REQUIRE(h->finalize() == expected);
+  }
+
+  REQUIRE_THROWS(lemac::HasherPool(std::span(key).first(15), 2));
+}
+
+TEST_CASE("hasher pool can be used from several threads") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 100> data{7};
+  const auto expected = lemac::LeMac(key).oneshot(data);
+  lemac::HasherPool pool(key, 3);
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; ++i) {
+        auto h = pool.acquire();
+        h->update(data);
+        if (h->finalize() != expected) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(failures == 0);
+  REQUIRE(pool.available() == 3);
+}
+
+TEST_CASE("c api gives the same result as the c++ api") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const std::array<std::uint8_t, 16> nonce{4, 5, 6};
+  const std::array<std::uint8_t, 100> data{7};
+  const lemac::LeMac lm(key);
+
+  const auto alignment = lemac_state_alignment();
+  REQUIRE(alignment >= alignof(void*));
+  REQUIRE(lemac_state_size() >= sizeof(void*));
+  std::vector<std::uint8_t> buffer(lemac_state_size() + alignment);
+  void* storage = buffer.data();
+  std::size_t space = buffer.size();
+  REQUIRE(std::align(alignment, lemac_state_size(), storage, space));
+
+  REQUIRE(lemac_init(static_cast<std::uint8_t*>(storage) + 1, key.data()) ==
+          -1);
+  REQUIRE(lemac_init(nullptr, key.data()) == -1);
+  REQUIRE(lemac_init(storage, nullptr) == -1);
+  REQUIRE(lemac_init(storage, key.data()) == 0);
+
+  lemac::tag tag;
+  lemac_oneshot(storage, data.data(), data.size(), nonce.data(), tag.data());
+  REQUIRE(tag == lm.oneshot(data, nonce));
+  lemac_oneshot(storage, nullptr, 0, nullptr, tag.data());
+  REQUIRE(tag == lm.oneshot({}));
+
+  // update in pieces, then reset and do it again
+  for (int round = 0; round < 2; ++round) {
+    lemac_update(storage, data.data(), 30);
+    lemac_update(storage, data.data() + 30, data.size() - 30);
+    lemac_finalize(storage, nonce.data(), tag.data());
+    REQUIRE(tag == lm.oneshot(data, nonce));
+    lemac_reset(storage);
+  }
+
+  // more messages than are handed over at a time
+  std::vector<std::vector<std::uint8_t>> messages(70);
+  std::vector<const std::uint8_t*> pointers;
+  std::vector<std::size_t> sizes;
+  std::vector<std::array<std::uint8_t, 16>> nonce_storage(messages.size());
+  std::vector<const std::uint8_t*> nonces;
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    messages[i].resize(i * 13);
+    std::iota(messages[i].begin(), messages[i].end(), i);
+    pointers.push_back(messages[i].data());
+    sizes.push_back(messages[i].size());
+    nonce_storage[i][3] = static_cast<std::uint8_t>(i);
+    nonces.push_back(nonce_storage[i].data());
+  }
+  std::vector<std::uint8_t> tags(16 * messages.size());
+  const bool use_nonces = GENERATE(false, true);
+  lemac_oneshot_batch(storage, messages.size(), pointers.data(), sizes.data(),
+                      use_nonces ? nonces.data() : nullptr, tags.data());
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    const auto expected = use_nonces ? lm.oneshot(messages[i], nonce_storage[i])
+                                     : lm.oneshot(messages[i]);
+    REQUIRE(
+        std::equal(expected.begin(), expected.end(), tags.begin() + 16 * i));
+  }
+
+  lemac_destroy(storage);
+}
+
+TEST_CASE("hash service gives the same result as oneshot") {
+  const std::array<std::uint8_t, 16> key{1, 2, 3};
+  const lemac::LeMac lm(key);
+  lemac::HashService::options opts;
+  opts.workers = GENERATE(1u, 3u);
+  opts.max_batch = GENERATE(1u, 64u);
+  opts.max_delay = std::chrono::microseconds{GENERATE(0, 50)};
+
+  constexpr std::size_t producers = 4;
+  constexpr std::size_t per_producer = 500;
+  std::vector<std::vector<std::uint8_t>> messages(producers * per_producer);
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    messages[i].resize(i % 250);
+    std::iota(messages[i].begin(), messages[i].end(), i);
+  }
+
+  // even messages use a callback, odd ones a future
+  std::vector<lemac::tag> results(messages.size());
+  std::vector<std::future<lemac::tag>> futures(messages.size());
+  {
+    lemac::HashService service(lm, opts);
+    REQUIRE(service.workers() == opts.workers);
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p] {
+        for (std::size_t i = p; i < messages.size(); i += producers) {
+          const std::array<std::uint8_t, 16> nonce{
+              static_cast<std::uint8_t>(i)};
+          if (i % 2 == 0) {
+            service.submit(messages[i], nonce,
+                           [&, i](const lemac::tag& hash) {
+                             results[i] = hash;
+                           });
+          } else {
+            futures[i] = service.submit(messages[i], nonce);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    // the futures can be waited for while the service is running
+    REQUIRE(futures[1].get() ==
+            lm.oneshot(messages[1], std::array<std::uint8_t, 16>{1}));
+    futures[1] = {};
+    // the destructor completes the rest
+  }
+  for (std::size_t i = 0; i < messages.size(); ++i) {
+    const std::array<std::uint8_t, 16> nonce{static_cast<std::uint8_t>(i)};
+    const auto expected = lm.oneshot(messages[i], nonce);
+    if (i % 2 == 0) {
+      REQUIRE(results[i] == expected);
+    } else if (futures[i].valid()) {
+      REQUIRE(futures[i].get() == expected);
+    }
+  }
+}
+
+TEST_CASE("hash service keeps statistics") {
+  lemac::HashService::options opts;
+  opts.max_batch = 10;
+  lemac::HashService service(lemac::LeMac{}, opts);
+  const std::array<std::uint8_t, 100> data{};
+  std::vector<std::future<lemac::tag>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(service.submit(data));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  const auto stats = service.get_statistics();
+  REQUIRE(stats.submitted == 100);
+  REQUIRE(stats.completed == 100);
+  REQUIRE(stats.queue_depth == 0);
+  REQUIRE(stats.batches >= 10);
+  REQUIRE(stats.max_batch_size >= 1);
+  REQUIRE(stats.max_batch_size <= 10);
+  REQUIRE(stats.max_queue_depth >= 1);
+  REQUIRE(stats.mean_batch_size() >= 1.0);
+}
+
+TEST_CASE("hash service requires a correctly sized nonce") {
+  lemac::HashService service(lemac::LeMac{});
+  const std::array<std::uint8_t, 15> nonce{};
+  REQUIRE_THROWS(service.submit({}, nonce));
+  REQUIRE_THROWS(service.submit({}, nonce, [](const auto&) {}));
+
+  lemac::HashService::options opts;
+  opts.max_batch = 0;
+  REQUIRE_THROWS(lemac::HashService(lemac::LeMac{}, opts));
+}
+
+TEST_CASE("hash_file gives the same result as oneshot") {
+  const auto size = GENERATE(0, 1, 4096, 64 * 1024, 300 * 1024 + 7);
+  std::vector<std::uint8_t> data(static_cast<std::size_t>(size));
+  std::iota(data.begin(), data.end(), std::uint8_t{3});
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("lemac_hash_file_test_" + std::to_string(size));
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+    REQUIRE(out);
+  }
+
+  lemac::LeMac lemac;
+  lemac::file_options options;
+  options.nonce = {1, 2, 3};
+  options.buffer_size = 1000;
+  options.bypass_cache = GENERATE(false, true);
+  options.uring_depth = GENERATE(1U, 3U);
+  const auto expected = lemac.oneshot(data, options.nonce);
+  for (const auto strategy :
+       {lemac::io_strategy::automatic, lemac::io_strategy::mmap,
+        lemac::io_strategy::read, lemac::io_strategy::uring,
+        lemac::io_strategy::reader_thread}) {
+    options.strategy = strategy;
+    const auto result = lemac::hash_file(lemac, path, options);
+    REQUIRE(result.hash == expected);
+    REQUIRE(result.bytes == data.size());
+    REQUIRE(result.strategy != lemac::io_strategy::automatic);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("hash_file maps large files a window at a time") {
+  // windows are a multiple of 64 KiB, this gives one which is partly filled
+  const auto size = GENERATE(3 * 64 * 1024, 7 * 64 * 1024 + 100);
+  std::vector<std::uint8_t> data(static_cast<std::size_t>(size));
+  std::iota(data.begin(), data.end(), std::uint8_t{5});
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("lemac_hash_file_window_test_" + std::to_string(size));
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+    REQUIRE(out);
+  }
+
+  lemac::LeMac lemac;
+  lemac::file_options options;
+  options.strategy = lemac::io_strategy::mmap;
+  options.nonce = {4, 5, 6};
+  options.mmap_window = GENERATE(std::size_t{1}, std::size_t{64 * 1024},
+                                 std::size_t{100 * 1024});
+  options.bypass_cache = GENERATE(false, true);
+  const auto result = lemac::hash_file(lemac, path, options);
+  REQUIRE(result.hash == lemac.oneshot(data, options.nonce));
+  REQUIRE(result.bytes == data.size());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("hash_files gives the same result as hash_file") {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "lemac_hash_files_test";
+  std::filesystem::create_directories(dir);
+  // more than one batch, with files of all kinds in between
+  std::vector<std::filesystem::path> paths;
+  std::vector<std::vector<std::uint8_t>> contents;
+  for (std::size_t i = 0; i < 150; ++i) {
+    const auto size = i % 50 == 7 ? 200 * 1024 + i : i * 13;
+    contents.emplace_back(size);
+    std::iota(contents.back().begin(), contents.back().end(),
+              static_cast<std::uint8_t>(i));
+    paths.push_back(dir / ("file" + std::to_string(i)));
+    std::ofstream out(paths.back(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(contents.back().data()),
+              static_cast<std::streamsize>(size));
+    REQUIRE(out);
+  }
+  paths.insert(paths.begin() + 70, dir / "does_not_exist");
+  contents.insert(contents.begin() + 70, std::vector<std::uint8_t>{});
+  paths.insert(paths.begin() + 3, dir);
+  contents.insert(contents.begin() + 3, std::vector<std::uint8_t>{});
+
+  lemac::LeMac lemac;
+  lemac::file_options options;
+  options.nonce = {7};
+  options.strategy = GENERATE(
+      lemac::io_strategy::automatic, lemac::io_strategy::mmap,
+      lemac::io_strategy::read, lemac::io_strategy::uring);
+  const auto outcomes = lemac::hash_files(lemac, paths, options);
+  REQUIRE(outcomes.size() == paths.size());
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    if (i == 3 || i == 71) {
+      REQUIRE(outcomes[i].error);
+      REQUIRE_THROWS_AS(std::rethrow_exception(outcomes[i].error),
+                        std::system_error);
+    } else {
+      REQUIRE_FALSE(outcomes[i].error);
+      REQUIRE(outcomes[i].result.hash ==
+              lemac.oneshot(contents[i], options.nonce));
+      REQUIRE(outcomes[i].result.bytes == contents[i].size());
+    }
+  }
+  std::filesystem::remove_all(dir);
+}
+
+#if !defined(_WIN32)
+TEST_CASE("hash_files opens the file names relative to a directory") {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "lemac_hash_files_at_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const std::vector<std::uint8_t> data(1000, 42);
+  {
+    std::ofstream out(dir / "file", std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+  }
+  std::filesystem::create_symlink("file", dir / "link");
+  const int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  REQUIRE(dirfd != -1);
+
+  lemac::LeMac lemac;
+  lemac::file_options options;
+  options.strategy =
+      GENERATE(lemac::io_strategy::automatic, lemac::io_strategy::read);
+  options.follow_symlinks = GENERATE(false, true);
+  // the directories in the paths are only for the messages
+  const std::vector<std::filesystem::path> paths{"elsewhere/file",
+                                                 "elsewhere/link"};
+  const auto outcomes = lemac::hash_files(lemac, dirfd, paths, options);
+  close(dirfd);
+  REQUIRE(outcomes.size() == 2);
+  REQUIRE_FALSE(outcomes[0].error);
+  REQUIRE(outcomes[0].result.hash == lemac.oneshot(data));
+  if (options.follow_symlinks) {
+    REQUIRE_FALSE(outcomes[1].error);
+    REQUIRE(outcomes[1].result.hash == lemac.oneshot(data));
+  } else {
+    REQUIRE(outcomes[1].error);
+    REQUIRE_THROWS_AS(std::rethrow_exception(outcomes[1].error),
+                      std::system_error);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("hash_file reads pipes") {
+  std::vector<std::uint8_t> data(200 * 1000 + 5);
+  std::iota(data.begin(), data.end(), std::uint8_t{11});
+  lemac::LeMac lemac;
+  lemac::file_options options;
+  options.strategy = GENERATE(
+      lemac::io_strategy::automatic, lemac::io_strategy::read,
+      lemac::io_strategy::uring, lemac::io_strategy::reader_thread);
+  options.buffer_size = 4096;
+
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  // catch2 assertions must not be used from other threads
+  bool written = true;
+  std::thread writer([&] {
+    for (std::size_t i = 0; i < data.size(); i += 3000) {
+      const auto n = std::min<std::size_t>(3000, data.size() - i);
+      if (write(fds[1], data.data() + i, n) != static_cast<long>(n)) {
+        written = false;
+        break;
+      }
+    }
+    close(fds[1]);
+  });
+  const auto result = lemac::hash_file(lemac, fds[0], options);
+  writer.join();
+  close(fds[0]);
+  REQUIRE(written);
+  REQUIRE(result.hash == lemac.oneshot(data));
+  REQUIRE(result.bytes == data.size());
+}
+#endif
+
+TEST_CASE("hash_file reports errors") {
+  lemac::LeMac lemac;
+  REQUIRE_THROWS_AS(
+      lemac::hash_file(lemac, std::filesystem::temp_directory_path()),
+      std::system_error);
+  REQUIRE_THROWS_AS(
+      lemac::hash_file(lemac, "this/file/does/not/exist"), std::system_error);
+}
+
+#if !defined(_WIN32)
+TEST_CASE("async_hash gives the same result as oneshot") {
+  const auto backend =
+      GENERATE(lemac::io_backend::automatic, lemac::io_backend::threads);
+  std::vector<std::uint8_t> data(1000 * 1000 + 3);
+  std::iota(data.begin(), data.end(), std::uint8_t{7});
+  const auto path =
+      std::filesystem::temp_directory_path() / "lemac_async_hash_test";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+    REQUIRE(out);
+  }
+  lemac::LeMac lemac;
+  const std::array<std::uint8_t, 16> nonce{9};
+  const auto expected = lemac.oneshot(data, nonce);
+
+  lemac::IoContext::options opts;
+  opts.backend = backend;
+  lemac::IoContext io(opts);
+  REQUIRE(io.backend() != lemac::io_backend::automatic);
+
+  SECTION("one file") {
+    const int fd = open(path.c_str(), O_RDONLY);
+    REQUIRE(fd != -1);
+    REQUIRE(lemac::sync_wait(io, lemac::async_hash(io, lemac, fd, nonce)) ==
+            expected);
+    close(fd);
+  }
+
+  SECTION("many files at once") {
+    constexpr std::size_t files = 200;
+    std::vector<int> fds;
+    std::vector<lemac::tag> hashes(files);
+    auto hash_into = [&](int fd, lemac::tag& out) -> lemac::task<> {
+      out = co_await lemac::async_hash(io, lemac, fd, nonce, 64 * 1024);
+    };
+    for (std::size_t i = 0; i < files; ++i) {
+      fds.push_back(open(path.c_str(), O_RDONLY));
+      REQUIRE(fds.back() != -1);
+      io.spawn(hash_into(fds.back(), hashes[i]));
+    }
+    io.run();
+    for (const auto& hash : hashes) {
+      REQUIRE(hash == expected);
+    }
+    for (const int fd : fds) {
+      close(fd);
+    }
+  }
+
+  SECTION("a pipe") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    // catch2 assertions must not be used from other threads
+    bool written = true;
+    std::thread writer([&] {
+      for (std::size_t i = 0; i < data.size(); i += 10000) {
+        const auto n = std::min<std::size_t>(10000, data.size() - i);
+        if (write(fds[1], data.data() + i, n) != static_cast<long>(n)) {
+          written = false;
+          break;
+        }
+      }
+      close(fds[1]);
+    });
+    const auto hash =
+        lemac::sync_wait(io, lemac::async_hash(io, lemac, fds[0], nonce, 4096));
+    writer.join();
+    close(fds[0]);
+    REQUIRE(written);
+    REQUIRE(hash == expected);
+  }
+
+  SECTION("errors are thrown") {
+    const int fd = open(std::filesystem::temp_directory_path().c_str(),
+                        O_RDONLY | O_DIRECTORY);
+    REQUIRE(fd != -1);
+    REQUIRE_THROWS_AS(
+        lemac::sync_wait(io, lemac::async_hash(io, lemac, fd, nonce)),
+        std::system_error);
+    close(fd);
+  }
+  std::filesystem::remove(path);
+}
+#endif
+
 TEST_CASE("hash can be copied and moved") {
   const std::array<std::uint8_t, 16> key{1, 2, 3};
   const std::array<std::uint8_t, 16> nonce_a{4, 5, 6};